@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "core/riscv.h"
+
+// 任务的停止方式
+enum {
+    BATCH_STOP_EBREAK = 0,
+    BATCH_STOP_TRAP,
+    BATCH_STOP_WFI,             // wfi 请求挂起 (riscv_run_budget 返回 1) 之后没有继续执行
+    BATCH_STOP_TIMEOUT,
+    BATCH_STOP_LOAD,            // 镜像不存在或者比 Flash 大 没有执行
+};
+
+static const char* batch_stop_name[] = { "ebreak", "trap", "wfi", "timeout", "load" };
+
+typedef struct _batch_check_t {
+    int reg;                    // -1 表示 pc
+    riscv_word_t value;
+}batch_check_t;
+
+typedef struct _batch_job_t {
+    char* image;
+    uint64_t timeout;
+    int expect;
+    int check_count;
+    batch_check_t checks[BATCH_MAX_CHECKS];
+}batch_job_t;
+
+// 工作线程依次领取下一个任务  结果写完一整行后才释放输出锁 不同任务的输出不会交错
+typedef struct _batch_pool_t {
+    struct _riscv_t* layout;
+    batch_job_t* jobs;
+    int count;
+    volatile uint32_t next;
+    volatile uint32_t failures;
+    volatile uint32_t running;
+    mutex_t out_lock;
+}batch_pool_t;
+
+// 解析一行中除镜像路径外的选项  格式错误时返回 -1
+static int batch_parse_option(batch_job_t* job, char* option) {
+    char* value = strchr(option, '=');
+    if (value == NULL) {
+        return -1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(option, "expect") == 0) {
+        for (int i = 0; i <= BATCH_STOP_TIMEOUT; i++) {
+            if (strcmp(value, batch_stop_name[i]) == 0) {
+                job->expect = i;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    char* end;
+    uint64_t number = strtoull(value, &end, 0);
+    if ((*value == '\0') || (*end != '\0')) {
+        return -1;
+    }
+
+    if (strcmp(option, "timeout") == 0) {
+        job->timeout = number;
+        return 0;
+    }
+
+    int reg;
+    if (strcmp(option, "pc") == 0) {
+        reg = -1;
+    }
+    else if ((option[0] == 'x') && (option[1] != '\0')) {
+        reg = (int)strtoul(option + 1, &end, 10);
+        if ((*end != '\0') || (reg >= RISCV_REG_NUM)) {
+            return -1;
+        }
+    }
+    else {
+        return -1;
+    }
+
+    if (job->check_count >= BATCH_MAX_CHECKS) {
+        return -1;
+    }
+    job->checks[job->check_count].reg = reg;
+    job->checks[job->check_count].value = (riscv_word_t)number;
+    job->check_count++;
+    return 0;
+}
+
+static int batch_parse(batch_pool_t* pool, const char* manifest) {
+    FILE* file = fopen(manifest, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open batch manifest %s\n", manifest);
+        return -1;
+    }
+
+    int capacity = 0;
+    int line_num = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+
+        char* image = strtok(line, " \t\r\n");
+        if ((image == NULL) || (image[0] == '#')) {
+            continue;
+        }
+
+        if (pool->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            pool->jobs = (batch_job_t*)realloc(pool->jobs, capacity * sizeof(batch_job_t));
+            assert(pool->jobs != NULL);
+        }
+
+        batch_job_t* job = &pool->jobs[pool->count++];
+        memset(job, 0, sizeof(batch_job_t));
+        job->image = strdup(image);
+        job->timeout = BATCH_DEFAULT_TIMEOUT;
+        job->expect = BATCH_STOP_EBREAK;
+
+        char* option;
+        while ((option = strtok(NULL, " \t\r\n")) != NULL) {
+            if (batch_parse_option(job, option) < 0) {
+                fprintf(stderr, "%s:%d: invalid option %s\n", manifest, line_num, option);
+                fclose(file);
+                return -1;
+            }
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// 按 JSON 字符串的规则输出  路径中可能有反斜杠
+static int batch_json_string(char* buf, int size, const char* str) {
+    int len = 0;
+    for (; *str && (len < size - 7); str++) {
+        unsigned char c = (unsigned char)*str;
+        if ((c == '"') || (c == '\\')) {
+            buf[len++] = '\\';
+            buf[len++] = c;
+        }
+        else if (c < 0x20) {
+            len += snprintf(buf + len, size - len, "\\u%04x", c);
+        }
+        else {
+            buf[len++] = c;
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// 把上一个任务写过的 RAM 和 Flash 页清零  上一个任务留下的内容不能影响下一个任务的结果
+// 只处理写过的页 每个任务的开销与它访问的存储器大小成正比 而不是与存储器总大小成正比
+static void batch_mem_clear(struct _riscv_t* riscv) {
+    riscv_machine_t* machine = riscv->machine;
+    for (int i = 0; i < machine->device_count; i++) {
+        riscv_device_t* dev = machine->device_map[i];
+        if (dev->type == RISCV_DEVICE_MEM) {
+            mem_clear((mem_t*)dev);
+        }
+    }
+}
+
+static void batch_run_job(batch_pool_t* pool, struct _riscv_t* riscv, int index) {
+    batch_job_t* job = &pool->jobs[index];
+    uint64_t start = plat_time_us();
+
+    // 复用同一个实例: 存储器清零后重新写入 Flash 再复位 与冷启动一样
+    int stop = BATCH_STOP_LOAD;
+    batch_mem_clear(riscv);
+    int size = riscv_load_image(riscv, job->image);
+    riscv_reset(riscv);
+    if (size >= 0) {
+        int rc = riscv_run_budget(riscv, job->timeout);
+        if (rc == 0) {
+            stop = BATCH_STOP_TIMEOUT;
+        }
+        else if (rc > 0) {
+            stop = BATCH_STOP_WFI;
+        }
+        else {
+            stop = (riscv->instr.raw == EBREAK) ? BATCH_STOP_EBREAK : BATCH_STOP_TRAP;
+        }
+    }
+    uint64_t us = plat_time_us() - start;
+
+    char reason[128] = "";
+    if (stop != job->expect) {
+        snprintf(reason, sizeof(reason), "stopped by %s, expected %s", batch_stop_name[stop], batch_stop_name[job->expect]);
+    }
+    for (int i = 0; (i < job->check_count) && (reason[0] == '\0'); i++) {
+        batch_check_t* check = &job->checks[i];
+        riscv_word_t value = (check->reg < 0) ? riscv->pc : riscv_read_reg(riscv, check->reg);
+        if (value != check->value) {
+            if (check->reg < 0) {
+                snprintf(reason, sizeof(reason), "pc=0x%" PRIxWORD ", expected 0x%" PRIxWORD, value, check->value);
+            }
+            else {
+                snprintf(reason, sizeof(reason), "x%d=0x%" PRIxWORD ", expected 0x%" PRIxWORD, check->reg, value, check->value);
+            }
+        }
+    }
+
+    // 先在本地拼好一整行 再加锁输出
+    char image[512];
+    batch_json_string(image, sizeof(image), job->image);
+
+    char line[1024];
+    int len = snprintf(line, sizeof(line), "{\"job\":%d,\"image\":\"%s\",\"status\":\"%s\",\"stop\":\"%s\",\"pc\":\"0x%" PRIxWORD "\",\"instret\":%llu,\"us\":%llu",
+        index, image, reason[0] ? "fail" : "pass", batch_stop_name[stop], riscv->pc,
+        (unsigned long long)riscv_get_instret(riscv), (unsigned long long)us);
+    if (reason[0]) {
+        len += snprintf(line + len, sizeof(line) - len, ",\"reason\":\"%s\"", reason);
+        atomic_add_u32(&pool->failures, 1);
+    }
+    snprintf(line + len, sizeof(line) - len, "}\n");
+
+    mutex_lock(&pool->out_lock);
+    fputs(line, stdout);
+    fflush(stdout);
+    mutex_unlock(&pool->out_lock);
+}
+
+static void batch_worker(batch_pool_t* pool) {
+    // 每个线程只分配一次实例和存储器 之后所有任务复用
+    struct _riscv_t* riscv = riscv_clone(pool->layout);
+    riscv->machine->quiet = 1;
+
+    while (1) {
+        int i = (int)atomic_add_u32(&pool->next, 1);
+        if (i >= pool->count) {
+            break;
+        }
+        batch_run_job(pool, riscv, i);
+    }
+
+    riscv_clone_destroy(riscv);
+}
+
+static void batch_thread(void* param) {
+    batch_pool_t* pool = (batch_pool_t*)param;
+    batch_worker(pool);
+    atomic_add_u32(&pool->running, (uint32_t)-1);
+}
+
+int batch_run(struct _riscv_t* layout, const char* manifest, int jobs) {
+    batch_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.layout = layout;
+    mutex_init(&pool.out_lock);
+
+    int rc = batch_parse(&pool, manifest);
+    if ((rc == 0) && pool.count) {
+        if (jobs <= 0) {
+            jobs = plat_cpu_count();
+        }
+        if (jobs > pool.count) {
+            jobs = pool.count;
+        }
+
+        // 当前线程也参与执行
+        uint64_t start = plat_time_ms();
+        pool.running = jobs - 1;
+        for (int i = 1; i < jobs; i++) {
+            thread_create(batch_thread, &pool);
+        }
+        batch_worker(&pool);
+        while (atomic_load_u32(&pool.running)) {
+            thread_msleep(1);
+        }
+
+        fprintf(stderr, "batch: %d/%d jobs passed in %llu ms on %d threads\n", pool.count - (int)pool.failures, pool.count,
+            (unsigned long long)(plat_time_ms() - start), jobs);
+        rc = (int)pool.failures;
+    }
+
+    for (int i = 0; i < pool.count; i++) {
+        free(pool.jobs[i].image);
+    }
+    free(pool.jobs);
+    return rc;
+}
@@ -0,0 +1,20 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "plat/plat.h"
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+// 清单文件每行一个任务  # 开始的行和空行忽略  数值可以是十进制或者 0x 开头的十六进制
+//     image.bin [timeout=N] [expect=ebreak|trap|wfi|timeout] [pc=V] [xN=V ...]
+// timeout: 最多执行的指令数 超过后停止 (默认 BATCH_DEFAULT_TIMEOUT)  用指令数而不是时间 结果与宿主机负载无关
+// expect:  期望的停止方式 默认 ebreak    pc/xN: 停止时检查的寄存器值
+#define BATCH_DEFAULT_TIMEOUT   100000000ull
+#define BATCH_MAX_CHECKS        8
+
+// 按清单在 jobs 个线程中执行所有镜像 (0 表示宿主机的处理器数量)  每个线程使用一个按 layout 布局预先分配的实例
+// 每个任务结束时向标准输出写一行 JSON   返回失败的任务数量 清单本身有错误时返回 -1
+int batch_run(struct _riscv_t* layout, const char* manifest, int jobs);
+
+#endif /* BATCH_H */
@@ -0,0 +1,402 @@
+#include "instr_implements.h"
+#include <stddef.h>
+#include <fenv.h>
+
+// CSR 查找表: 以 12 位地址为下标 一次访问找到对应的读写方式
+// 普通 CSR 只记录字段偏移和 WARL 可写掩码  有副作用的 CSR 使用读写函数
+typedef riscv_word_t (*riscv_csr_read_t)(riscv_t* riscv, riscv_word_t addr);
+typedef void (*riscv_csr_write_t)(riscv_t* riscv, riscv_word_t addr, riscv_word_t val);
+
+typedef struct _riscv_csr_entry_t {
+    riscv_csr_read_t read;          // 为 NULL 时直接读取字段
+    riscv_csr_write_t write;        // 为 NULL 时按掩码写入字段
+    uint16_t offset;                // 字段在 riscv_csr_t 中的偏移
+    uint8_t present;                // 为 0 表示该地址没有实现
+    riscv_word_t mask;              // 可写位 其余位保持不变
+}riscv_csr_entry_t;
+
+#define CSR_FIELD(field, mask)      { NULL, NULL, offsetof(riscv_csr_t, field), 1, mask }
+#define CSR_FIELD_WRITE(field, write)   { NULL, write, offsetof(riscv_csr_t, field), 1, 0 }
+#define CSR_FUNC(read, write)       { read, write, 0, 1, 0 }
+#define CSR_ALL                     ((riscv_word_t)-1)
+
+// misa: 最高两位 MXL 为 1 (RV32) 或 2 (RV64) + 已经实现的扩展
+#define MISA_EXT(c)     (1 << ((c) - 'A'))
+#define MISA_MXL        ((riscv_word_t)(RISCV_XLEN / 32) << (RISCV_XLEN - 2))
+#define MISA_VALUE      (MISA_MXL | MISA_EXT('A') | MISA_EXT('C') | MISA_EXT('F') | MISA_EXT('I') | MISA_EXT('M') | MISA_EXT('S') | MISA_EXT('U') | MISA_EXT('V'))
+
+// 取出宿主机浮点环境中累积的异常标志 合并到 fflags 后清空
+riscv_word_t riscv_fpu_flags(riscv_t* riscv) {
+    int except = fetestexcept(FE_ALL_EXCEPT);
+    if (except) {
+        riscv->fflags |= ((except & FE_INEXACT) ? FFLAGS_NX : 0)
+                       | ((except & FE_UNDERFLOW) ? FFLAGS_UF : 0)
+                       | ((except & FE_OVERFLOW) ? FFLAGS_OF : 0)
+                       | ((except & FE_DIVBYZERO) ? FFLAGS_DZ : 0)
+                       | ((except & FE_INVALID) ? FFLAGS_NV : 0);
+        feclearexcept(FE_ALL_EXCEPT);
+    }
+    return riscv->fflags;
+}
+
+static void riscv_fpu_set(riscv_t* riscv, riscv_word_t fflags, riscv_word_t frm) {
+    feclearexcept(FE_ALL_EXCEPT);
+    riscv->fflags = fflags & 0x1F;
+    riscv->frm = frm & 0x7;
+    fesetround(fpu_host_round(riscv->frm));
+}
+
+// 浮点 CSR
+static riscv_word_t csr_read_fpu(riscv_t* riscv, riscv_word_t addr) {
+    switch (addr) {
+    case RISCV_FFLAGS:
+        return riscv_fpu_flags(riscv);
+    case RISCV_FRM:
+        return riscv->frm;
+    default:
+        return (riscv->frm << 5) | riscv_fpu_flags(riscv);
+    }
+}
+
+static void csr_write_fpu(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    switch (addr) {
+    case RISCV_FFLAGS:
+        riscv_fpu_set(riscv, val, riscv->frm);
+        break;
+    case RISCV_FRM:
+        riscv_fpu_set(riscv, riscv_fpu_flags(riscv), val);
+        break;
+    default:
+        riscv_fpu_set(riscv, val, val >> 5);
+        break;
+    }
+}
+
+// 向量 CSR 全部只读 向量指令总是从头执行完 vstart 恒为 0
+static riscv_word_t csr_read_vector(riscv_t* riscv, riscv_word_t addr) {
+    switch (addr) {
+    case RISCV_CSR_VL:
+        return riscv->vl;
+    case RISCV_CSR_VTYPE:
+        return riscv->vtype;
+    case RISCV_CSR_VLENB:
+        return RISCV_VLENB;
+    default:
+        return 0;
+    }
+}
+
+static void csr_write_ignore(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+}
+
+// 退休指令数 = 已经执行完的块累加值 + 当前块中位于 pc 之前的指令数
+uint64_t riscv_get_instret(riscv_t* riscv) {
+    uint64_t count = riscv->instret;
+    riscv_block_t* block = riscv->exec_block;
+    if (block) {
+        for (int i = 0; (i < block->count) && (block->instrs[i].pc != riscv->pc); i++) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// 机器共用的 time 周期数: 本 hart 推算的值超过机器已记录的最大值时更新 否则沿用最大值
+static uint64_t csr_time_cycles(riscv_t* riscv, uint64_t instret) {
+    volatile uint64_t* time = &riscv->machine->time_cycles;
+    uint64_t local = instret * riscv->cpi + riscv->riscv_csr_regs.time_offset;
+    uint64_t now = atomic_load_u64(time);
+    while (local > now) {
+        if (atomic_cas_u64(time, now, local)) {
+            return local;
+        }
+        now = atomic_load_u64(time);
+    }
+    return now;
+}
+
+// 计数器的原始值: 周期数由指令数乘以 CPI 得到 不需要在执行循环中单独累加
+// index 为地址的低 2 位: 0 cycle  1 time  2 instret
+static uint64_t csr_counter_base(riscv_t* riscv, riscv_word_t index, uint64_t instret) {
+    switch (index) {
+    case 0:
+        return instret * riscv->cpi;
+    case 1:
+        return csr_time_cycles(riscv, instret) / RISCV_CYCLES_PER_TICK;
+    default:
+        return instret;
+    }
+}
+
+// 计数器: RV64 直接读写完整的 64 位  RV32 偶数地址是低 32 位 高 32 位的地址多 0x80
+// 用户级的 cycle/time/instret 与 M 模式的计数器读到的是同一个值
+static riscv_word_t csr_read_counter(riscv_t* riscv, riscv_word_t addr) {
+    riscv_word_t index = addr & 0x3;
+    uint64_t val = csr_counter_base(riscv, index, riscv_get_instret(riscv));
+    if (index == 0) {
+        val += riscv->riscv_csr_regs.mcycle_offset;
+    }
+    else if (index == 2) {
+        val += riscv->riscv_csr_regs.minstret_offset;
+    }
+    return (addr & 0x80) ? (riscv_word_t)(val >> 32) : (riscv_word_t)val;
+}
+
+// 写入只替换一半 保存的是与原始值的差值  写计数器的这条指令本身退休后 下一条指令读到的正好是写入值
+static void csr_write_counter(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t index = addr & 0x3;
+    uint64_t* offset = (index == 0) ? &riscv->riscv_csr_regs.mcycle_offset : &riscv->riscv_csr_regs.minstret_offset;
+    uint64_t base = csr_counter_base(riscv, index, riscv_get_instret(riscv) + 1);
+    uint64_t current = base + *offset;
+
+#if RISCV_XLEN == 64
+    current = val;
+#else
+    if (addr & 0x80) {
+        current = (current & 0xFFFFFFFFULL) | ((uint64_t)val << 32);
+    }
+    else {
+        current = (current & ~0xFFFFFFFFULL) | val;
+    }
+#endif
+    *offset = current - base;
+}
+
+void riscv_set_cpi(riscv_t* riscv, uint32_t cpi) {
+    if (cpi == 0) {
+        cpi = 1;
+    }
+    uint64_t instret = riscv_get_instret(riscv);
+    riscv->riscv_csr_regs.mcycle_offset += instret * riscv->cpi - instret * cpi;
+    riscv->riscv_csr_regs.time_offset += instret * riscv->cpi - instret * cpi;
+    riscv->cpi = cpi;
+    riscv_timer_update(riscv);
+}
+
+// MPP 只能是已经实现的特权级 写入保留值 2 时保持不变
+// 浮点指令不跟踪是否修改了浮点状态 FS 只要不是 Off 就报告为 Dirty 操作系统切换任务时总会保存浮点寄存器
+// 特权相关的位发生变化 地址转换状态和中断判断都要重新计算
+static void csr_write_mstatus(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t mask = MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MPRV | SSTATUS_MASK;
+    riscv_word_t old = riscv->riscv_csr_regs.mstatus;
+    if (((val & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT) == 2) {
+        val = (val & ~MSTATUS_MPP) | (old & MSTATUS_MPP);
+    }
+    val &= ~MSTATUS_SD;
+    if (val & MSTATUS_FS) {
+        val |= MSTATUS_FS | MSTATUS_SD;
+    }
+    riscv->riscv_csr_regs.mstatus = (old & ~(mask | MSTATUS_SD)) | (val & (mask | MSTATUS_SD));
+    riscv_mmu_update(riscv);
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+}
+
+// sstatus 只是 mstatus 中 S 模式可见的部分 另外能读到只读的 UXL 和 SD
+static riscv_word_t csr_read_sstatus(riscv_t* riscv, riscv_word_t addr) {
+    return riscv->riscv_csr_regs.mstatus & (SSTATUS_MASK | MSTATUS_UXL | MSTATUS_SD);
+}
+
+static void csr_write_sstatus(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t mstatus = riscv->riscv_csr_regs.mstatus;
+    csr_write_mstatus(riscv, RISCV_MSTATUS, (mstatus & ~SSTATUS_MASK) | (val & SSTATUS_MASK));
+}
+
+// 中断使能发生变化 让执行循环在下一个块边界重新判断
+static void csr_write_mie(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv->riscv_csr_regs.mie = val & (MIP_MSIP | MIP_MTIP | MIP_MEIP | MIP_S_MASK);
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+}
+
+// mip 可能正被设备线程修改 读取也使用原子操作
+static riscv_word_t csr_read_mip(riscv_t* riscv, riscv_word_t addr) {
+    return atomic_load_u32(&riscv->riscv_csr_regs.mip);
+}
+
+// M 级挂起位由设备设置 软件只能修改 S 级的三位
+static void csr_write_mip(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_mip_update(riscv, val & MIP_S_MASK, 1);
+    riscv_mip_update(riscv, ~val & MIP_S_MASK, 0);
+}
+
+// sie/sip 只能看到委托给 S 模式的中断  sip 中只有 SSIP 可写
+static riscv_word_t csr_read_sint(riscv_t* riscv, riscv_word_t addr) {
+    riscv_word_t val = (addr == RISCV_SIE) ? riscv->riscv_csr_regs.mie : riscv->riscv_csr_regs.mip;
+    return val & riscv->riscv_csr_regs.mideleg;
+}
+
+static void csr_write_sint(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t deleg = riscv->riscv_csr_regs.mideleg;
+    if (addr == RISCV_SIE) {
+        csr_write_mie(riscv, RISCV_MIE, (riscv->riscv_csr_regs.mie & ~deleg) | (val & deleg));
+    }
+    else if (deleg & MIP_SSIP) {
+        riscv_mip_update(riscv, MIP_SSIP, (val & MIP_SSIP) != 0);
+    }
+}
+
+static void csr_write_mideleg(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv->riscv_csr_regs.mideleg = val & MIP_S_MASK;
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+}
+
+// mtvec/stvec 的模式只支持 0 直接 和 1 向量  其它值保持原来的模式
+static void csr_write_tvec(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t* tvec = (addr == RISCV_MTVEC) ? &riscv->riscv_csr_regs.mtvec : &riscv->riscv_csr_regs.stvec;
+    if ((val & 0x3) > 1) {
+        val = (val & ~0x3) | (*tvec & 0x3);
+    }
+    *tvec = val;
+}
+
+// 只支持 Bare 和 Sv32/Sv39  ASID 固定为 0   换页表时 TLB 全部作废
+// 写入不支持的模式时整个写入无效 (RV32 的模式只有一位 不会出现这种情况)
+static void csr_write_satp(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    riscv_word_t mode = val & SATP_MODE;
+    if ((mode != 0) && (mode != SATP_MODE_PAGED)) {
+        return;
+    }
+    riscv->riscv_csr_regs.satp = val & (SATP_MODE | SATP_PPN);
+    riscv_tlb_flush(riscv, 0, 1);
+    riscv_mmu_update(riscv);
+}
+
+static const riscv_csr_entry_t csr_table[RISCV_CSR_NUM] = {
+    [RISCV_FFLAGS]      = CSR_FUNC(csr_read_fpu, csr_write_fpu),
+    [RISCV_FRM]         = CSR_FUNC(csr_read_fpu, csr_write_fpu),
+    [RISCV_FCSR]        = CSR_FUNC(csr_read_fpu, csr_write_fpu),
+    [RISCV_CSR_VSTART]  = CSR_FUNC(csr_read_vector, csr_write_ignore),
+    [RISCV_CSR_VL]      = CSR_FUNC(csr_read_vector, NULL),
+    [RISCV_CSR_VTYPE]   = CSR_FUNC(csr_read_vector, NULL),
+    [RISCV_CSR_VLENB]   = CSR_FUNC(csr_read_vector, NULL),
+
+    [RISCV_SSTATUS]     = CSR_FUNC(csr_read_sstatus, csr_write_sstatus),
+    [RISCV_SIE]         = CSR_FUNC(csr_read_sint, csr_write_sint),
+    [RISCV_STVEC]       = CSR_FIELD_WRITE(stvec, csr_write_tvec),
+    [RISCV_SCOUNTEREN]  = CSR_FIELD(scounteren, 0x7),
+    [RISCV_SSCRATCH]    = CSR_FIELD(sscratch, CSR_ALL),
+    [RISCV_SEPC]        = CSR_FIELD(sepc, CSR_ALL & ~1),
+    [RISCV_SCAUSE]      = CSR_FIELD(scause, CSR_ALL),
+    [RISCV_STVAL]       = CSR_FIELD(stval, CSR_ALL),
+    [RISCV_SIP]         = CSR_FUNC(csr_read_sint, csr_write_sint),
+    [RISCV_SATP]        = CSR_FIELD_WRITE(satp, csr_write_satp),
+
+    [RISCV_MSTATUS]     = CSR_FIELD_WRITE(mstatus, csr_write_mstatus),
+    [RISCV_MISA]        = CSR_FIELD(misa, 0),
+    [RISCV_MEDELEG]     = CSR_FIELD(medeleg, 0xB3FF),  // M 模式的 ecall 不能委托
+    [RISCV_MIDELEG]     = CSR_FIELD_WRITE(mideleg, csr_write_mideleg),
+    [RISCV_MIE]         = CSR_FIELD_WRITE(mie, csr_write_mie),
+    [RISCV_MTVEC]       = CSR_FIELD_WRITE(mtvec, csr_write_tvec),
+    [RISCV_MCOUNTEREN]  = CSR_FIELD(mcounteren, 0x7),
+    [RISCV_MSCRATCH]    = CSR_FIELD(mscratch, CSR_ALL),
+    [RISCV_MEPC]        = CSR_FIELD(mepc, CSR_ALL & ~1),
+    [RISCV_MCAUSE]      = CSR_FIELD(mcause, CSR_ALL),
+    [RISCV_MTVAL]       = CSR_FIELD(mtval, CSR_ALL),
+    [RISCV_MIP]         = CSR_FUNC(csr_read_mip, csr_write_mip),
+
+    [RISCV_MCYCLE]      = CSR_FUNC(csr_read_counter, csr_write_counter),
+    [RISCV_MINSTRET]    = CSR_FUNC(csr_read_counter, csr_write_counter),
+    [RISCV_CYCLE]       = CSR_FUNC(csr_read_counter, NULL),
+    [RISCV_TIME]        = CSR_FUNC(csr_read_counter, NULL),
+    [RISCV_INSTRET]     = CSR_FUNC(csr_read_counter, NULL),
+
+    // 高 32 位的 CSR 只存在于 RV32
+#if RISCV_XLEN == 32
+    [RISCV_MSTATUSH]    = CSR_FIELD(zero, 0),
+    [RISCV_MCYCLEH]     = CSR_FUNC(csr_read_counter, csr_write_counter),
+    [RISCV_MINSTRETH]   = CSR_FUNC(csr_read_counter, csr_write_counter),
+    [RISCV_CYCLEH]      = CSR_FUNC(csr_read_counter, NULL),
+    [RISCV_TIMEH]       = CSR_FUNC(csr_read_counter, NULL),
+    [RISCV_INSTRETH]    = CSR_FUNC(csr_read_counter, NULL),
+#endif
+
+    [RISCV_MVENDORID]   = CSR_FIELD(zero, 0),
+    [RISCV_MARCHID]     = CSR_FIELD(zero, 0),
+    [RISCV_MIMPID]      = CSR_FIELD(zero, 0),
+    [RISCV_MHARTID]     = CSR_FIELD(mhartid, 0),
+};
+
+static inline riscv_word_t* csr_field(riscv_t* riscv, riscv_word_t addr) {
+    return (riscv_word_t*)((uint8_t*)&riscv->riscv_csr_regs + csr_table[addr].offset);
+}
+
+// CSR 寄存器相关
+void riscv_csr_init(riscv_t* riscv) {
+    riscv_word_t mhartid = riscv->riscv_csr_regs.mhartid;
+    memset(&riscv->riscv_csr_regs, 0, sizeof(riscv->riscv_csr_regs));
+
+    riscv->riscv_csr_regs.mstatus = MSTATUS_MPP | MSTATUS_SXL | MSTATUS_UXL;        // 复位后 MPP 为 M  mret 回到 M 模式
+    riscv->riscv_csr_regs.misa = MISA_VALUE;
+    riscv->riscv_csr_regs.mhartid = mhartid;
+
+    // 外设不随内核复位 仍然有效的中断线保留在 MEIP 中
+    riscv->riscv_csr_regs.mip = riscv->irq_lines ? MIP_MEIP : 0;
+
+    riscv->instret = 0;
+    riscv->exec_block = NULL;
+
+    riscv->trap_pending = 0;
+    riscv->irq_pending = riscv->work_pending != 0;
+    riscv_mmu_update(riscv);
+}
+
+int riscv_csr_check(riscv_t* riscv, riscv_word_t addr, int write) {
+    addr &= 0xFFF;
+    if (!csr_table[addr].present) {
+        return -1;
+    }
+
+    // 地址的 [9:8] 是能够访问的最低特权级
+    if (riscv->priv < ((addr >> 8) & 0x3)) {
+        return -1;
+    }
+
+    // 地址的 [11:10] 为 11 表示只读
+    if (write && ((addr >> 10) == 0x3)) {
+        return -1;
+    }
+
+    // 浮点单元关闭 (FS 为 Off) 时浮点 CSR 与浮点指令一样是非法的
+    if ((addr <= RISCV_FCSR) && !(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+        return -1;
+    }
+
+    // 用户级计数器: 低特权级需要 mcounteren 中对应的位  U 模式还需要 scounteren
+    if (((addr & ~0x80) >= RISCV_CYCLE) && ((addr & ~0x80) <= RISCV_INSTRET)) {
+        riscv_word_t bit = 1 << (addr & 0x1F);
+        if ((riscv->priv < RISCV_PRIV_M) && !(riscv->riscv_csr_regs.mcounteren & bit)) {
+            return -1;
+        }
+        if ((riscv->priv < RISCV_PRIV_S) && !(riscv->riscv_csr_regs.scounteren & bit)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// CSR 寄存器读写 调用前应当先用 riscv_csr_check 确认地址合法
+riscv_word_t riscv_read_csr(riscv_t* riscv, riscv_word_t addr) {
+    addr &= 0xFFF;
+    const riscv_csr_entry_t* entry = &csr_table[addr];
+    if (!entry->present) {
+        return 0;
+    }
+    if (entry->read) {
+        return entry->read(riscv, addr);
+    }
+    return *csr_field(riscv, addr);
+}
+
+void riscv_write_csr(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
+    addr &= 0xFFF;
+    const riscv_csr_entry_t* entry = &csr_table[addr];
+    if (!entry->present) {
+        return;
+    }
+    if (entry->write) {
+        entry->write(riscv, addr, val);
+        return;
+    }
+
+    riscv_word_t* field = csr_field(riscv, addr);
+    *field = (*field & ~entry->mask) | (val & entry->mask);
+}
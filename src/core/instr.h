@@ -19,9 +19,12 @@
 #define OP_LW      0b0000011
 #define OP_LBU     0b0000011
 #define OP_LHU     0b0000011
+#define OP_LWU     0b0000011       // RV64
+#define OP_LD      0b0000011       // RV64
 #define OP_SB      0b0100011
 #define OP_SH      0b0100011
 #define OP_SW      0b0100011
+#define OP_SD      0b0100011       // RV64
 #define OP_ADDI    0b0010011
 #define OP_SLTI    0b0010011
 #define OP_SLTIU   0b0010011
@@ -43,6 +46,11 @@
 #define OP_AND     0b0110011
 #define OP_NOP     0b0010011
 #define OP_CSR     0b1110011
+#define OP_FENCE   0b0001111
+
+// RV64: 对低 32 位运算并把结果符号扩展的 W 指令
+#define OP_IMM_32  0b0011011
+#define OP_32      0b0111011
 
 #define FUNC3_ADDI      0b000
 #define FUNC3_SLTI      0b010
@@ -56,12 +64,15 @@
 #define FUNC3_SB        0b000
 #define FUNC3_SH        0b001
 #define FUNC3_SW        0b010
+#define FUNC3_SD        0b011           // RV64
 
 #define FUNC3_LB        0b000
 #define FUNC3_LH        0b001
 #define FUNC3_LW        0b010
 #define FUNC3_LBU       0b100
 #define FUNC3_LHU       0b101
+#define FUNC3_LD        0b011           // RV64
+#define FUNC3_LWU       0b110           // RV64
 
 #define FUNC3_ADD       0b000
 #define FUNC3_SUB       0b000
@@ -97,8 +108,20 @@
 #define FUNC3_CSRRWI    0b101
 #define FUNC3_CSRRSI    0b110
 #define FUNC3_CSRRCI    0b111
+
+// funct3 为 0 的系统指令由 imm 区分
+#define IMM_ECALL       0x000
+#define IMM_EBREAK      0x001
+#define IMM_WFI         0x105
+#define IMM_SRET        0x102
+#define IMM_MRET        0x302
+#define FUNC7_SFENCE_VMA    0b0001001   // imm 的高 7 位 低 5 位是 rs2
+
 #define FUNC3_RETURN    0b000
 
+#define FUNC3_FENCE     0b000
+#define FUNC3_FENCE_I   0b001
+
 #define FUNC7_ADD       0b0000000
 #define FUNC7_SUB       0b0100000
 #define FUNC7_SRL       0b0000000
@@ -108,84 +131,200 @@
 #define FUNC7_REM       0b0000001
 #define FUNC7_MRET      0b0011000
 
+// Zba/Zbb: 与基础指令共用 OP/OP-IMM 依靠 funct7 区分
+#define FUNC7_SHADD     0b0010000       // sh1add/sh2add/sh3add: funct3 = 010/100/110
+#define FUNC7_NEGATE    0b0100000       // andn/orn/xnor: funct3 = 111/110/100
+#define FUNC7_MINMAX    0b0000101       // min/minu/max/maxu: funct3 = 100/101/110/111
+#define FUNC7_ZEXT_H    0b0000100       // funct3 = 100 rs2 = 0
+#define FUNC7_ROTATE    0b0110000       // rol/ror/rori 以及 funct3 = 001 的一元运算
+#define FUNC7_ADD_UW    0b0000100       // RV64 OP-32: add.uw (funct3 = 000) zext.h (funct3 = 100)
+#define FUNC7_SLLI_UW   0b0000100       // RV64 OP-IMM-32: slli.uw 的 imm[11:6] 为 000010
+
+// funct3 = 001 时 rs2 位置区分一元运算
+#define UNARY_CLZ       0b00000
+#define UNARY_CTZ       0b00001
+#define UNARY_CPOP      0b00010
+#define UNARY_SEXT_B    0b00100
+#define UNARY_SEXT_H    0b00101
+
+// funct3 = 101 时由完整的 12 位立即数区分  rev8 的编码包含 XLEN
+#define IMM_ORC_B       0x287
+#if RISCV_XLEN == 64
+#define IMM_REV8        0x6B8
+#else
+#define IMM_REV8        0x698
+#endif
+
+// A-Extension: funct3 为 010(.w) 或 011(.d RV64) 具体操作由 funct7 的高 5 位区分
+#define OP_AMO          0b0101111
+#define FUNC3_AMO_W     0b010
+#define FUNC3_AMO_D     0b011
+
+#define FUNC5_AMOADD    0b00000
+#define FUNC5_AMOSWAP   0b00001
+#define FUNC5_LR        0b00010
+#define FUNC5_SC        0b00011
+#define FUNC5_AMOXOR    0b00100
+#define FUNC5_AMOOR     0b01000
+#define FUNC5_AMOAND    0b01100
+#define FUNC5_AMOMIN    0b10000
+#define FUNC5_AMOMAX    0b10100
+#define FUNC5_AMOMINU   0b11000
+#define FUNC5_AMOMAXU   0b11100
+
+// F-Extension: 单精度浮点
+#define OP_LOAD_FP      0b0000111
+#define OP_STORE_FP     0b0100111
+#define OP_FMADD        0b1000011
+#define OP_FMSUB        0b1000111
+#define OP_FNMSUB       0b1001011
+#define OP_FNMADD       0b1001111
+#define OP_FP           0b1010011
+
+#define FUNC3_FLW       0b010
+#define FUNC3_FSW       0b010
+#define FMT_S           0b00            // R4 型指令 funct7 的低 2 位
+
+#define FUNC7_FADD_S    0b0000000
+#define FUNC7_FSUB_S    0b0000100
+#define FUNC7_FMUL_S    0b0001000
+#define FUNC7_FDIV_S    0b0001100
+#define FUNC7_FSQRT_S   0b0101100
+#define FUNC7_FSGNJ_S   0b0010000
+#define FUNC7_FMINMAX_S 0b0010100
+#define FUNC7_FCMP_S    0b1010000
+#define FUNC7_FCVT_W_S  0b1100000       // rs2 = 0: fcvt.w.s  rs2 = 1: fcvt.wu.s  RV64 增加 2: fcvt.l.s  3: fcvt.lu.s
+#define FUNC7_FCVT_S_W  0b1101000       // rs2 = 0: fcvt.s.w  rs2 = 1: fcvt.s.wu  RV64 增加 2: fcvt.s.l  3: fcvt.s.lu
+#define FUNC7_FMV_X_W   0b1110000       // funct3 = 000: fmv.x.w  funct3 = 001: fclass.s
+#define FUNC7_FMV_W_X   0b1111000
+
+#define FUNC3_FSGNJ     0b000
+#define FUNC3_FSGNJN    0b001
+#define FUNC3_FSGNJX    0b010
+#define FUNC3_FMIN      0b000
+#define FUNC3_FMAX      0b001
+#define FUNC3_FLE       0b000
+#define FUNC3_FLT       0b001
+#define FUNC3_FEQ       0b010
+#define FUNC3_FMV_X_W   0b000
+#define FUNC3_FCLASS    0b001
+
+// 舍入模式 位于浮点指令的 funct3 以及 frm 寄存器
+#define FRM_RNE         0b000           // 就近舍入 偶数优先
+#define FRM_RTZ         0b001           // 向零舍入
+#define FRM_RDN         0b010           // 向下舍入
+#define FRM_RUP         0b011           // 向上舍入
+#define FRM_RMM         0b100           // 就近舍入 远离零优先
+#define FRM_DYN         0b111           // 使用 frm 寄存器
+
+// V-Extension: 向量 load/store 与标量浮点共用 LOAD-FP/STORE-FP  funct3 表示元素宽度
+#define OP_V            0b1010111
+
+#define FUNC3_VLE8      0b000
+#define FUNC3_VLE16     0b101
+#define FUNC3_VLE32     0b110
+
+#define FUNC3_OPIVV     0b000
+#define FUNC3_OPMVV     0b010
+#define FUNC3_OPIVI     0b011
+#define FUNC3_OPIVX     0b100
+#define FUNC3_OPMVX     0b110
+#define FUNC3_OPCFG     0b111
+
+// funct6 位于 funct7 的高 6 位 最低位是 vm
+#define FUNC6_VADD      0b000000        // OPIVV/OPIVX/OPIVI
+#define FUNC6_VSUB      0b000010        // OPIVV/OPIVX
+#define FUNC6_VRSUB     0b000011        // OPIVX/OPIVI
+#define FUNC6_VAND      0b001001
+#define FUNC6_VOR       0b001010
+#define FUNC6_VXOR      0b001011
+#define FUNC6_VMV       0b010111        // vm = 1 时为 vmv.v.*
+#define FUNC6_VREDSUM   0b000000        // OPMVV
+#define FUNC6_VREDAND   0b000001
+#define FUNC6_VREDOR    0b000010
+#define FUNC6_VREDXOR   0b000011
+#define FUNC6_VMV_S     0b010000        // OPMVV: vmv.x.s  OPMVX: vmv.s.x
+#define FUNC6_VMUL      0b100101        // OPMVV/OPMVX
+
 #define EBREAK 0b00000000000100000000000001110011
 #define OP_BREAK 0b1110011
 
+// 指令编码固定为 32 位 与 XLEN 无关
 typedef union _instr_t
 {
     // common 单独的 OPCODE 特化分类
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t other : 25;
+        uint32_t opcode : 7;
+        uint32_t other : 25;
     };
 
     // 字节读取是有顺序的 目前看是小端序的
 
     // R-Type
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t rd : 5;
-        riscv_word_t funct3 : 3;
-        riscv_word_t rs1 : 5;
-        riscv_word_t rs2 : 5;
-        riscv_word_t funct7 : 7;
+        uint32_t opcode : 7;
+        uint32_t rd : 5;
+        uint32_t funct3 : 3;
+        uint32_t rs1 : 5;
+        uint32_t rs2 : 5;
+        uint32_t funct7 : 7;
     } r;
 
     // I-Type
     struct {
-        // riscv_word_t imm11_0 : 12;
-        // riscv_word_t rs1 : 5;
-        // riscv_word_t funct3 : 3;
-        // riscv_word_t rd : 5;
-        // riscv_word_t opcode : 7;
-
-        riscv_word_t opcode : 7;
-        riscv_word_t rd : 5;
-        riscv_word_t funct3 : 3;
-        riscv_word_t rs1 : 5;
-        riscv_word_t imm11_0 : 12;
+        // uint32_t imm11_0 : 12;
+        // uint32_t rs1 : 5;
+        // uint32_t funct3 : 3;
+        // uint32_t rd : 5;
+        // uint32_t opcode : 7;
+
+        uint32_t opcode : 7;
+        uint32_t rd : 5;
+        uint32_t funct3 : 3;
+        uint32_t rs1 : 5;
+        uint32_t imm11_0 : 12;
     } i;
 
     // S-Type
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t imm4_0 : 5;
-        riscv_word_t funct3  : 3;
-        riscv_word_t rs1 : 5;
-        riscv_word_t rs2 : 5;
-        riscv_word_t imm11_5 : 7;
+        uint32_t opcode : 7;
+        uint32_t imm4_0 : 5;
+        uint32_t funct3  : 3;
+        uint32_t rs1 : 5;
+        uint32_t rs2 : 5;
+        uint32_t imm11_5 : 7;
     } s;
 
     // B-Type
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t imm_11 : 1;
-        riscv_word_t imm_4_1 : 4;
-        riscv_word_t funct3 : 3;
-        riscv_word_t rs1 : 5;
-        riscv_word_t rs2 : 5;
-        riscv_word_t imm_10_5 : 6;
-        riscv_word_t imm_12 : 1;
+        uint32_t opcode : 7;
+        uint32_t imm_11 : 1;
+        uint32_t imm_4_1 : 4;
+        uint32_t funct3 : 3;
+        uint32_t rs1 : 5;
+        uint32_t rs2 : 5;
+        uint32_t imm_10_5 : 6;
+        uint32_t imm_12 : 1;
     } b;
 
     // U-Type
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t rd  : 5;
-        riscv_word_t imm31_12 : 20;
+        uint32_t opcode : 7;
+        uint32_t rd  : 5;
+        uint32_t imm31_12 : 20;
     } u;
 
     // J-Type
     struct {
-        riscv_word_t opcode : 7;
-        riscv_word_t rd : 5;
-        riscv_word_t imm_19_12 : 8;
-        riscv_word_t imm_11 : 1;
-        riscv_word_t imm_10_1 : 10;
-        riscv_word_t imm_20 : 1;
+        uint32_t opcode : 7;
+        uint32_t rd : 5;
+        uint32_t imm_19_12 : 8;
+        uint32_t imm_11 : 1;
+        uint32_t imm_10_1 : 10;
+        uint32_t imm_20 : 1;
     } j;
 
-    riscv_word_t raw;
+    uint32_t raw;
 }instr_t;
 
 #endif /* INSTR_H */
\ No newline at end of file
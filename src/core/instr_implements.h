@@ -3,31 +3,41 @@
 
 #include "riscv.h"
 #include "types.h"
+#include "plat/plat.h"
 #include <stdio.h>
+#include <math.h>
+#include <fenv.h>
+#include <string.h>
 
-// 立即数统一用有符号数的方式处理
+// 立即数统一用有符号数的方式处理  int32_t 赋值给 riscv_word_t 时自动符号扩展到 XLEN
 
 #define i_get_imm(instr)       \
     ((int32_t)(instr.i.imm11_0 | ((instr.i.imm11_0 & (1 << 11)) ? (0xFFFFF << 12) : 0)))
 
+// 移位立即数的 funct7: RV64 的 shamt 有 6 位 占用了 imm[5] 这一位不参与区分指令
+#define i_get_shift_funct7(instr)   (((instr).i.imm11_0 >> 5) & ~(RISCV_SHAMT_MASK >> 5))
+
+// W 指令的结果: 取低 32 位再符号扩展到 XLEN
+#define sext_w(val)     ((riscv_word_t)(int32_t)(uint32_t)(val))
+
 // I-Instruction-Math
 static inline void handle_addi(riscv_t* riscv) {
-    int32_t source = (int32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
-    int32_t imm = (int32_t)i_get_imm(riscv->instr);
-    int32_t result = imm + source;
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t imm = i_get_imm(riscv->instr);
+    riscv_word_t result = imm + source;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_slti(riscv_t* riscv) {
     // 将寄存器的有符号整数与立即数比较
-    int32_t source = (int32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
-    int32_t imm = (int32_t)i_get_imm(riscv->instr);
-    int32_t result = (source < imm) ? 1 : 0;
+    riscv_sword_t source = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_sword_t imm = i_get_imm(riscv->instr);
+    riscv_word_t result = (source < imm) ? 1 : 0;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sltiu(riscv_t* riscv) {
@@ -37,7 +47,7 @@ static inline void handle_sltiu(riscv_t* riscv) {
     riscv_word_t result = (source < imm) ? 1 : 0;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_xori(riscv_t* riscv) {
@@ -47,7 +57,7 @@ static inline void handle_xori(riscv_t* riscv) {
     riscv_word_t result = source ^ imm;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_ori(riscv_t* riscv) {
@@ -56,7 +66,7 @@ static inline void handle_ori(riscv_t* riscv) {
     riscv_word_t result = imm | source;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_andi(riscv_t* riscv) {
@@ -66,92 +76,75 @@ static inline void handle_andi(riscv_t* riscv) {
     riscv_word_t result = imm & source;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_slli(riscv_t* riscv) {
     // 逻辑左移指定位数 逻辑右移统一补零
     riscv_word_t source = (riscv_word_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
-    riscv_word_t imm = (riscv_word_t)i_get_imm(riscv->instr) & 0b11111;
-    
+    riscv_word_t imm = (riscv_word_t)i_get_imm(riscv->instr) & RISCV_SHAMT_MASK;
+
     riscv_word_t result = source << imm;
     riscv_write_reg(riscv, riscv->instr.i.rd, result);
                 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_srai_srli(riscv_t* riscv) {
-    riscv_word_t flag = riscv->instr.i.imm11_0 >> 5;
+    riscv_word_t flag = i_get_shift_funct7(riscv->instr);
+    riscv_word_t source = (riscv_word_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t shamt = riscv->instr.i.imm11_0 & RISCV_SHAMT_MASK;   // RV32 取出最后 5 位 RV64 取出 6 位
+
     if (flag > 0) {
-        riscv_word_t source = (riscv_word_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
-        riscv_word_t shamt = riscv->instr.i.imm11_0 & 0b11111;   // 只取出最后 5 位
-        
-        // 算术移位需要判断 source 首位正负
-        int32_t flag = source >> 31;
-        if (flag == 0) {
-            // 正数情况 等效于逻辑右移
-            riscv_word_t result = (source >> shamt);
-            riscv_write_reg(riscv, riscv->instr.i.rd, result);
-        }
-        else {
-            // 负数情况 右移前面的部分补 1
-            int32_t result1 = (0xFFFFFFFF << (32 - shamt)) | (source >> shamt);
-            // 可以不用那么麻烦 直接转换为有符号数就可以了
-            int32_t result2 = (int32_t) source >> shamt;
-            if (result1 != result2) {
-                printf("handler srai not ok on minus number\n");
-            }
-            riscv_write_reg(riscv, riscv->instr.i.rd, result2);
-        }
+        // 算术移位 负数右移前面的部分补 1  直接转换为有符号数就可以了
+        riscv_word_t result = (riscv_word_t)((riscv_sword_t)source >> shamt);
+        riscv_write_reg(riscv, riscv->instr.i.rd, result);
     }
-
     else {
-        riscv_word_t source = (riscv_word_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
-        riscv_word_t shamt = (riscv_word_t)i_get_imm(riscv->instr) & 0b11111;   // 只取出最后 5 位
         riscv_word_t result = source >> shamt;
         riscv_write_reg(riscv, riscv->instr.i.rd, result);
     }
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 // R-Instruction-Math
 static inline void handle_add(riscv_t* riscv) {
-    int32_t source1 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t source2 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs2);
-    int32_t result = source1 + source2;
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t result = source1 + source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sub(riscv_t* riscv) {
-    int32_t source1 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t source2 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs2);
-    int32_t result = source1 - source2;
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t result = source1 - source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sll(riscv_t* riscv) {
     // 将寄存器中的数值左移 在模拟器层面不需要考虑前后的符号一致性
     riscv_word_t source = (riscv_word_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
-    riscv_word_t shamt = (riscv_word_t) riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t shamt = (riscv_word_t) riscv_read_reg(riscv, riscv->instr.r.rs2) & RISCV_SHAMT_MASK;
     riscv_word_t result = source << shamt;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_slt(riscv_t* riscv) {
     // 比较两个寄存器中有符号整数值 结果存储在 rd 中
-    int32_t source1 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t source2 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_sword_t source1 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_sword_t source2 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
     riscv_word_t flag = (source1 < source2) ? 1 : 0;
     riscv_write_reg(riscv, riscv->instr.r.rd, flag);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sltu(riscv_t* riscv) {
@@ -161,7 +154,7 @@ static inline void handle_sltu(riscv_t* riscv) {
     riscv_word_t flag = (source1 < source2) ? 1 : 0;
     riscv_write_reg(riscv, riscv->instr.r.rd, flag);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_xor(riscv_t* riscv) {
@@ -171,42 +164,31 @@ static inline void handle_xor(riscv_t* riscv) {
     riscv_word_t flag = source1 ^ source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, flag);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_srl(riscv_t* riscv) {
     // 逻辑右移
     riscv_word_t source1 = (riscv_word_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
     riscv_word_t source2 = (riscv_word_t) riscv_read_reg(riscv, riscv->instr.r.rs2);
-    riscv_word_t shamt = source2 & 0b11111;
+    riscv_word_t shamt = source2 & RISCV_SHAMT_MASK;
 
     riscv_word_t result = source1 >> shamt;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sra(riscv_t* riscv) {
-    int32_t source1 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t source2 = (int32_t) riscv_read_reg(riscv, riscv->instr.r.rs2);
-    riscv_word_t shamt = source2 & 0b11111;     // ((uint32_t)source1 >> 9) | (0xFFFFFFFF << (32 - shamt))
-
-    if (source1 < 0) {
-        // 负数 右移补 1
-        int32_t result1 = ((uint32_t)source1 >> shamt) | (0xFFFFFFFF << (32 - shamt));
-        int32_t result2 = ((int32_t) source1) >> shamt;
-        if (result1 != result2) {
-            printf("handle sra on minus number not ok\n");
-        }
-        riscv_write_reg(riscv, riscv->instr.r.rd, result2);
-    }
-    else {
-        // 正数 等效于逻辑右移
-        riscv_word_t result = source1 >> shamt;
-        riscv_write_reg(riscv, riscv->instr.r.rd, result);
-    }
+    riscv_sword_t source1 = (riscv_sword_t) riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t shamt = source2 & RISCV_SHAMT_MASK;
+
+    // 负数右移补 1 正数等效于逻辑右移  有符号数的右移两种情况都满足
+    riscv_word_t result = (riscv_word_t)(source1 >> shamt);
+    riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 
@@ -217,7 +199,7 @@ static inline void handle_or(riscv_t* riscv) {
     riscv_word_t flag = source1 | source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, flag);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_and(riscv_t* riscv) {
@@ -227,20 +209,20 @@ static inline void handle_and(riscv_t* riscv) {
     riscv_word_t result = source1 & source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 // U-Instruction
 static inline void handle_lui(riscv_t* riscv) {
-    // 取出前 20 位放在寄存器中     地址是无符号数
-    riscv_word_t imm20_0 = (riscv_word_t) riscv->instr.u.imm31_12 << 12;
+    // 取出前 20 位放在寄存器中  RV64 需要把第 31 位符号扩展
+    riscv_word_t imm20_0 = (riscv_word_t)(int32_t)((uint32_t)riscv->instr.u.imm31_12 << 12);
     riscv_write_reg(riscv, riscv->instr.u.rd, imm20_0);
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 // 辅助函数: 获取一个 32 位有符号数
 static inline int32_t s_get_offset(instr_t instr) {
-    riscv_word_t temp = instr.s.imm11_5 << 5 | instr.s.imm4_0;       // 一共 12 位 需要转换到 32 位
+    uint32_t temp = instr.s.imm11_5 << 5 | instr.s.imm4_0;       // 一共 12 位 需要转换到 32 位
     if (instr.s.imm11_5 & (1 << 6)) {
         // 负数 首位补 1
         return (int32_t)(temp | (0xFFFFF << 12));
@@ -257,9 +239,12 @@ static inline void handle_sb(riscv_t* riscv) {
     
     // Q: 为什么在传具体值 target 的时候要传地址
     // A: 后续要通过地址处理 根据读写单位 uint8_t 和 width 决定写入多少
-    riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 1);
+    if (riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 1) < 0) {
+        riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sh(riscv_t* riscv) {
@@ -267,9 +252,12 @@ static inline void handle_sh(riscv_t* riscv) {
     int32_t offset = s_get_offset(riscv->instr);
     riscv_word_t target = riscv_read_reg(riscv, riscv->instr.s.rs2);
     
-    riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 2);
+    if (riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 2) < 0) {
+        riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_sw(riscv_t* riscv) {
@@ -277,11 +265,29 @@ static inline void handle_sw(riscv_t* riscv) {
     int32_t offset = s_get_offset(riscv->instr);
     riscv_word_t target = riscv_read_reg(riscv, riscv->instr.s.rs2);
 
-    riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 4);
+    if (riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 4) < 0) {
+        riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
+#if RISCV_XLEN == 64
+static inline void handle_sd(riscv_t* riscv) {
+    riscv_word_t base_addr = riscv_read_reg(riscv, riscv->instr.s.rs1);
+    int32_t offset = s_get_offset(riscv->instr);
+    riscv_word_t target = riscv_read_reg(riscv, riscv->instr.s.rs2);
+
+    if (riscv_mem_write(riscv, base_addr + offset, (uint8_t*) &target, 8) < 0) {
+        riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
+
+    riscv->pc += riscv->instr_size;
+}
+#endif
+
 // I-Instruction-LOAD
 static inline void handle_lb(riscv_t* riscv) {
     // 从内存中加载数据到寄存器中
@@ -290,13 +296,16 @@ static inline void handle_lb(riscv_t* riscv) {
     riscv_word_t load_addr = base_addr + offset;    // 获取要读取的数据的内存地址
 
     uint8_t res = 0;
-    riscv_mem_read(riscv, load_addr, &res, 1);
+    if (riscv_mem_read(riscv, load_addr, &res, 1) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
 
     // 注意 res 是 uin8_t 类型 不能接收符号扩展后的结果 没有意义
-    riscv_word_t new_val = res & (1 << 7) ? (res | 0xFFFFFF00) : res;
+    riscv_word_t new_val = (riscv_word_t)(int8_t)res;
     riscv_write_reg(riscv, riscv->instr.i.rd, new_val);
     
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_lh(riscv_t* riscv) {
@@ -305,11 +314,14 @@ static inline void handle_lh(riscv_t* riscv) {
     riscv_word_t load_addr = base_addr + offset;
 
     uint16_t res = 0;
-    riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 2);
-    riscv_word_t new_val = res & (1 << 15) ? (res | 0xFFFF0000) : res;
+    if (riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 2) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
+    riscv_word_t new_val = (riscv_word_t)(int16_t)res;
     riscv_write_reg(riscv, riscv->instr.i.rd, new_val);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_lw(riscv_t* riscv) {
@@ -318,10 +330,14 @@ static inline void handle_lw(riscv_t* riscv) {
     riscv_word_t load_addr = base_addr + offset;
 
     uint32_t res = 0;
-    riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 4);    // 已经读满 不需要符号扩展
-    riscv_write_reg(riscv, riscv->instr.i.rd, res);
+    // RV32 已经读满 RV64 需要符号扩展
+    if (riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 4) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, sext_w(res));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_lbu(riscv_t* riscv) {
@@ -331,10 +347,13 @@ static inline void handle_lbu(riscv_t* riscv) {
     riscv_word_t load_addr = base_addr + offset;
 
     uint8_t res = 0;
-    riscv_mem_read(riscv, load_addr, &res, 1);
+    if (riscv_mem_read(riscv, load_addr, &res, 1) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
     riscv_write_reg(riscv, riscv->instr.i.rd, res);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_lhu(riscv_t* riscv) {
@@ -344,61 +363,98 @@ static inline void handle_lhu(riscv_t* riscv) {
     riscv_word_t load_addr = base_addr + offset;
 
     uint16_t res = 0;
-    riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 2);
+    if (riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 2) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, res);
+
+    riscv->pc += riscv->instr_size;
+}
+
+#if RISCV_XLEN == 64
+static inline void handle_lwu(riscv_t* riscv) {
+    // 与 LW 相比不做符号扩展
+    riscv_word_t base_addr = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    int32_t offset = i_get_imm(riscv->instr);
+    riscv_word_t load_addr = base_addr + offset;
+
+    uint32_t res = 0;
+    if (riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 4) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, res);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_ld(riscv_t* riscv) {
+    riscv_word_t base_addr = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    int32_t offset = i_get_imm(riscv->instr);
+    riscv_word_t load_addr = base_addr + offset;
+
+    uint64_t res = 0;
+    if (riscv_mem_read(riscv, load_addr, (uint8_t*)&res, 8) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, load_addr);
+        return;
+    }
     riscv_write_reg(riscv, riscv->instr.i.rd, res);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
+#endif
 
 // J-Instruction-Math
 static inline void handle_auipc(riscv_t* riscv) {
     // 将立即数左移 12 位
-    riscv_word_t imm = riscv->instr.u.imm31_12 << 12;
+    riscv_word_t imm = (riscv_word_t)(int32_t)((uint32_t)riscv->instr.u.imm31_12 << 12);
     riscv_word_t current_pc = riscv->pc;
 
     riscv_word_t new_addr = current_pc + imm;
     riscv_write_reg(riscv, riscv->instr.u.rd, new_addr);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 // 辅助函数: 获取一个 32 位有符号数
 static inline int32_t j_get_imm(instr_t instr) {
-    riscv_word_t temp = (instr.j.imm_20 << 20) | (instr.j.imm_19_12 << 12) | (instr.j.imm_10_1 << 1) | (instr.j.imm_11 << 11);
+    uint32_t temp = (instr.j.imm_20 << 20) | (instr.j.imm_19_12 << 12) | (instr.j.imm_10_1 << 1) | (instr.j.imm_11 << 11);
     if (instr.j.imm_20 == 1) {
         // 负数补 1
-        return (temp | 0xFFF00000);
+        return (int32_t)(temp | 0xFFF00000);
     }
-    return temp;
+    return (int32_t)temp;
 }
 
 // J-Instruction-JUMP
 static inline void handle_jal(riscv_t* riscv) {
     // 将立即数的结果存储在 pc 中
     int32_t offset = j_get_imm(riscv->instr);
-    riscv_write_reg(riscv, riscv->instr.j.rd, riscv->pc + 4);
+    riscv_write_reg(riscv, riscv->instr.j.rd, riscv->pc + riscv->instr_size);
     riscv->pc = (riscv_word_t)(riscv->pc + offset);
     return;
 }
 
 // I-Instruction-JUMP
 static inline void handle_jalr(riscv_t* riscv) {
-    // 保存断点
-    riscv_write_reg(riscv, riscv->instr.i.rd, riscv->pc + 4);
-
-    // 跳转基地址
+    // 跳转基地址  必须在写 rd 之前读取 rd 与 rs1 可能相同 (jalr ra, 0(ra) / c.jalr ra)
     riscv_word_t base = riscv_read_reg(riscv, riscv->instr.i.rs1);
 
-    // 跳转偏移量
+    // 跳转偏移量  目标地址的最低位清零
     int32_t offset = i_get_imm(riscv->instr);
+    riscv_word_t target = (base + offset) & ~(riscv_word_t)1;
+
+    // 保存断点
+    riscv_write_reg(riscv, riscv->instr.i.rd, riscv->pc + riscv->instr_size);
 
-    riscv->pc = base + offset;
+    riscv->pc = target;
     return;
 }
 
 // 辅助函数 
 static inline int32_t b_get_imm(instr_t instr) {
-    riscv_word_t temp = (instr.b.imm_4_1 << 1) | (instr.b.imm_10_5 << 5) | (instr.b.imm_11 << 11) | (instr.b.imm_12 << 12);
+    uint32_t temp = (instr.b.imm_4_1 << 1) | (instr.b.imm_10_5 << 5) | (instr.b.imm_11 << 11) | (instr.b.imm_12 << 12);
     if (instr.b.imm_12 == 1) {
         // 负数补 1
         return (int32_t)(temp | 0xFFFFE000);
@@ -416,7 +472,7 @@ static inline void handle_beq(riscv_t* riscv) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = (offset + riscv->pc);
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
@@ -429,31 +485,31 @@ static inline void handle_bne(riscv_t* riscv) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = (offset + riscv->pc);
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
 static inline void handle_blt(riscv_t* riscv) {
-    int32_t source1 = (int32_t)riscv_read_reg(riscv, riscv->instr.b.rs1);
-    int32_t source2 = (int32_t)riscv_read_reg(riscv, riscv->instr.b.rs2);
+    riscv_sword_t source1 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.b.rs1);
+    riscv_sword_t source2 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.b.rs2);
     
     if (source1 < source2) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = riscv->pc + offset;
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
 static inline void handle_bge(riscv_t* riscv) {
-    int32_t source1 = (int32_t)riscv_read_reg(riscv, riscv->instr.b.rs1);
-    int32_t source2 = (int32_t)riscv_read_reg(riscv, riscv->instr.b.rs2);
+    riscv_sword_t source1 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.b.rs1);
+    riscv_sword_t source2 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.b.rs2);
     
     if (source1 >= source2) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = riscv->pc + offset;
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
@@ -466,7 +522,7 @@ static inline void handle_bltu(riscv_t* riscv) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = riscv->pc + offset;
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
@@ -478,98 +534,226 @@ static inline void handle_bgeu(riscv_t* riscv) {
         int32_t offset = b_get_imm(riscv->instr);
         riscv->pc = riscv->pc + offset;
     } else {
-        riscv->pc += sizeof(riscv_word_t);
+        riscv->pc += riscv->instr_size;
     }
 }
 
 // M-Extension
 static inline void handle_mul(riscv_t* riscv) {
-    // 对于超出 32 位的乘法结果直接截断
-    int32_t source1 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t source2 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    // 对于超出 XLEN 的乘法结果直接截断  用无符号数相乘 低半部分与有符号乘法相同
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    int32_t result = (int32_t)(source1 * source2);
+    riscv_word_t result = source1 * source2;
     riscv_write_reg(riscv, riscv->instr.r.rd, result);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
-// 辅助函数 针对 64 位的扩展函数
-static inline int64_t s_extend_64(int32_t temp) {
-    if (temp < 0) {
-        return (int64_t) (temp | (0xFFFFFFFF00000000));
+// 辅助函数 计算乘积的高 XLEN 位  a_signed/b_signed 在每个 handler 中都是常量 内联后不产生分支
+static inline riscv_word_t mul_high(riscv_word_t a, riscv_word_t b, int a_signed, int b_signed) {
+#if RISCV_XLEN == 64
+    // 拆成 32 位分段计算无符号乘积的高 64 位 不依赖编译器的 128 位整数
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t high = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#else
+    uint64_t high = ((uint64_t)a * b) >> 32;
+#endif
+    // 有符号操作数为负时 它的无符号值多了 2^XLEN  乘积的高半部分要减去另一个操作数
+    if (a_signed && ((riscv_sword_t)a < 0)) {
+        high -= b;
+    }
+    if (b_signed && ((riscv_sword_t)b < 0)) {
+        high -= a;
     }
-    return (int64_t)temp;
+    return (riscv_word_t)high;
 }
 
 static inline void handle_mulh(riscv_t* riscv) {
-    int64_t source1 = s_extend_64((int32_t) riscv_read_reg(riscv, riscv->instr.r.rs1));
-    int64_t source2 = s_extend_64((int32_t) riscv_read_reg(riscv, riscv->instr.r.rs2));
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_word_t result = ((source1 * source2) >> 32);
-    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+    riscv_write_reg(riscv, riscv->instr.r.rd, mul_high(source1, source2, 1, 1));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_mulhsu(riscv_t* riscv) {
     // 执行一个有符号和无符号的乘法操作 并将高位放入目标寄存器中
-    int64_t sign_source = s_extend_64((int32_t)riscv_read_reg(riscv, riscv->instr.r.rs1));
-    uint64_t unsign_source = (uint64_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t sign_source = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t unsign_source = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_word_t result = (sign_source * unsign_source) >> 32;
-    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+    riscv_write_reg(riscv, riscv->instr.r.rd, mul_high(sign_source, unsign_source, 1, 0));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_mulhu(riscv_t* riscv) {
     // 执行两个无符号的乘法操作 并将高位放入目标寄存器中
-    uint64_t sign_source = (int64_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
-    uint64_t unsign_source = (uint64_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_word_t result = (sign_source * unsign_source) >> 32;
-    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+    riscv_write_reg(riscv, riscv->instr.r.rd, mul_high(source1, source2, 0, 0));
+
+    riscv->pc += riscv->instr_size;
+}
 
-    riscv->pc += sizeof(riscv_word_t);
+// 除法不产生异常: 除数为 0 时商为全 1 余数为被除数  最小负数除以 -1 时商为被除数 余数为 0
+// 宿主机遇到这两种情况会直接崩溃 必须先排除  W 指令用 int32_t/uint32_t 实例化同一套规则
+#define DIV_HELPERS(suffix, stype, utype)                                               \
+static inline utype div_signed_##suffix(stype a, stype b) {                             \
+    if (b == 0) {                                                                       \
+        return (utype)-1;                                                               \
+    }                                                                                   \
+    if ((b == -1) && ((utype)a == ((utype)1 << (sizeof(utype) * 8 - 1)))) {             \
+        return (utype)a;                                                                \
+    }                                                                                   \
+    return (utype)(a / b);                                                              \
+}                                                                                       \
+static inline utype rem_signed_##suffix(stype a, stype b) {                             \
+    if (b == 0) {                                                                       \
+        return (utype)a;                                                                \
+    }                                                                                   \
+    if (b == -1) {                                                                      \
+        return 0;                                                                       \
+    }                                                                                   \
+    return (utype)(a % b);                                                              \
+}                                                                                       \
+static inline utype div_unsigned_##suffix(utype a, utype b) {                           \
+    return b ? (a / b) : (utype)-1;                                                     \
+}                                                                                       \
+static inline utype rem_unsigned_##suffix(utype a, utype b) {                           \
+    return b ? (a % b) : a;                                                             \
 }
 
+DIV_HELPERS(x, riscv_sword_t, riscv_word_t)
+#if RISCV_XLEN == 64
+DIV_HELPERS(w, int32_t, uint32_t)
+#endif
+
 static inline void handle_div(riscv_t* riscv) {
-    int32_t rs1 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t rs2 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_sword_t rs1 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_sword_t rs2 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_write_reg(riscv, riscv->instr.r.rd, rs1 / rs2);
+    riscv_write_reg(riscv, riscv->instr.r.rd, div_signed_x(rs1, rs2));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_divu(riscv_t* riscv) {
     riscv_word_t rs1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
     riscv_word_t rs2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_write_reg(riscv, riscv->instr.r.rd, rs1 / rs2);
+    riscv_write_reg(riscv, riscv->instr.r.rd, div_unsigned_x(rs1, rs2));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_rem(riscv_t* riscv) {
-    int32_t rs1 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
-    int32_t rs2 = (int32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_sword_t rs1 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_sword_t rs2 = (riscv_sword_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_write_reg(riscv, riscv->instr.r.rd, rs1 % rs2);
+    riscv_write_reg(riscv, riscv->instr.r.rd, rem_signed_x(rs1, rs2));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_remu(riscv_t* riscv) {
     riscv_word_t rs1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
     riscv_word_t rs2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
 
-    riscv_write_reg(riscv, riscv->instr.r.rd, rs1 % rs2);
+    riscv_write_reg(riscv, riscv->instr.r.rd, rem_unsigned_x(rs1, rs2));
+
+    riscv->pc += riscv->instr_size;
+}
+
+#if RISCV_XLEN == 64
+// RV64 W 指令: 只使用源操作数的低 32 位 结果符号扩展到 64 位
+static inline void handle_addiw(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t imm = i_get_imm(riscv->instr);
+    riscv_write_reg(riscv, riscv->instr.i.rd, sext_w(source + imm));
+
+    riscv->pc += riscv->instr_size;
+}
+
+// slliw/srliw/sraiw: shamt 只有 5 位  imm[5] 必须为 0 调用前已经检查
+static inline void handle_shiftiw(riscv_t* riscv) {
+    uint32_t source = (uint32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+    uint32_t shamt = riscv->instr.i.imm11_0 & 0x1F;
+    uint32_t result;
+
+    if (riscv->instr.i.funct3 == FUNC3_SLLI) {
+        result = source << shamt;
+    }
+    else if (riscv->instr.i.imm11_0 >> 5) {
+        result = (uint32_t)((int32_t)source >> shamt);
+    }
+    else {
+        result = source >> shamt;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, sext_w(result));
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
+// addw/subw/sllw/srlw/sraw 由 funct3 和 funct7 区分 调用前已经检查过编码
+static inline void handle_opw(riscv_t* riscv) {
+    uint32_t source1 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    uint32_t source2 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    uint32_t shamt = source2 & 0x1F;
+    uint32_t result;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_ADD:
+        result = (riscv->instr.r.funct7 == FUNC7_SUB) ? (source1 - source2) : (source1 + source2);
+        break;
+    case FUNC3_SLL:
+        result = source1 << shamt;
+        break;
+    default:
+        result = (riscv->instr.r.funct7 == FUNC7_SRA) ? (uint32_t)((int32_t)source1 >> shamt) : (source1 >> shamt);
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, sext_w(result));
+
+    riscv->pc += riscv->instr_size;
+}
+
+// mulw/divw/divuw/remw/remuw
+static inline void handle_mulw_divw(riscv_t* riscv) {
+    uint32_t source1 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    uint32_t source2 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs2);
+    uint32_t result;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_MUL:
+        result = source1 * source2;
+        break;
+    case FUNC3_DIV:
+        result = div_signed_w((int32_t)source1, (int32_t)source2);
+        break;
+    case FUNC3_DIVU:
+        result = div_unsigned_w(source1, source2);
+        break;
+    case FUNC3_REM:
+        result = rem_signed_w((int32_t)source1, (int32_t)source2);
+        break;
+    default:
+        result = rem_unsigned_w(source1, source2);
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, sext_w(result));
+
+    riscv->pc += riscv->instr_size;
+}
+#endif
+
 // CSR Operation
 static inline void handle_csrrw(riscv_t* riscv) {
     // 读取 csr 到 reg-rd 中    同时把 reg-rs1 的值写入 csr 中
@@ -581,7 +765,7 @@ static inline void handle_csrrw(riscv_t* riscv) {
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
     riscv_write_csr(riscv, csr_addr, rs1_content);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_csrrs(riscv_t* riscv) {
@@ -591,10 +775,13 @@ static inline void handle_csrrs(riscv_t* riscv) {
     riscv_word_t csr_content = riscv_read_csr(riscv, csr_addr);
     riscv_word_t rs1_content = riscv_read_reg(riscv, riscv->instr.i.rs1);
 
-    riscv_write_csr(riscv, csr_addr, csr_content | rs1_content);
+    // rs1 为 x0 时只读 不产生写入的副作用
+    if (riscv->instr.i.rs1) {
+        riscv_write_csr(riscv, csr_addr, csr_content | rs1_content);
+    }
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_csrrc(riscv_t* riscv) {
@@ -604,10 +791,12 @@ static inline void handle_csrrc(riscv_t* riscv) {
     riscv_word_t csr_content = riscv_read_csr(riscv, csr_addr);
     riscv_word_t rs1_content = riscv_read_reg(riscv, riscv->instr.i.rs1);
 
-    riscv_write_csr(riscv, csr_addr, csr_content & ~rs1_content);
+    if (riscv->instr.i.rs1) {
+        riscv_write_csr(riscv, csr_addr, csr_content & ~rs1_content);
+    }
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_csrrwi(riscv_t* riscv) {
@@ -620,7 +809,7 @@ static inline void handle_csrrwi(riscv_t* riscv) {
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
     riscv_write_csr(riscv, csr_addr, new_csr_content);
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_csrrsi(riscv_t* riscv) {
@@ -630,9 +819,11 @@ static inline void handle_csrrsi(riscv_t* riscv) {
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
 
     riscv_word_t new_csr_content = riscv->instr.i.rs1;
-    riscv_write_csr(riscv, csr_addr, new_csr_content | csr_content);
+    if (new_csr_content) {
+        riscv_write_csr(riscv, csr_addr, new_csr_content | csr_content);
+    }
 
-    riscv->pc += sizeof(riscv_word_t);
+    riscv->pc += riscv->instr_size;
 }
 
 static inline void handle_csrrci(riscv_t* riscv) {
@@ -642,8 +833,1269 @@ static inline void handle_csrrci(riscv_t* riscv) {
     riscv_word_t new_csr_content = riscv->instr.i.rs1;
 
     riscv_write_reg(riscv, riscv->instr.i.rd, csr_content);
-    riscv_write_csr(riscv, csr_addr, csr_content & ~new_csr_content);
+    if (new_csr_content) {
+        riscv_write_csr(riscv, csr_addr, csr_content & ~new_csr_content);
+    }
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 系统指令
+static inline void handle_ecall(riscv_t* riscv) {
+    riscv_raise_exception(riscv, EXCP_ECALL_U + riscv->priv, 0);
+}
+
+static inline void handle_mret(riscv_t* riscv) {
+    if (riscv->priv != RISCV_PRIV_M) {
+        riscv_raise_exception(riscv, EXCP_ILLEGAL_INSTR, riscv->instr.raw);
+        return;
+    }
+
+    // 回到 MPP 记录的特权级  MIE 恢复为进入 trap 前的值  MPIE 置 1  MPP 置为最低的 U
+    riscv_word_t mstatus = riscv->riscv_csr_regs.mstatus;
+    riscv->priv = (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+    mstatus = (mstatus & ~(MSTATUS_MIE | MSTATUS_MPP)) | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+    if (riscv->priv != RISCV_PRIV_M) {
+        mstatus &= ~MSTATUS_MPRV;
+    }
+    riscv->riscv_csr_regs.mstatus = mstatus;
+    riscv_mmu_update(riscv);
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+
+    riscv->pc = riscv->riscv_csr_regs.mepc;
+}
+
+static inline void handle_sret(riscv_t* riscv) {
+    if (riscv->priv < RISCV_PRIV_S) {
+        riscv_raise_exception(riscv, EXCP_ILLEGAL_INSTR, riscv->instr.raw);
+        return;
+    }
+
+    riscv_word_t mstatus = riscv->riscv_csr_regs.mstatus;
+    riscv->priv = (mstatus & MSTATUS_SPP) ? RISCV_PRIV_S : RISCV_PRIV_U;
+    mstatus = (mstatus & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV)) | ((mstatus & MSTATUS_SPIE) ? MSTATUS_SIE : 0) | MSTATUS_SPIE;
+    riscv->riscv_csr_regs.mstatus = mstatus;
+    riscv_mmu_update(riscv);
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+
+    riscv->pc = riscv->riscv_csr_regs.sepc;
+}
+
+static inline void handle_wfi(riscv_t* riscv) {
+    // 允许实现为空操作: 中断在下一个块边界检查 软件总是在循环中使用 wfi
+    // 线程池调度时没有可响应的中断就在块边界让出线程  wfi 总是块的最后一条指令
+    if (riscv->machine->workers && !(atomic_load_u32(&riscv->riscv_csr_regs.mip) & riscv->riscv_csr_regs.mie)) {
+        riscv->wfi = 1;
+        atomic_xchg_u32(&riscv->irq_pending, 1);
+    }
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_sfence_vma(riscv_t* riscv) {
+    if (riscv->priv < RISCV_PRIV_S) {
+        riscv_raise_exception(riscv, EXCP_ILLEGAL_INSTR, riscv->instr.raw);
+        return;
+    }
+
+    // ASID 固定为 0 rs2 不影响结果   rs1 为 x0 时清空全部
+    riscv_word_t rs1 = riscv->instr.r.rs1;
+    riscv_tlb_flush(riscv, riscv_read_reg(riscv, rs1), rs1 == 0);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 单核并且按顺序访存 fence 不需要做任何事
+// 多个 hart 之间的访存顺序: 不区分前驱/后继集合 统一使用宿主机的完整屏障
+static inline void handle_fence(riscv_t* riscv) {
+    atomic_fence();
+    riscv->pc += riscv->instr_size;
+}
+
+// 之前对指令存储区的写入在这之后可见: 作废全部预译码块
+static inline void handle_fence_i(riscv_t* riscv) {
+    riscv_block_flush(riscv);
+    riscv->pc += riscv->instr_size;
+}
+
+// A-Extension
+// 目标地址落在普通存储器上时 直接对本机指针使用宿主机的原子指令 多个 hart 线程之间也能保证原子性
+// 落在外设上时没有本机指针 退化为普通的读-改-写
+// 地址没有按宽度对齐时无法保证原子性 产生地址不对齐异常 (LR 为读 SC/AMO 为存储) 不做非原子的访问
+// width 为 4 (.w) 或 8 (.d 只存在于 RV64) 由调用方以常量传入 内联后不产生分支  .w 读到的值符号扩展到 XLEN
+static inline int amo_misaligned(riscv_t* riscv, riscv_word_t addr, int width, riscv_word_t cause) {
+    if (addr & (width - 1)) {
+        riscv_raise_exception(riscv, cause, addr);
+        return 1;
+    }
+    return 0;
+}
+
+static inline void* amo_host_ptr(riscv_t* riscv, riscv_word_t addr, int width) {
+    return riscv_mem_ptr(riscv, addr, width, RISCV_MEM_ATTR_READABLE | RISCV_MEM_ATTR_WRITABLE);
+}
+
+static inline void handle_lr(riscv_t* riscv, int width) {
+    riscv_word_t addr = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    if (amo_misaligned(riscv, addr, width, EXCP_LOAD_MISALIGNED)) {
+        return;
+    }
+    // LR 只读取 按读访问转换 不能置位 D 也不能在只读页上产生写缺页
+    void* ptr = riscv_mem_ptr(riscv, addr, width, RISCV_MEM_ATTR_READABLE);
+
+    riscv_word_t res = 0;
+    if (ptr) {
+        res = (width == 8) ? (riscv_word_t)atomic_load_u64((uint64_t*)ptr) : atomic_load_u32((uint32_t*)ptr);
+    }
+    else if (riscv_mem_read(riscv, addr, (uint8_t*)&res, width) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, addr);
+        return;
+    }
+    if (width == 4) {
+        res = sext_w(res);
+    }
+
+    // 记录读到的值 SC 时只要内存中仍然是这个值就认为保留有效
+    riscv->reserve_valid = 1;
+    riscv->reserve_addr = addr;
+    riscv->reserve_value = res;
+    riscv_write_reg(riscv, riscv->instr.r.rd, res);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_sc(riscv_t* riscv, int width) {
+    riscv_word_t addr = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    if (amo_misaligned(riscv, addr, width, EXCP_STORE_MISALIGNED)) {
+        return;
+    }
+
+    // rd 写 0 表示成功 写 1 表示失败
+    riscv_word_t fail = 1;
+    if (riscv->reserve_valid && (riscv->reserve_addr == addr)) {
+        void* ptr = amo_host_ptr(riscv, addr, width);
+        if (ptr) {
+            // 比较交换无法识别 A-B-A 形式的修改 对 LR/SC 实现的锁和计数器没有影响
+            int ok = (width == 8) ? atomic_cas_u64((uint64_t*)ptr, riscv->reserve_value, source)
+                                  : atomic_cas_u32((uint32_t*)ptr, (uint32_t)riscv->reserve_value, (uint32_t)source);
+            fail = ok ? 0 : 1;
+            if (ok && riscv->write_log) {
+                riscv_write_log_add(riscv, addr, (uint8_t*)&source, width);
+            }
+        }
+        else if (riscv_mem_write(riscv, addr, (uint8_t*)&source, width) < 0) {
+            riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, addr);
+            return;
+        }
+        else {
+            fail = 0;
+        }
+    }
+
+    // 无论成功与否 SC 都会清除保留
+    riscv->reserve_valid = 0;
+    riscv_write_reg(riscv, riscv->instr.r.rd, fail);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 根据 funct5 计算 AMO 写回内存的新值
+// .w 的两个操作数先符号扩展到 XLEN: 有符号和无符号的大小关系都与 32 位比较相同 写回时只取低 32 位
+static inline riscv_word_t amo_compute(riscv_word_t funct5, riscv_word_t old, riscv_word_t source) {
+    switch (funct5) {
+    case FUNC5_AMOSWAP:
+        return source;
+    case FUNC5_AMOADD:
+        return old + source;
+    case FUNC5_AMOXOR:
+        return old ^ source;
+    case FUNC5_AMOAND:
+        return old & source;
+    case FUNC5_AMOOR:
+        return old | source;
+    case FUNC5_AMOMIN:
+        return ((riscv_sword_t)old < (riscv_sword_t)source) ? old : source;
+    case FUNC5_AMOMAX:
+        return ((riscv_sword_t)old > (riscv_sword_t)source) ? old : source;
+    case FUNC5_AMOMINU:
+        return (old < source) ? old : source;
+    case FUNC5_AMOMAXU:
+    default:
+        return (old > source) ? old : source;
+    }
+}
+
+// 宿主机有对应原子指令的直接映射 min/max 没有 用比较交换循环实现
+static inline uint32_t amo_host_u32(uint32_t* ptr, riscv_word_t funct5, uint32_t source) {
+    uint32_t old;
+    switch (funct5) {
+    case FUNC5_AMOSWAP:
+        return atomic_xchg_u32(ptr, source);
+    case FUNC5_AMOADD:
+        return atomic_add_u32(ptr, source);
+    case FUNC5_AMOXOR:
+        return atomic_xor_u32(ptr, source);
+    case FUNC5_AMOAND:
+        return atomic_and_u32(ptr, source);
+    case FUNC5_AMOOR:
+        return atomic_or_u32(ptr, source);
+    default:
+        do {
+            old = atomic_load_u32(ptr);
+        } while (!atomic_cas_u32(ptr, old, (uint32_t)amo_compute(funct5, sext_w(old), sext_w(source))));
+        return old;
+    }
+}
+
+static inline uint64_t amo_host_u64(uint64_t* ptr, riscv_word_t funct5, uint64_t source) {
+    uint64_t old;
+    switch (funct5) {
+    case FUNC5_AMOSWAP:
+        return atomic_xchg_u64(ptr, source);
+    case FUNC5_AMOADD:
+        return atomic_add_u64(ptr, source);
+    case FUNC5_AMOXOR:
+        return atomic_xor_u64(ptr, source);
+    case FUNC5_AMOAND:
+        return atomic_and_u64(ptr, source);
+    case FUNC5_AMOOR:
+        return atomic_or_u64(ptr, source);
+    default:
+        do {
+            old = atomic_load_u64(ptr);
+        } while (!atomic_cas_u64(ptr, old, amo_compute(funct5, (riscv_word_t)old, (riscv_word_t)source)));
+        return old;
+    }
+}
+
+static inline void handle_amo(riscv_t* riscv, int width) {
+    riscv_word_t addr = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t funct5 = riscv->instr.r.funct7 >> 2;
+    if (amo_misaligned(riscv, addr, width, EXCP_STORE_MISALIGNED)) {
+        return;
+    }
+    void* ptr = amo_host_ptr(riscv, addr, width);
+
+    riscv_word_t old = 0;
+    if (ptr) {
+        old = (width == 8) ? (riscv_word_t)amo_host_u64((uint64_t*)ptr, funct5, source) : amo_host_u32((uint32_t*)ptr, funct5, (uint32_t)source);
+        if (riscv->write_log) {
+            riscv_word_t result = (width == 4) ? amo_compute(funct5, sext_w(old), sext_w(source)) : amo_compute(funct5, old, source);
+            riscv_write_log_add(riscv, addr, (uint8_t*)&result, width);
+        }
+    }
+    else {
+        // AMO 的访问错误统一报告为存储错误
+        if (riscv_mem_read(riscv, addr, (uint8_t*)&old, width) < 0) {
+            riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, addr);
+            return;
+        }
+        if (width == 4) {
+            old = sext_w(old);
+            source = sext_w(source);
+        }
+        riscv_word_t result = amo_compute(funct5, old, source);
+        if (riscv_mem_write(riscv, addr, (uint8_t*)&result, width) < 0) {
+            riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, addr);
+            return;
+        }
+    }
+    if (width == 4) {
+        old = sext_w(old);
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, old);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// F-Extension
+// 运算直接交给宿主机 FPU 异常标志由硬件累积在线程的浮点环境中 读 fcsr 时才取出
+// 宿主机的舍入模式在进入执行时已经按 frm 设置 只有指令给出不同的静态舍入模式时才临时切换
+#define FREG_NAN_BOX        0xFFFFFFFF00000000ULL
+#define F32_CANONICAL_NAN   0x7FC00000
+#define F32_SIGN            0x80000000
+
+typedef union _f32_t {
+    float f;
+    uint32_t u;
+}f32_t;
+
+static inline int f32_is_nan(uint32_t bits) {
+    return (bits & ~F32_SIGN) > 0x7F800000;
+}
+
+static inline int f32_is_snan(uint32_t bits) {
+    return f32_is_nan(bits) && ((bits & 0x00400000) == 0);
+}
+
+// 读取单精度寄存器 高 32 位不全为 1 说明不是合法的 NaN-boxing 视为规范 NaN
+static inline uint32_t fpu_read_bits(riscv_t* riscv, int reg) {
+    uint64_t raw = riscv->fregs[reg];
+    return ((raw & FREG_NAN_BOX) == FREG_NAN_BOX) ? (uint32_t)raw : F32_CANONICAL_NAN;
+}
+
+static inline float fpu_read_s(riscv_t* riscv, int reg) {
+    f32_t val;
+    val.u = fpu_read_bits(riscv, reg);
+    return val.f;
+}
+
+static inline void fpu_write_bits(riscv_t* riscv, int reg, uint32_t bits) {
+    riscv->fregs[reg] = FREG_NAN_BOX | bits;
+}
+
+// 运算结果写回 RISC-V 要求所有 NaN 结果都是规范 NaN 宿主机会保留输入的 payload
+static inline void fpu_write_s(riscv_t* riscv, int reg, float result) {
+    f32_t val;
+    val.f = result;
+    fpu_write_bits(riscv, reg, f32_is_nan(val.u) ? F32_CANONICAL_NAN : val.u);
+}
+
+// rm 到宿主机舍入模式  宿主机没有 RMM 用就近舍入代替  保留的编码同样按就近舍入处理
+static inline int fpu_host_round(riscv_word_t rm) {
+    switch (rm) {
+    case FRM_RTZ:
+        return FE_TOWARDZERO;
+    case FRM_RDN:
+        return FE_DOWNWARD;
+    case FRM_RUP:
+        return FE_UPWARD;
+    default:
+        return FE_TONEAREST;
+    }
+}
+
+// 指令的静态舍入模式与 frm 不同时临时切换 返回需要恢复的模式 不需要切换时返回 -1
+static inline int fpu_round_begin(riscv_t* riscv, riscv_word_t rm) {
+    if ((rm == FRM_DYN) || (rm == riscv->frm)) {
+        return -1;
+    }
+    int prev = fegetround();
+    fesetround(fpu_host_round(rm));
+    return prev;
+}
+
+static inline void fpu_round_end(int prev) {
+    if (prev >= 0) {
+        fesetround(prev);
+    }
+}
+
+// FLW/FSW
+static inline void handle_flw(riscv_t* riscv) {
+    riscv_word_t base_addr = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    int32_t offset = i_get_imm(riscv->instr);
+
+    uint32_t res = 0;
+    if (riscv_mem_read(riscv, base_addr + offset, (uint8_t*)&res, 4) < 0) {
+        riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
+    fpu_write_bits(riscv, riscv->instr.i.rd, res);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fsw(riscv_t* riscv) {
+    riscv_word_t base_addr = riscv_read_reg(riscv, riscv->instr.s.rs1);
+    int32_t offset = s_get_offset(riscv->instr);
+
+    // 按原样存储低 32 位 不检查 NaN-boxing
+    uint32_t target = (uint32_t)riscv->fregs[riscv->instr.s.rs2];
+    if (riscv_mem_write(riscv, base_addr + offset, (uint8_t*)&target, 4) < 0) {
+        riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, base_addr + offset);
+        return;
+    }
+
+    riscv->pc += riscv->instr_size;
+}
+
+// R4-Type: rs3 位于 funct7 的高 5 位
+#define r4_get_rs3(instr)      ((instr).r.funct7 >> 2)
+
+static inline void handle_fmadd_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fmaf(fpu_read_s(riscv, riscv->instr.r.rs1), fpu_read_s(riscv, riscv->instr.r.rs2), fpu_read_s(riscv, r4_get_rs3(riscv->instr)));
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fmsub_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fmaf(fpu_read_s(riscv, riscv->instr.r.rs1), fpu_read_s(riscv, riscv->instr.r.rs2), -fpu_read_s(riscv, r4_get_rs3(riscv->instr)));
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fnmsub_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fmaf(-fpu_read_s(riscv, riscv->instr.r.rs1), fpu_read_s(riscv, riscv->instr.r.rs2), fpu_read_s(riscv, r4_get_rs3(riscv->instr)));
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fnmadd_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fmaf(-fpu_read_s(riscv, riscv->instr.r.rs1), fpu_read_s(riscv, riscv->instr.r.rs2), -fpu_read_s(riscv, r4_get_rs3(riscv->instr)));
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 四则运算和开方
+static inline void handle_fadd_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fpu_read_s(riscv, riscv->instr.r.rs1) + fpu_read_s(riscv, riscv->instr.r.rs2);
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fsub_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fpu_read_s(riscv, riscv->instr.r.rs1) - fpu_read_s(riscv, riscv->instr.r.rs2);
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fmul_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fpu_read_s(riscv, riscv->instr.r.rs1) * fpu_read_s(riscv, riscv->instr.r.rs2);
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fdiv_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = fpu_read_s(riscv, riscv->instr.r.rs1) / fpu_read_s(riscv, riscv->instr.r.rs2);
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fsqrt_s(riscv_t* riscv) {
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result = sqrtf(fpu_read_s(riscv, riscv->instr.r.rs1));
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 符号注入 只操作符号位 不产生异常
+static inline void handle_fsgnj_s(riscv_t* riscv) {
+    uint32_t source1 = fpu_read_bits(riscv, riscv->instr.r.rs1);
+    uint32_t source2 = fpu_read_bits(riscv, riscv->instr.r.rs2);
+    uint32_t sign = 0;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_FSGNJ:
+        sign = source2 & F32_SIGN;
+        break;
+    case FUNC3_FSGNJN:
+        sign = ~source2 & F32_SIGN;
+        break;
+    default:
+        sign = (source1 ^ source2) & F32_SIGN;
+        break;
+    }
+    fpu_write_bits(riscv, riscv->instr.r.rd, (source1 & ~F32_SIGN) | sign);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 只有一个操作数是 NaN 时返回另一个 并且认为 -0.0 小于 +0.0
+static inline void handle_fminmax_s(riscv_t* riscv) {
+    uint32_t source1 = fpu_read_bits(riscv, riscv->instr.r.rs1);
+    uint32_t source2 = fpu_read_bits(riscv, riscv->instr.r.rs2);
+    int is_max = (riscv->instr.r.funct3 == FUNC3_FMAX);
+
+    if (f32_is_snan(source1) || f32_is_snan(source2)) {
+        riscv->fflags |= FFLAGS_NV;
+    }
 
-    riscv->pc += sizeof(riscv_word_t);
+    uint32_t result;
+    if (f32_is_nan(source1) && f32_is_nan(source2)) {
+        result = F32_CANONICAL_NAN;
+    }
+    else if (f32_is_nan(source1)) {
+        result = source2;
+    }
+    else if (f32_is_nan(source2)) {
+        result = source1;
+    }
+    else if (((source1 | source2) & ~F32_SIGN) == 0) {
+        // 两个都是 0: min 取负号 max 取正号
+        result = is_max ? (source1 & source2) : (source1 | source2);
+    }
+    else {
+        f32_t a, b;
+        a.u = source1;
+        b.u = source2;
+        result = ((a.f < b.f) != is_max) ? source1 : source2;
+    }
+    fpu_write_bits(riscv, riscv->instr.r.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 比较结果写入整数寄存器  feq 只对 sNaN 报无效操作 flt/fle 对任意 NaN 报无效操作
+static inline void handle_fcmp_s(riscv_t* riscv) {
+    uint32_t source1 = fpu_read_bits(riscv, riscv->instr.r.rs1);
+    uint32_t source2 = fpu_read_bits(riscv, riscv->instr.r.rs2);
+    riscv_word_t result = 0;
+
+    if (f32_is_nan(source1) || f32_is_nan(source2)) {
+        if ((riscv->instr.r.funct3 != FUNC3_FEQ) || f32_is_snan(source1) || f32_is_snan(source2)) {
+            riscv->fflags |= FFLAGS_NV;
+        }
+    }
+    else {
+        f32_t a, b;
+        a.u = source1;
+        b.u = source2;
+        switch (riscv->instr.r.funct3) {
+        case FUNC3_FEQ:
+            result = a.f == b.f;
+            break;
+        case FUNC3_FLT:
+            result = a.f < b.f;
+            break;
+        default:
+            result = a.f <= b.f;
+            break;
+        }
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 按舍入模式取整 不依赖宿主机当前的舍入模式  调用前已经排除 NaN 和无穷
+static inline float fpu_round_int(riscv_t* riscv, float val, riscv_word_t rm) {
+    if (rm == FRM_DYN) {
+        rm = riscv->frm;
+    }
+    switch (rm) {
+    case FRM_RTZ:
+        return truncf(val);
+    case FRM_RDN:
+        return floorf(val);
+    case FRM_RUP:
+        return ceilf(val);
+    case FRM_RMM:
+        return roundf(val);
+    default:
+        // remainderf 的商按偶数优先取整 差值就是 RNE 的结果 且是精确的
+        return val - remainderf(val, 1.0f);
+    }
+}
+
+// 超出范围或 NaN 时饱和到边界并报无效操作 否则结果不精确时报 NX
+// rs2 = 0/1 为 fcvt.w/wu  RV64 上 rs2 = 2/3 为 fcvt.l/lu  32 位结果符号扩展到 XLEN
+static inline void handle_fcvt_w_s(riscv_t* riscv) {
+    float source = fpu_read_s(riscv, riscv->instr.r.rs1);
+    int is_unsigned = riscv->instr.r.rs2 & 1;
+    int is_long = (RISCV_XLEN == 64) && (riscv->instr.r.rs2 & 2);
+    // 有符号范围为 [-bound, bound) 无符号范围为 [0, 2 * bound)
+    float bound = is_long ? 9223372036854775808.0f : 2147483648.0f;
+    uint64_t umax = is_long ? UINT64_MAX : UINT32_MAX;
+    int64_t smax = is_long ? INT64_MAX : INT32_MAX;
+    int64_t smin = is_long ? INT64_MIN : INT32_MIN;
+    uint64_t result;
+
+    if (isnan(source)) {
+        result = is_unsigned ? umax : (uint64_t)smax;
+        riscv->fflags |= FFLAGS_NV;
+    }
+    else {
+        float rounded = isinf(source) ? source : fpu_round_int(riscv, source, riscv->instr.r.funct3);
+        if (is_unsigned && (rounded < 0.0f)) {
+            result = 0;
+            riscv->fflags |= FFLAGS_NV;
+        }
+        else if (is_unsigned && (rounded >= 2.0f * bound)) {
+            result = umax;
+            riscv->fflags |= FFLAGS_NV;
+        }
+        else if (!is_unsigned && (rounded < -bound)) {
+            result = (uint64_t)smin;
+            riscv->fflags |= FFLAGS_NV;
+        }
+        else if (!is_unsigned && (rounded >= bound)) {
+            result = (uint64_t)smax;
+            riscv->fflags |= FFLAGS_NV;
+        }
+        else {
+            result = is_unsigned ? (uint64_t)rounded : (uint64_t)(int64_t)rounded;
+            if (rounded != source) {
+                riscv->fflags |= FFLAGS_NX;
+            }
+        }
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, is_long ? (riscv_word_t)result : sext_w(result));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fcvt_s_w(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.r.rs1);
+
+    // 超过 2^24 的整数转换可能不精确 由宿主机按当前舍入模式处理并记录 NX
+    int prev = fpu_round_begin(riscv, riscv->instr.r.funct3);
+    float result;
+    switch (riscv->instr.r.rs2) {
+    case 0:
+        result = (float)(int32_t)source;
+        break;
+    case 1:
+        result = (float)(uint32_t)source;
+        break;
+    case 2:
+        result = (float)(int64_t)(riscv_sword_t)source;
+        break;
+    default:
+        result = (float)(uint64_t)source;
+        break;
+    }
+    fpu_write_s(riscv, riscv->instr.r.rd, result);
+    fpu_round_end(prev);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 寄存器之间按位搬运 不做任何转换  RV64 上 fmv.x.w 的结果符号扩展
+static inline void handle_fmv_x_w(riscv_t* riscv) {
+    riscv_write_reg(riscv, riscv->instr.r.rd, sext_w(riscv->fregs[riscv->instr.r.rs1]));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_fmv_w_x(riscv_t* riscv) {
+    fpu_write_bits(riscv, riscv->instr.r.rd, (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1));
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 结果中只有一位为 1 依次表示: -inf -normal -subnormal -0 +0 +subnormal +normal +inf sNaN qNaN
+static inline void handle_fclass_s(riscv_t* riscv) {
+    uint32_t source = fpu_read_bits(riscv, riscv->instr.r.rs1);
+    uint32_t exp = (source >> 23) & 0xFF;
+    uint32_t frac = source & 0x007FFFFF;
+    int sign = (source & F32_SIGN) != 0;
+    int shift;
+
+    if (exp == 0xFF) {
+        if (frac == 0) {
+            shift = sign ? 0 : 7;
+        }
+        else {
+            shift = f32_is_snan(source) ? 8 : 9;
+        }
+    }
+    else if (exp == 0) {
+        if (frac == 0) {
+            shift = sign ? 3 : 4;
+        }
+        else {
+            shift = sign ? 2 : 5;
+        }
+    }
+    else {
+        shift = sign ? 1 : 6;
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, 1 << shift);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// V-Extension
+// 所有向量 handler 返回 -1 表示指令不合法 由调用方跳转到 cond_end
+#define v_get_funct6(instr)     ((instr).r.funct7 >> 1)
+#define v_get_vm(instr)         ((instr).r.funct7 & 0x1)
+#define v_get_simm5(instr)      ((int32_t)((instr).r.rs1 << 27) >> 27)
+
+// 根据 vtype 计算 VLMAX  vtype 不合法时返回 0
+static inline riscv_word_t rvv_vlmax(riscv_word_t vtype) {
+    riscv_word_t vsew = (vtype >> 3) & 0x7;
+    riscv_word_t vlmul = vtype & 0x7;
+    if ((vtype >> 8) || (vsew > 2) || (vlmul == 4)) {
+        return 0;
+    }
+
+    riscv_word_t sew = 8 << vsew;
+    if (vlmul < 4) {
+        return (RISCV_VLEN / sew) << vlmul;
+    }
+
+    // 分数 LMUL: 要求 SEW <= LMUL * ELEN
+    riscv_word_t shift = 8 - vlmul;
+    if (sew > (RISCV_ELEN >> shift)) {
+        return 0;
+    }
+    return (RISCV_VLEN / sew) >> shift;
+}
+
+// 元素宽度的下标 0/1/2 对应 SEW = 8/16/32
+static inline int rvv_sew_index(riscv_t* riscv) {
+    return (riscv->vtype >> 3) & 0x7;
+}
+
+// 寄存器组包含的寄存器个数 分数 LMUL 按 1 计算
+static inline int rvv_lmul_regs(riscv_t* riscv) {
+    riscv_word_t vlmul = riscv->vtype & 0x7;
+    return (vlmul < 4) ? (1 << vlmul) : 1;
+}
+
+// 寄存器编号必须按寄存器组大小对齐
+static inline int rvv_check_group(riscv_t* riscv, int reg) {
+    return (reg & (rvv_lmul_regs(riscv) - 1)) == 0;
+}
+
+static inline riscv_word_t rvv_read_elem(const uint8_t* base, int index, int size) {
+    riscv_word_t val = 0;
+    memcpy(&val, base + index * size, size);
+    return val;
+}
+
+static inline void rvv_write_elem(uint8_t* base, int index, int size, riscv_word_t val) {
+    memcpy(base + index * size, &val, size);
+}
+
+// vsetvli / vsetivli / vsetvl 共用: 区别只在于 vtype 和 AVL 的来源
+static inline void handle_vsetvl(riscv_t* riscv) {
+    riscv_word_t raw = riscv->instr.raw;
+    riscv_word_t rd = riscv->instr.r.rd;
+    riscv_word_t rs1 = riscv->instr.r.rs1;
+    riscv_word_t vtype;
+    riscv_word_t avl;
+
+    if ((raw >> 30) == 0x3) {
+        // vsetivli: AVL 是 rs1 位置上的 5 位无符号立即数
+        vtype = (raw >> 20) & 0x3FF;
+        avl = rs1;
+    }
+    else {
+        vtype = (raw >> 31) ? riscv_read_reg(riscv, riscv->instr.r.rs2) : ((raw >> 20) & 0x7FF);
+        if (rs1 != 0) {
+            avl = riscv_read_reg(riscv, rs1);
+        }
+        else {
+            // rs1 = x0: rd 也是 x0 时保持 vl 不变  否则取 VLMAX
+            avl = (rd == 0) ? riscv->vl : ~(riscv_word_t)0;
+        }
+    }
+
+    riscv_word_t vlmax = rvv_vlmax(vtype);
+    if (vlmax == 0) {
+        riscv->vtype = RVV_VILL;
+        riscv->vl = 0;
+    }
+    else {
+        riscv->vtype = vtype;
+        riscv->vl = (avl < vlmax) ? avl : vlmax;
+    }
+    riscv_write_reg(riscv, rd, riscv->vl);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 单位步长 load/store: 只接受 vm = 1 mop = 0 nf = 0 的编码 也就是 funct7 = 1 且 rs2 = 0
+static inline int rvv_check_unit_stride(riscv_t* riscv, int eew) {
+    if ((riscv->vtype & RVV_VILL) || (riscv->instr.r.funct7 != 0x1) || (riscv->instr.r.rs2 != 0)) {
+        return -1;
+    }
+
+    // EEW 与 SEW 不同时寄存器组大小会变化 这里只保证访问不超出寄存器堆
+    riscv_word_t vd = riscv->instr.r.rd;
+    if (vd * RISCV_VLENB + riscv->vl * eew > sizeof(riscv->vregs)) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int handle_vle(riscv_t* riscv, int eew) {
+    if (rvv_check_unit_stride(riscv, eew) < 0) {
+        return -1;
+    }
+
+    riscv_word_t addr = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    uint8_t* vd = riscv->vregs[riscv->instr.r.rd];
+    riscv_word_t bytes = riscv->vl * eew;
+
+    if (bytes) {
+        // 普通存储器直接整段复制 外设则逐个元素读取
+        uint8_t* src = riscv_mem_ptr(riscv, addr, bytes, RISCV_MEM_ATTR_READABLE);
+        if (src) {
+            memcpy(vd, src, bytes);
+        }
+        else {
+            // 没有实现 vstart 出错后整条指令重新执行 重复读写的结果相同
+            for (riscv_word_t i = 0; i < riscv->vl; i++) {
+                if (riscv_mem_read(riscv, addr + i * eew, vd + i * eew, eew) < 0) {
+                    riscv_mem_fault(riscv, EXCP_LOAD_ACCESS_FAULT, addr + i * eew);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+static inline int handle_vse(riscv_t* riscv, int eew) {
+    if (rvv_check_unit_stride(riscv, eew) < 0) {
+        return -1;
+    }
+
+    // 存储指令的 vs3 位于 rd 的位置
+    riscv_word_t addr = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    uint8_t* vs3 = riscv->vregs[riscv->instr.r.rd];
+    riscv_word_t bytes = riscv->vl * eew;
+
+    if (bytes) {
+        uint8_t* dest = riscv_mem_ptr(riscv, addr, bytes, RISCV_MEM_ATTR_WRITABLE);
+        if (dest) {
+            memcpy(dest, vs3, bytes);
+            for (riscv_word_t i = 0; riscv->write_log && (i < riscv->vl); i++) {
+                riscv_write_log_add(riscv, addr + i * eew, vs3 + i * eew, eew);
+            }
+        }
+        else {
+            for (riscv_word_t i = 0; i < riscv->vl; i++) {
+                if (riscv_mem_write(riscv, addr + i * eew, vs3 + i * eew, eew) < 0) {
+                    riscv_mem_fault(riscv, EXCP_STORE_ACCESS_FAULT, addr + i * eew);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// 取出第二个操作数: VV 直接使用 vs1 寄存器组  VX/VI 先把标量复制成向量 与 VV 共用同一个运算核心
+static inline const uint8_t* rvv_operand(riscv_t* riscv, uint8_t* splat) {
+    int size = 1 << rvv_sew_index(riscv);
+    riscv_word_t scalar;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_OPIVV:
+    case FUNC3_OPMVV:
+        return rvv_check_group(riscv, riscv->instr.r.rs1) ? riscv->vregs[riscv->instr.r.rs1] : NULL;
+    case FUNC3_OPIVI:
+        scalar = (riscv_word_t)v_get_simm5(riscv->instr);
+        break;
+    default:
+        scalar = riscv_read_reg(riscv, riscv->instr.r.rs1);
+        break;
+    }
+
+    for (riscv_word_t i = 0; i < riscv->vl; i++) {
+        rvv_write_elem(splat, i, size, scalar);
+    }
+    return splat;
+}
+
+// 逐元素运算  reverse 用于 vrsub: vd = op1 - vs2
+static inline int handle_vop(riscv_t* riscv, rvv_op_t op, int reverse) {
+    if ((riscv->vtype & RVV_VILL) || !v_get_vm(riscv->instr)) {
+        return -1;
+    }
+    if (!rvv_check_group(riscv, riscv->instr.r.rd) || !rvv_check_group(riscv, riscv->instr.r.rs2)) {
+        return -1;
+    }
+
+    uint8_t splat[RISCV_VLENB * RVV_LMUL_MAX];
+    const uint8_t* op1 = rvv_operand(riscv, splat);
+    if (op1 == NULL) {
+        return -1;
+    }
+
+    uint8_t* vd = riscv->vregs[riscv->instr.r.rd];
+    const uint8_t* vs2 = riscv->vregs[riscv->instr.r.rs2];
+    rvv_binop_t kernel = riscv->rvv->binop[op][rvv_sew_index(riscv)];
+    if (reverse) {
+        kernel(vd, op1, vs2, riscv->vl);
+    }
+    else {
+        kernel(vd, vs2, op1, riscv->vl);
+    }
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// 归约: vd[0] = vs1[0] op vs2[0] op ... op vs2[vl - 1]  vl 为 0 时不写 vd
+static inline int handle_vred(riscv_t* riscv, rvv_op_t op) {
+    if ((riscv->vtype & RVV_VILL) || !v_get_vm(riscv->instr) || !rvv_check_group(riscv, riscv->instr.r.rs2)) {
+        return -1;
+    }
+
+    int sew_index = rvv_sew_index(riscv);
+    int size = 1 << sew_index;
+    if (riscv->vl) {
+        riscv_word_t init = rvv_read_elem(riscv->vregs[riscv->instr.r.rs1], 0, size);
+        riscv_word_t result = riscv->rvv->redop[op][sew_index](riscv->vregs[riscv->instr.r.rs2], init, riscv->vl);
+        rvv_write_elem(riscv->vregs[riscv->instr.r.rd], 0, size, result);
+    }
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// vmv.v.v / vmv.v.x / vmv.v.i
+static inline int handle_vmv_v(riscv_t* riscv) {
+    if ((riscv->vtype & RVV_VILL) || !v_get_vm(riscv->instr) || (riscv->instr.r.rs2 != 0) || !rvv_check_group(riscv, riscv->instr.r.rd)) {
+        return -1;
+    }
+
+    uint8_t splat[RISCV_VLENB * RVV_LMUL_MAX];
+    const uint8_t* op1 = rvv_operand(riscv, splat);
+    if (op1 == NULL) {
+        return -1;
+    }
+    memmove(riscv->vregs[riscv->instr.r.rd], op1, riscv->vl << rvv_sew_index(riscv));
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// vmv.x.s: 取 vs2 的第 0 个元素 符号扩展后写入 rd  不受 vl 影响
+static inline int handle_vmv_x_s(riscv_t* riscv) {
+    if ((riscv->vtype & RVV_VILL) || !v_get_vm(riscv->instr) || (riscv->instr.r.rs1 != 0)) {
+        return -1;
+    }
+
+    int bits = 8 << rvv_sew_index(riscv);
+    riscv_word_t val = rvv_read_elem(riscv->vregs[riscv->instr.r.rs2], 0, bits / 8);
+    if (bits < RISCV_XLEN) {
+        val = (riscv_word_t)((riscv_sword_t)(val << (RISCV_XLEN - bits)) >> (RISCV_XLEN - bits));
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, val);
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// vmv.s.x: 把 rs1 写入 vd 的第 0 个元素  vl 为 0 时不写
+static inline int handle_vmv_s_x(riscv_t* riscv) {
+    if ((riscv->vtype & RVV_VILL) || !v_get_vm(riscv->instr) || (riscv->instr.r.rs2 != 0)) {
+        return -1;
+    }
+
+    if (riscv->vl) {
+        rvv_write_elem(riscv->vregs[riscv->instr.r.rd], 0, 1 << rvv_sew_index(riscv), riscv_read_reg(riscv, riscv->instr.r.rs1));
+    }
+
+    riscv->pc += riscv->instr_size;
+    return 0;
+}
+
+// Zba/Zbb
+// 位运算尽量映射到编译器内建函数 由编译器生成对应的单条宿主机指令
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline riscv_word_t bit_clz(riscv_word_t val) {
+    if (val == 0) {
+        return RISCV_XLEN;
+    }
+#if defined(_MSC_VER) && (RISCV_XLEN == 64)
+    unsigned long index;
+    _BitScanReverse64(&index, val);
+    return 63 - index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, val);
+    return 31 - index;
+#elif RISCV_XLEN == 64
+    return __builtin_clzll(val);
+#else
+    return __builtin_clz(val);
+#endif
+}
+
+static inline riscv_word_t bit_ctz(riscv_word_t val) {
+    if (val == 0) {
+        return RISCV_XLEN;
+    }
+#if defined(_MSC_VER) && (RISCV_XLEN == 64)
+    unsigned long index;
+    _BitScanForward64(&index, val);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, val);
+    return index;
+#elif RISCV_XLEN == 64
+    return __builtin_ctzll(val);
+#else
+    return __builtin_ctz(val);
+#endif
+}
+
+static inline riscv_word_t bit_cpop(riscv_word_t val) {
+#ifdef _MSC_VER
+    // __popcnt 要求宿主机支持 POPCNT 指令 这里用不依赖硬件的写法  ones 为每个字节都是 0x01 的常数
+    const riscv_word_t ones = ~(riscv_word_t)0 / 0xFF;
+    val = val - ((val >> 1) & (ones * 0x55));
+    val = (val & (ones * 0x33)) + ((val >> 2) & (ones * 0x33));
+    val = (val + (val >> 4)) & (ones * 0x0F);
+    return (val * ones) >> (RISCV_XLEN - 8);
+#elif RISCV_XLEN == 64
+    return __builtin_popcountll(val);
+#else
+    return __builtin_popcount(val);
+#endif
+}
+
+static inline riscv_word_t bit_bswap(riscv_word_t val) {
+#if defined(_MSC_VER) && (RISCV_XLEN == 64)
+    return _byteswap_uint64(val);
+#elif defined(_MSC_VER)
+    return _byteswap_ulong(val);
+#elif RISCV_XLEN == 64
+    return __builtin_bswap64(val);
+#else
+    return __builtin_bswap32(val);
+#endif
+}
+
+// 编译器能识别这种写法并生成循环移位指令
+static inline riscv_word_t bit_ror(riscv_word_t val, riscv_word_t shamt) {
+    shamt &= RISCV_SHAMT_MASK;
+    return (val >> shamt) | (val << ((RISCV_XLEN - shamt) & RISCV_SHAMT_MASK));
+}
+
+// Zba: rd = (rs1 << n) + rs2  n 由 funct3 的高 2 位给出
+static inline void handle_shxadd(riscv_t* riscv) {
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t shamt = riscv->instr.r.funct3 >> 1;
+
+    riscv_write_reg(riscv, riscv->instr.r.rd, (source1 << shamt) + source2);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// andn/orn/xnor: 第二个操作数取反后再做逻辑运算
+static inline void handle_logic_neg(riscv_t* riscv) {
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = ~riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t result;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_AND:
+        result = source1 & source2;
+        break;
+    case FUNC3_OR:
+        result = source1 | source2;
+        break;
+    default:
+        result = source1 ^ source2;
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_minmax(riscv_t* riscv) {
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t result;
+
+    switch (riscv->instr.r.funct3) {
+    case FUNC3_XOR:         // min
+        result = ((riscv_sword_t)source1 < (riscv_sword_t)source2) ? source1 : source2;
+        break;
+    case FUNC3_SR:          // minu
+        result = (source1 < source2) ? source1 : source2;
+        break;
+    case FUNC3_OR:          // max
+        result = ((riscv_sword_t)source1 > (riscv_sword_t)source2) ? source1 : source2;
+        break;
+    default:                // maxu
+        result = (source1 > source2) ? source1 : source2;
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.r.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_zext_h(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_write_reg(riscv, riscv->instr.r.rd, source & 0xFFFF);
+
+    riscv->pc += riscv->instr_size;
 }
-#endif /* INSTER_IMPL_H */
\ No newline at end of file
+
+static inline void handle_rol(riscv_t* riscv) {
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+
+    // 左移 n 位等于右移 XLEN - n 位
+    riscv_write_reg(riscv, riscv->instr.r.rd, bit_ror(source1, RISCV_XLEN - (source2 & RISCV_SHAMT_MASK)));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_ror(riscv_t* riscv) {
+    riscv_word_t source1 = riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+
+    riscv_write_reg(riscv, riscv->instr.r.rd, bit_ror(source1, source2));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_rori(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t shamt = riscv->instr.i.imm11_0 & RISCV_SHAMT_MASK;
+
+    riscv_write_reg(riscv, riscv->instr.i.rd, bit_ror(source, shamt));
+
+    riscv->pc += riscv->instr_size;
+}
+
+// clz/ctz/cpop/sext.b/sext.h 只有一个源操作数 具体操作由 rs2 位置区分 调用前已经检查过编码
+static inline void handle_bit_unary(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t result;
+
+    switch (riscv->instr.i.imm11_0 & 0x1F) {
+    case UNARY_CLZ:
+        result = bit_clz(source);
+        break;
+    case UNARY_CTZ:
+        result = bit_ctz(source);
+        break;
+    case UNARY_CPOP:
+        result = bit_cpop(source);
+        break;
+    case UNARY_SEXT_B:
+        result = (riscv_word_t)(riscv_sword_t)(int8_t)source;
+        break;
+    default:
+        result = (riscv_word_t)(riscv_sword_t)(int16_t)source;
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+
+// 每个字节非零时置为 0xFF 否则为 0
+static inline void handle_orc_b(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+
+    // 低 7 位加上 0x7F 会进位到最高位 再与原值的最高位合并 得到每个字节是否非零
+    const riscv_word_t ones = ~(riscv_word_t)0 / 0xFF;
+    riscv_word_t nonzero = (((source & (ones * 0x7F)) + (ones * 0x7F)) | source) & (ones * 0x80);
+    riscv_write_reg(riscv, riscv->instr.i.rd, (nonzero >> 7) * 0xFF);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_rev8(riscv_t* riscv) {
+    riscv_word_t source = riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_write_reg(riscv, riscv->instr.i.rd, bit_bswap(source));
+
+    riscv->pc += riscv->instr_size;
+}
+
+#if RISCV_XLEN == 64
+// RV64 Zba/Zbb 的 W 形式: .uw 先把 rs1 零扩展到 32 位  W 运算只看低 32 位 结果符号扩展
+// add.uw 的 funct3 为 0 与 shNadd.uw 共用一个 handler
+static inline void handle_shxadd_uw(riscv_t* riscv) {
+    riscv_word_t source1 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+    riscv_word_t shamt = riscv->instr.r.funct3 >> 1;
+
+    riscv_write_reg(riscv, riscv->instr.r.rd, (source1 << shamt) + source2);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_slli_uw(riscv_t* riscv) {
+    riscv_word_t source = (uint32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t shamt = riscv->instr.i.imm11_0 & RISCV_SHAMT_MASK;
+
+    riscv_write_reg(riscv, riscv->instr.i.rd, source << shamt);
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline uint32_t bit_rorw(uint32_t val, riscv_word_t shamt) {
+    shamt &= 0x1F;
+    return (val >> shamt) | (val << ((32 - shamt) & 0x1F));
+}
+
+static inline void handle_rolw(riscv_t* riscv) {
+    uint32_t source1 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+
+    riscv_write_reg(riscv, riscv->instr.r.rd, sext_w(bit_rorw(source1, 32 - (source2 & 0x1F))));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_rorw(riscv_t* riscv) {
+    uint32_t source1 = (uint32_t)riscv_read_reg(riscv, riscv->instr.r.rs1);
+    riscv_word_t source2 = riscv_read_reg(riscv, riscv->instr.r.rs2);
+
+    riscv_write_reg(riscv, riscv->instr.r.rd, sext_w(bit_rorw(source1, source2)));
+
+    riscv->pc += riscv->instr_size;
+}
+
+static inline void handle_roriw(riscv_t* riscv) {
+    uint32_t source = (uint32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+
+    riscv_write_reg(riscv, riscv->instr.i.rd, sext_w(bit_rorw(source, riscv->instr.i.imm11_0)));
+
+    riscv->pc += riscv->instr_size;
+}
+
+// clzw/ctzw/cpopw: 复用 64 位版本  ctzw 在第 32 位补 1 使全零时结果为 32
+static inline void handle_bit_unary_w(riscv_t* riscv) {
+    uint32_t source = (uint32_t)riscv_read_reg(riscv, riscv->instr.i.rs1);
+    riscv_word_t result;
+
+    switch (riscv->instr.i.imm11_0 & 0x1F) {
+    case UNARY_CLZ:
+        result = bit_clz(source) - 32;
+        break;
+    case UNARY_CTZ:
+        result = bit_ctz((riscv_word_t)source | ((riscv_word_t)1 << 32));
+        break;
+    default:
+        result = bit_cpop(source);
+        break;
+    }
+    riscv_write_reg(riscv, riscv->instr.i.rd, result);
+
+    riscv->pc += riscv->instr_size;
+}
+#endif
+
+#endif /* INSTER_IMPL_H */
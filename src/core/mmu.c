@@ -0,0 +1,309 @@
+#include "riscv.h"
+#include <string.h>
+
+// Sv32/Sv39 地址转换 由 XLEN 在编译时选择
+// Sv32: 两级页表 每级 10 位虚拟页号 页表项 4 字节
+// Sv39: 三级页表 每级 9 位虚拟页号 页表项 8 字节  虚拟地址的高 25 位必须是第 38 位的符号扩展
+// TLB 命中时不访问页表 权限按当前特权级在每次访问时检查
+#if RISCV_XLEN == 64
+#define MMU_LEVELS          3
+#define VPN_BITS            9
+#define PTE_SIZE            8
+#define PTE_PPN(pte)        (((pte) >> 10) & 0xFFFFFFFFFFFULL)
+#define PTE_RESERVED(pte)   ((pte) >> 54)               // Svpbmt/Svnapot 没有实现 这些位必须为 0
+#define PPN_TOO_LARGE(ppn)  0
+#define VADDR_INVALID(va)   ((riscv_word_t)((riscv_sword_t)((va) << 25) >> 25) != (va))
+#else
+#define MMU_LEVELS          2
+#define VPN_BITS            10
+#define PTE_SIZE            4
+#define PTE_PPN(pte)        ((pte) >> 10)
+#define PTE_RESERVED(pte)   0
+#define PPN_TOO_LARGE(ppn)  ((ppn) >> 20)                // 只支持 32 位物理地址
+#define VADDR_INVALID(va)   0
+#endif
+
+#define VPN_SHIFT(level)    (RISCV_PAGE_SHIFT + VPN_BITS * (level))
+#define VPN(vaddr, level)   (((vaddr) >> VPN_SHIFT(level)) & ((1 << VPN_BITS) - 1))
+
+static inline riscv_tlb_entry_t* tlb_slot(riscv_tlb_entry_t* tlb, riscv_word_t vpn) {
+    return &tlb[vpn & (RISCV_TLB_SIZE - 1)];
+}
+
+// 数据访问使用的特权级: M 模式下 MPRV 置位时按 MPP 访问
+static inline int mmu_data_priv(riscv_t* riscv) {
+    riscv_word_t mstatus = riscv->riscv_csr_regs.mstatus;
+    if ((riscv->priv == RISCV_PRIV_M) && (mstatus & MSTATUS_MPRV)) {
+        return (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+    }
+    return riscv->priv;
+}
+
+void riscv_mmu_update(riscv_t* riscv) {
+    riscv_word_t satp = riscv->riscv_csr_regs.satp;
+    int paging = (satp & SATP_MODE) != 0;
+
+    riscv->data_mmu = paging && (mmu_data_priv(riscv) != RISCV_PRIV_M);
+
+    // ASID 固定为 0 借用这几位记录特权级 S/U 模式的译码结果互不混用
+    riscv->fetch_ctx = (paging && (riscv->priv != RISCV_PRIV_M)) ? (satp | ((riscv_word_t)riscv->priv << SATP_ASID_SHIFT)) : 0;
+}
+
+static int mmu_page_fault(int access) {
+    switch (access) {
+    case RISCV_ACCESS_EXEC:
+        return EXCP_INSTR_PAGE_FAULT;
+    case RISCV_ACCESS_WRITE:
+        return EXCP_STORE_PAGE_FAULT;
+    default:
+        return EXCP_LOAD_PAGE_FAULT;
+    }
+}
+
+static int mmu_access_fault(int access) {
+    switch (access) {
+    case RISCV_ACCESS_EXEC:
+        return EXCP_INSTR_ACCESS_FAULT;
+    case RISCV_ACCESS_WRITE:
+        return EXCP_STORE_ACCESS_FAULT;
+    default:
+        return EXCP_LOAD_ACCESS_FAULT;
+    }
+}
+
+// 按页表项的权限检查一次访问  写入时要求 D 已经置位 否则重新遍历页表去设置
+static int mmu_permit(riscv_t* riscv, riscv_word_t pte, int access) {
+    riscv_word_t mstatus = riscv->riscv_csr_regs.mstatus;
+    int priv = (access == RISCV_ACCESS_EXEC) ? riscv->priv : mmu_data_priv(riscv);
+
+    if (pte & PTE_U) {
+        // S 模式永远不能执行用户页 只有 SUM 置位时才能读写
+        if ((priv == RISCV_PRIV_S) && ((access == RISCV_ACCESS_EXEC) || !(mstatus & MSTATUS_SUM))) {
+            return 0;
+        }
+    }
+    else if (priv == RISCV_PRIV_U) {
+        return 0;
+    }
+
+    switch (access) {
+    case RISCV_ACCESS_EXEC:
+        return (pte & PTE_X) != 0;
+    case RISCV_ACCESS_WRITE:
+        return (pte & (PTE_W | PTE_D)) == (PTE_W | PTE_D);
+    default:
+        return (pte & PTE_R) || ((mstatus & MSTATUS_MXR) && (pte & PTE_X));
+    }
+}
+
+// 原子地置位 A/D 位  其它 hart 同时修改了这个页表项时返回 0 由调用者重新遍历页表  无法写入时返回 -1
+static int mmu_update_pte(riscv_t* riscv, riscv_word_t pte_addr, riscv_word_t old, riscv_word_t updated) {
+    void* ptr = riscv_pmem_ptr(riscv, pte_addr, PTE_SIZE, RISCV_MEM_ATTR_READABLE | RISCV_MEM_ATTR_WRITABLE);
+    if (ptr == NULL) {
+        // 页表不在存储器中 只能直接写回
+        return (riscv_pmem_write(riscv, pte_addr, (uint8_t*)&updated, PTE_SIZE) < 0) ? -1 : 1;
+    }
+#if RISCV_XLEN == 64
+    return atomic_cas_u64((uint64_t*)ptr, old, updated);
+#else
+    return atomic_cas_u32((uint32_t*)ptr, old, updated);
+#endif
+}
+
+// 遍历页表并填写 TLB 项
+static int mmu_walk(riscv_t* riscv, riscv_word_t vaddr, int access, riscv_tlb_entry_t* entry) {
+    riscv_word_t table;
+    riscv_word_t pte_addr = 0;
+    riscv_word_t pte = 0;
+    int level;
+
+    if (VADDR_INVALID(vaddr)) {
+        return mmu_page_fault(access);
+    }
+
+restart:
+    table = (riscv->riscv_csr_regs.satp & SATP_PPN) << RISCV_PAGE_SHIFT;
+    for (level = MMU_LEVELS - 1; level >= 0; level--) {
+        pte_addr = table + VPN(vaddr, level) * PTE_SIZE;
+        if (riscv_pmem_read(riscv, pte_addr, (uint8_t*)&pte, PTE_SIZE) < 0) {
+            return mmu_access_fault(access);
+        }
+
+        if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)) || PTE_RESERVED(pte)) {
+            return mmu_page_fault(access);
+        }
+        if (pte & (PTE_R | PTE_X)) {
+            break;
+        }
+
+        // 指向下一级页表
+        if (PPN_TOO_LARGE(PTE_PPN(pte))) {
+            return mmu_access_fault(access);
+        }
+        table = PTE_PPN(pte) << RISCV_PAGE_SHIFT;
+    }
+    if (level < 0) {
+        return mmu_page_fault(access);
+    }
+
+    // 大页的低位页号必须为 0
+    riscv_word_t super_mask = ((riscv_word_t)1 << (VPN_BITS * level)) - 1;
+    if (PTE_PPN(pte) & super_mask) {
+        return mmu_page_fault(access);
+    }
+    if (PPN_TOO_LARGE(PTE_PPN(pte))) {
+        return mmu_access_fault(access);
+    }
+
+    // 由硬件维护 A/D 位  没有权限时不会写回
+    // 用比较交换写回 读到页表项之后它被其它 hart 修改 (例如内核清除了 V 或 A) 时重新遍历 不能覆盖对方的修改
+    riscv_word_t update = PTE_A | ((access == RISCV_ACCESS_WRITE) ? PTE_D : 0);
+    if (!mmu_permit(riscv, pte | ((pte & PTE_W) ? PTE_D : 0), access)) {
+        return mmu_page_fault(access);
+    }
+    if ((pte & update) != update) {
+        int rc = mmu_update_pte(riscv, pte_addr, pte, pte | update);
+        if (rc < 0) {
+            return mmu_access_fault(access);
+        }
+        if (rc == 0) {
+            goto restart;
+        }
+        pte |= update;
+    }
+
+    // 大页内的 4K 页由虚拟地址的低位页号给出
+    riscv_word_t ppage = (PTE_PPN(pte) | ((vaddr >> RISCV_PAGE_SHIFT) & super_mask)) << RISCV_PAGE_SHIFT;
+
+    entry->valid = 1;
+    entry->vpn = vaddr >> RISCV_PAGE_SHIFT;
+    entry->ppage = ppage;
+    entry->pte = pte & 0xFF;
+    entry->host_read = riscv_pmem_ptr(riscv, ppage, RISCV_PAGE_SIZE, RISCV_MEM_ATTR_READABLE);
+    entry->host_write = riscv_pmem_ptr(riscv, ppage, RISCV_PAGE_SIZE, RISCV_MEM_ATTR_WRITABLE);
+    return 0;
+}
+
+int riscv_mmu_translate(riscv_t* riscv, riscv_word_t vaddr, int access, riscv_tlb_entry_t** entry) {
+    riscv_word_t vpn = vaddr >> RISCV_PAGE_SHIFT;
+    riscv_tlb_entry_t* slot = tlb_slot((access == RISCV_ACCESS_EXEC) ? riscv->itlb : riscv->dtlb, vpn);
+
+    if (!slot->valid || (slot->vpn != vpn) || !mmu_permit(riscv, slot->pte, access)) {
+        // 没有命中或者缓存的权限不够 (例如第一次写入需要设置 D 位) 重新遍历页表
+        slot->valid = 0;
+        int cause = mmu_walk(riscv, vaddr, access, slot);
+        if (cause) {
+            return cause;
+        }
+    }
+
+    *entry = slot;
+    return 0;
+}
+
+void riscv_tlb_flush(riscv_t* riscv, riscv_word_t vaddr, int all) {
+    riscv_word_t vpn = vaddr >> RISCV_PAGE_SHIFT;
+
+    if (all) {
+        for (int i = 0; i < RISCV_TLB_SIZE; i++) {
+            riscv->itlb[i].valid = 0;
+            riscv->dtlb[i].valid = 0;
+        }
+    }
+    else {
+        riscv_tlb_entry_t* slot = tlb_slot(riscv->itlb, vpn);
+        if (slot->vpn == vpn) {
+            slot->valid = 0;
+        }
+        slot = tlb_slot(riscv->dtlb, vpn);
+        if (slot->vpn == vpn) {
+            slot->valid = 0;
+        }
+    }
+
+    // 经过地址转换译码的块也要作废  没有开启转换时译码的块 (ctx 为 0) 不受影响
+    for (int i = 0; i < RISCV_BLOCK_CACHE_SIZE; i++) {
+        riscv_block_t* block = &riscv->block_cache[i];
+        if ((block->count == 0) || (block->ctx == 0)) {
+            continue;
+        }
+        if (all || ((block->start_pc >> RISCV_PAGE_SHIFT) == vpn) || (((block->end_pc - 1) >> RISCV_PAGE_SHIFT) == vpn)) {
+            block->count = 0;
+        }
+    }
+}
+
+int riscv_vmem_read(riscv_t* riscv, riscv_word_t vaddr, uint8_t* val, int width) {
+    // 跨页的非对齐访问按字节拆开 两页的映射可能不同
+    if ((vaddr & RISCV_PAGE_MASK) + width > RISCV_PAGE_SIZE) {
+        for (int i = 0; i < width; i++) {
+            if (riscv_vmem_read(riscv, vaddr + i, val + i, 1) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    riscv_tlb_entry_t* entry;
+    int cause = riscv_mmu_translate(riscv, vaddr, RISCV_ACCESS_READ, &entry);
+    if (cause) {
+        riscv_raise_exception(riscv, cause, vaddr);
+        return -1;
+    }
+    if (entry->host_read) {
+        memcpy(val, entry->host_read + (vaddr & RISCV_PAGE_MASK), width);
+        return 0;
+    }
+    return riscv_pmem_read(riscv, entry->ppage | (vaddr & RISCV_PAGE_MASK), val, width);
+}
+
+int riscv_vmem_write(riscv_t* riscv, riscv_word_t vaddr, uint8_t* val, int width) {
+    riscv_tlb_entry_t* entry;
+    int cause;
+
+    if ((vaddr & RISCV_PAGE_MASK) + width > RISCV_PAGE_SIZE) {
+        // 先转换两页 任何一页缺页时都不能已经写入了另一页的部分
+        riscv_word_t second = (vaddr | RISCV_PAGE_MASK) + 1;
+        if ((cause = riscv_mmu_translate(riscv, vaddr, RISCV_ACCESS_WRITE, &entry)) != 0) {
+            riscv_raise_exception(riscv, cause, vaddr);
+            return -1;
+        }
+        if ((cause = riscv_mmu_translate(riscv, second, RISCV_ACCESS_WRITE, &entry)) != 0) {
+            riscv_raise_exception(riscv, cause, second);
+            return -1;
+        }
+        for (int i = 0; i < width; i++) {
+            if (riscv_vmem_write(riscv, vaddr + i, val + i, 1) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    cause = riscv_mmu_translate(riscv, vaddr, RISCV_ACCESS_WRITE, &entry);
+    if (cause) {
+        riscv_raise_exception(riscv, cause, vaddr);
+        return -1;
+    }
+    if (entry->host_write) {
+        memcpy(entry->host_write + (vaddr & RISCV_PAGE_MASK), val, width);
+        return 0;
+    }
+    return riscv_pmem_write(riscv, entry->ppage | (vaddr & RISCV_PAGE_MASK), val, width);
+}
+
+// 区间必须位于同一页中  转换失败时只返回 NULL 由调用者退回到逐个访问 在那里报告异常
+uint8_t* riscv_vmem_ptr(riscv_t* riscv, riscv_word_t vaddr, riscv_word_t size, riscv_word_t attr) {
+    if ((vaddr & RISCV_PAGE_MASK) + size > RISCV_PAGE_SIZE) {
+        return NULL;
+    }
+
+    int write = (attr & RISCV_MEM_ATTR_WRITABLE) != 0;
+    riscv_tlb_entry_t* entry;
+    if (riscv_mmu_translate(riscv, vaddr, write ? RISCV_ACCESS_WRITE : RISCV_ACCESS_READ, &entry)) {
+        return NULL;
+    }
+
+    uint8_t* host = write ? entry->host_write : entry->host_read;
+    return host ? host + (vaddr & RISCV_PAGE_MASK) : NULL;
+}
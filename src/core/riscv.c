@@ -1,454 +1,1724 @@
 #include "instr_implements.h"
+#include "rvc.h"
 #include<stdlib.h>
 #include<assert.h>
 #include<stdio.h>
 #include<string.h>
+#include<fenv.h>
 
-// CSR 寄存器相关
-void riscv_csr_init(riscv_t* riscv) {
+// RISCV 相关
+riscv_t* riscv_hart_add(riscv_machine_t* machine) {
+    if (machine->hart_count >= RISCV_MAX_HARTS) {
+        return NULL;
+    }
 
-}
+    riscv_t* riscv = (riscv_t*)calloc(1, sizeof(riscv_t));    // 因为要求返回指针 所以分配一个空间就可以    32 + 32 + 32*32 / 144
+    assert(riscv != NULL);  // 判断为 True 继续运行
 
-// CSR 寄存器读写
-riscv_word_t riscv_read_csr(riscv_t* riscv, riscv_word_t addr) {
-    return riscv->riscv_csr_regs.mscratch;
-}
+    // 预译码缓存 calloc 保证所有缓存项初始无效
+    riscv->block_cache = (riscv_block_t*)calloc(RISCV_BLOCK_CACHE_SIZE, sizeof(riscv_block_t));
+    assert(riscv->block_cache != NULL);
 
-void riscv_write_csr(riscv_t* riscv, riscv_word_t addr, riscv_word_t val) {
-    riscv->riscv_csr_regs.mscratch = val;
+    riscv->rvv = rvv_kernels();
+    riscv->cpi = 1;
+    riscv->timer_instret = UINT64_MAX;
+
+    // 复位时 CSR 清零但保留 mhartid
+    riscv->machine = machine;
+    riscv->riscv_csr_regs.mhartid = machine->hart_count;
+    machine->harts[machine->hart_count++] = riscv;
+    return riscv;
 }
 
-// RISCV 相关
 riscv_t* riscv_create(void) {
-    riscv_t* riscv = (riscv_t*)calloc(1, sizeof(riscv_t));    // 因为要求返回指针 所以分配一个空间就可以    32 + 32 + 32*32 / 144
-    assert(riscv != NULL);  // 判断为 True 继续运行
+    riscv_machine_t* machine = (riscv_machine_t*)calloc(1, sizeof(riscv_machine_t));
+    assert(machine != NULL);
+    return riscv_hart_add(machine);
+}
+
+riscv_t* riscv_clone(riscv_t* layout) {
+    riscv_machine_t* machine = layout->machine;
+    riscv_t* riscv = riscv_create();
+
+    // 只复制存储器 寄存器类外设有自己的状态和线程 不能复制
+    for (int i = 0; i < machine->device_count; i++) {
+        riscv_device_t* dev = machine->device_map[i];
+        if (dev->type != RISCV_DEVICE_MEM) {
+            continue;
+        }
+
+        mem_t* mem = mem_create(dev->name, dev->attr, dev->addr_start, dev->addr_end - dev->addr_start);
+        assert(mem != NULL);
+        riscv_device_add(riscv, &mem->riscv_dev);
+        if (dev == &machine->flash->riscv_dev) {
+            riscv_flash_set(riscv, mem);
+        }
+    }
+    riscv_set_cpi(riscv, layout->cpi);
     return riscv;
 }
 
+void riscv_clone_destroy(riscv_t* riscv) {
+    riscv_machine_t* machine = riscv->machine;
+    for (int i = 0; i < machine->device_count; i++) {
+        riscv_device_t* dev = machine->device_map[i];
+        if (dev->type == RISCV_DEVICE_MEM) {
+            mem_destroy((mem_t*)dev);
+        }
+    }
+    riscv_destroy(riscv);
+}
+
+static void riscv_prefetch_stop(riscv_t* riscv);
+
+void riscv_destroy(riscv_t* riscv) {
+    riscv_machine_t* machine = riscv->machine;
+    for (int i = 0; i < machine->hart_count; i++) {
+        riscv_t* hart = machine->harts[i];
+        riscv_prefetch_stop(hart);
+        free(hart->block_cache);
+        free(hart);
+    }
+    free(machine->device_map);
+    free(machine->pool);
+    free(machine);
+}
+
+// 共享存储器的内容发生变化 所有 hart 的预译码结果都作废
+static void riscv_machine_flush(riscv_machine_t* machine) {
+    for (int i = 0; i < machine->hart_count; i++) {
+        riscv_block_flush(machine->harts[i]);
+    }
+}
+
 // 挂载 flash 结构体
 void riscv_flash_set(riscv_t* riscv, mem_t* flash) {
-    riscv->riscv_flash = flash;
+    riscv->machine->flash = flash;
+    riscv_machine_flush(riscv->machine);
+}
+
+void riscv_block_flush(riscv_t* riscv) {
+    for (int i = 0; i < RISCV_BLOCK_CACHE_SIZE; i++) {
+        riscv->block_cache[i].count = 0;
+    }
+    atomic_add_u32(&riscv->block_gen, 1);
+}
+
+void riscv_block_drop(riscv_t* riscv, riscv_word_t pc) {
+    riscv_block_t* block = &riscv->block_cache[(pc >> 1) & (RISCV_BLOCK_CACHE_SIZE - 1)];
+    if (block->start_pc == pc) {
+        block->count = 0;
+    }
 }
 
 // 读取 image.bin 文件
-void riscv_load_bin(riscv_t* riscv, const char* file_name) {
+int riscv_load_image(riscv_t* riscv, const char* file_name) {
     // 相对路径在 launch.json 文件定义的根路径中
     // 注意指定读取方式 以二进制 b 的形式读取
     FILE* file = fopen(file_name, "rb");
-
-    // 判断文件是否存在
     if (file == NULL) {
-        fprintf(stderr, "file %s doesn't exist\n", file_name);
-        exit(-1);
-    }
-
-    // 判断文件是否为空 程序报错退出
-    if (feof(file)) {
-        fprintf(stderr, "file %s is empty\n", file_name);
-        exit(-1);
+        return -1;
     }
 
-    // 确认文件成功打开后写入数据(有缓冲区的方式)
-    char buffer[1024];
-    char* destination = riscv->riscv_flash->mem;    // 以写入的数据大小作为类型
-    
-    size_t size;
-
-    // 之前我这里的 size 赋值少加了括号 然后优先级判定 size = 1 出了 bug
-    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        // 判断大于 0 只是判断仍然有内容没有写入 所以不一定每次都是 1024
-        memcpy(destination, buffer, size);
-        destination += size;
-    }
+    // 直接读到 Flash 的存储空间中  读满之后还有剩余内容说明镜像比 Flash 大
+    mem_t* flash = riscv->machine->flash;
+    size_t capacity = flash->riscv_dev.addr_end - flash->riscv_dev.addr_start;
+    size_t size = fread(flash->mem, 1, capacity, file);
+    int overflow = (size == capacity) && (fgetc(file) != EOF);
+    mem_mark_dirty(flash, 0, (riscv_word_t)size);
 
     // 记得关闭
     fclose(file);
+
+    // Flash 内容已经改变 之前译码的结果全部作废
+    riscv_machine_flush(riscv->machine);
+    return overflow ? -1 : (int)size;
+}
+
+int riscv_load_bin(riscv_t* riscv, const char* file_name) {
+    if (riscv_load_image(riscv, file_name) < 0) {
+        fprintf(stderr, "file %s doesn't exist or doesn't fit in flash\n", file_name);
+        return -1;
+    }
+    return 0;
 }
 
 // 重置芯片状态
 void riscv_reset(riscv_t* riscv) {
     riscv->pc = 0;      // 因为 main.c 中定义的 RISCV_FLASH_START 是从 0 开始
     memset(riscv->regs, 0, sizeof(riscv->regs));
+    memset(riscv->fregs, 0, sizeof(riscv->fregs));
+    riscv->fflags = 0;
+    riscv->frm = FRM_RNE;
+    memset(riscv->vregs, 0, sizeof(riscv->vregs));
+    riscv->vl = 0;
+    riscv->vtype = RVV_VILL;
 
     // 并没有重置 Flash 和 RAM
 
     // 添加了指令结构体之后也重置指令
     riscv->instr.raw = 0;
 
+    // 清除 LR/SC 保留状态
+    riscv->reserve_valid = 0;
+    riscv->cov_prev = 0;
+    riscv->cov_next = RISCV_COV_NO_NEXT;
+
+    // 从 M 模式开始运行 关闭地址转换
+    riscv->priv = RISCV_PRIV_M;
+    riscv_tlb_flush(riscv, 0, 1);
+
     // 重新读写设备缓存
-    riscv->dev_read_buffer = riscv->dev_write_buffer = riscv->device_list;
+    riscv_machine_t* machine = riscv->machine;
+    riscv->dev_read_buffer = riscv->dev_write_buffer = machine->device_count ? machine->device_map[0] : NULL;
+    // 启动 hart 复位时机器的时间从 0 重新开始
+    if (riscv == machine->harts[0]) {
+        machine->time_cycles = 0;
+    }
 
     // 初始化 CSR 寄存器
     riscv_csr_init(riscv);
+
+    // 定时器按虚拟时间设置 复位后 time 从 0 开始 到期位置重新换算
+    riscv_timer_update(riscv);
 }
 
-// 添加不同外部设备
-void riscv_device_add(riscv_t* riscv, riscv_device_t* dev){
-    // 使用头插法完成设备的添加
-    dev->next = riscv->device_list;     // 首先指向头结点
+// 添加不同外部设备 设备属于整个机器 所有 hart 都能访问
+int riscv_device_add(riscv_t* riscv, riscv_device_t* dev){
+    riscv_machine_t* machine = riscv->machine;
+
+    // 找到按起始地址排序后的插入位置
+    int pos = 0;
+    while ((pos < machine->device_count) && (machine->device_map[pos]->addr_start < dev->addr_start)) {
+        pos++;
+    }
+
+    // 只需要和前后两个相邻设备比较 就能判断是否存在重叠
+    riscv_device_t* prev = (pos > 0) ? machine->device_map[pos - 1] : NULL;
+    riscv_device_t* next = (pos < machine->device_count) ? machine->device_map[pos] : NULL;
+    riscv_device_t* conflict = NULL;
+    if (prev && (prev->addr_end > dev->addr_start)) {
+        conflict = prev;
+    }
+    if (next && (next->addr_start < dev->addr_end)) {
+        conflict = next;
+    }
+    if (conflict) {
+        fprintf(stderr, "device %s [%" PRIxWORD ", %" PRIxWORD ") overlaps %s [%" PRIxWORD ", %" PRIxWORD ")\n", dev->name, dev->addr_start, dev->addr_end,
+                conflict->name, conflict->addr_start, conflict->addr_end);
+        return -1;
+    }
+
+    // 重新生成一张新表 注册完成后表的内容不再修改
+    riscv_device_t** new_map = (riscv_device_t**)malloc((machine->device_count + 1) * sizeof(riscv_device_t*));
+    assert(new_map != NULL);
+    memcpy(new_map, machine->device_map, pos * sizeof(riscv_device_t*));
+    new_map[pos] = dev;
+    memcpy(new_map + pos + 1, machine->device_map + pos, (machine->device_count - pos) * sizeof(riscv_device_t*));
 
-    riscv->device_list = dev;           // 重新链接起来
+    free(machine->device_map);
+    machine->device_map = new_map;
+    machine->device_count++;
 
     // 初始化 device_buffer
-    if (riscv->dev_read_buffer == NULL) {
-        riscv->dev_read_buffer = dev;
+    for (int i = 0; i < machine->hart_count; i++) {
+        riscv_t* hart = machine->harts[i];
+        if (hart->dev_read_buffer == NULL) {
+            hart->dev_read_buffer = dev;
+        }
+        if (hart->dev_write_buffer == NULL) {
+            hart->dev_write_buffer = dev;
+        }
     }
-    if (riscv->dev_write_buffer == NULL) {
-        riscv->dev_write_buffer = dev;
+    return 0;
+}
+
+// 跳转/分支/系统指令会改变控制流 作为预译码块的最后一条指令
+// fence.i 会作废预译码缓存 同样结束当前块
+static int riscv_block_end(instr_t instr) {
+    switch (instr.opcode) {
+    case OP_JAL:
+    case OP_JALR:
+    case OP_BEQ:
+    case OP_BREAK:
+    case OP_FENCE:
+        return 1;
+    default:
+        return 0;
     }
 }
 
-// 取值 -> 分析指令 -> 执行指令 流程模拟(核心)
-void riscv_continue(riscv_t* riscv, int forever) {
-    // 取指 riscv->pc; 
+// 取指: 返回 pc 对应的本机指针 以及从 pc 开始可以连续读取的字节数 (到页或者存储器的末尾)
+// 失败时返回 NULL 并给出异常编号  代码可以位于任何普通存储器中 不能位于寄存器类外设中
+static uint8_t* riscv_fetch_ptr(riscv_t* riscv, riscv_word_t ctx, riscv_word_t pc, riscv_word_t* avail, riscv_word_t* cause) {
+    if (ctx) {
+        riscv_tlb_entry_t* entry;
+        int fault = riscv_mmu_translate(riscv, pc, RISCV_ACCESS_EXEC, &entry);
+        if (fault) {
+            *cause = fault;
+            return NULL;
+        }
+        if (entry->host_read == NULL) {
+            *cause = EXCP_INSTR_ACCESS_FAULT;
+            return NULL;
+        }
+        *avail = RISCV_PAGE_SIZE - (pc & RISCV_PAGE_MASK);
+        return entry->host_read + (pc & RISCV_PAGE_MASK);
+    }
 
-    // 预处理: 获取指向 image.bin 空间的指针
-    // Q: 这个地方的强制类型转换是为什么    虽然它们的类型确实不一样    不能直接用 uin8_t* 接收吗
-    riscv_word_t* mem = (riscv_word_t*) riscv->riscv_flash->mem;
-    
+    // 大部分代码位于 Flash 中 先检查它
+    riscv_device_t* dev = &riscv->machine->flash->riscv_dev;
+    if ((pc < dev->addr_start) || (pc >= dev->addr_end)) {
+        dev = device_find(riscv, pc);
+    }
+    uint8_t* ptr = (dev && dev->host_ptr) ? dev->host_ptr(dev, pc, 2, RISCV_MEM_ATTR_READABLE) : NULL;
+    if (ptr == NULL) {
+        *cause = EXCP_INSTR_ACCESS_FAULT;
+        return NULL;
+    }
+    *avail = dev->addr_end - pc;
+    return ptr;
+}
+
+// 从 pc 开始按地址转换上下文 ctx 顺序译码一个块到 block 中  压缩指令在这里展开
+// 开启地址转换时块不会跨页 (只有跨页的 32 位指令会读到下一页)
+// 返回译出的指令数 为 0 时给出取指异常的原因和地址  不会触发异常 也不会修改 block->count 以外的 hart 状态
+static int riscv_block_decode(riscv_t* riscv, riscv_word_t ctx, riscv_block_t* block, riscv_word_t pc, riscv_word_t* cause, riscv_word_t* fault_addr) {
+    uint8_t* mem = NULL;
+    riscv_word_t avail = 0;
+    *cause = EXCP_INSTR_ACCESS_FAULT;
+    *fault_addr = pc;
+
+    int count = 0;
+    while (count < RISCV_BLOCK_MAX_INSTR) {
+        // 压缩指令要求 2 字节对齐
+        if (pc & 1) {
+            break;
+        }
+
+        // 到达页或者存储器的末尾 重新取得指针  块的第一条指令之后不再跨页
+        if (avail < 2) {
+            if ((count > 0) && ctx) {
+                break;
+            }
+            mem = riscv_fetch_ptr(riscv, ctx, pc, &avail, cause);
+            if (mem == NULL) {
+                break;
+            }
+        }
+
+        // 先取低 16 位 根据最低两位判断指令长度
+        uint16_t low = *(uint16_t*)mem;
+        riscv_decoded_t* decoded = &block->instrs[count];
+        decoded->pc = pc;
+
+        if (rvc_is_compressed(low)) {
+            decoded->instr.raw = rvc_expand(low);
+            decoded->size = 2;
+        }
+        else {
+            uint16_t high;
+            if (avail >= 4) {
+                high = *(uint16_t*)(mem + 2);
+            }
+            else {
+                // 指令的高半部分位于下一页/下一个存储器
+                riscv_word_t next_avail;
+                uint8_t* next = riscv_fetch_ptr(riscv, ctx, pc + 2, &next_avail, cause);
+                if (next == NULL) {
+                    *fault_addr = pc + 2;
+                    break;
+                }
+                high = *(uint16_t*)next;
+                avail = 0;
+            }
+            decoded->instr.raw = ((riscv_word_t)high << 16) | low;
+            decoded->size = 4;
+        }
+
+        count++;
+        if (riscv_block_end(decoded->instr)) {
+            break;
+        }
+        pc += decoded->size;
+        if (avail) {
+            mem += decoded->size;
+            avail -= decoded->size;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    riscv_decoded_t* last = &block->instrs[count - 1];
+    block->start_pc = block->instrs[0].pc;
+    block->end_pc = last->pc + last->size;
+    block->ctx = ctx;
+    block->count = count;
+    return count;
+}
+
+/* 预译码线程: 执行线程每次缓存未命中时给出提示 pc  预译码线程从这里沿静态控制流向前译码
+ * 结果放在独立的缓存中 执行线程未命中时先到这里复制  hart 自己的块缓存仍然只由执行线程读写
+ * 每一项用序号保护: 写入期间序号为奇数 读取前后序号相同并且为偶数才有效 执行线程从不等待 */
+
+#define RISCV_PREFETCH_DEPTH    64          // 每次提示之后最多向前译码的块数
+#define RISCV_PREFETCH_SPIN     4096        // 没有提示时先空转检查这么多次 再休眠
+
+typedef struct _riscv_prefetch_slot_t {
+    volatile uint32_t seq;
+    uint32_t gen;                           // 译码时的 block_gen  与当前值不同说明已经过期
+    riscv_block_t block;
+}riscv_prefetch_slot_t;
+
+typedef struct _riscv_prefetch_t {
+    riscv_t* riscv;
+    volatile uint64_t hint;                 // pc + 1  为 0 表示没有新的提示
+    volatile uint32_t stop;
+    volatile uint32_t done;
+    riscv_prefetch_slot_t slots[RISCV_BLOCK_CACHE_SIZE];
+}riscv_prefetch_t;
+
+static riscv_prefetch_slot_t* riscv_prefetch_slot(riscv_prefetch_t* prefetch, riscv_word_t pc) {
+    return &prefetch->slots[(pc >> 1) & (RISCV_BLOCK_CACHE_SIZE - 1)];
+}
+
+// 执行线程调用: 把预译码好的块复制到 block  不存在 过期或者正在写入时返回 0
+static int riscv_prefetch_take(riscv_prefetch_t* prefetch, riscv_word_t pc, riscv_block_t* block) {
+    riscv_prefetch_slot_t* slot = riscv_prefetch_slot(prefetch, pc);
+    uint32_t seq = atomic_load_u32(&slot->seq);
+    if ((seq & 1) || (slot->gen != atomic_load_u32(&prefetch->riscv->block_gen)) || (slot->block.start_pc != pc)) {
+        return 0;
+    }
+
+    // 读到的可能是写了一半的内容 先限制长度 最后用序号确认
+    int count = slot->block.count;
+    if ((count <= 0) || (count > RISCV_BLOCK_MAX_INSTR)) {
+        return 0;
+    }
+    memcpy(block->instrs, slot->block.instrs, count * sizeof(riscv_decoded_t));
+    block->end_pc = slot->block.end_pc;
+    atomic_fence();
+    if (atomic_load_u32(&slot->seq) != seq) {
+        return 0;
+    }
+
+    block->start_pc = pc;
+    block->ctx = 0;
+    block->count = count;
+    return 1;
+}
+
+static void riscv_prefetch_publish(riscv_prefetch_slot_t* slot, uint32_t gen, riscv_block_t* block) {
+    uint32_t seq = slot->seq;
+    atomic_store_u32(&slot->seq, seq + 1);
+    atomic_fence();
+    slot->gen = gen;
+    memcpy(&slot->block, block, sizeof(riscv_block_t));
+    atomic_store_u32(&slot->seq, seq + 2);
+}
+
+// 从 pc 出发按广度优先向前译码  条件分支两个方向都跟随 jalr 的目标静态未知 到此为止
+static void riscv_prefetch_walk(riscv_prefetch_t* prefetch, riscv_word_t pc) {
+    riscv_t* riscv = prefetch->riscv;
+    uint32_t gen = atomic_load_u32(&riscv->block_gen);
+    riscv_word_t queue[RISCV_PREFETCH_DEPTH];
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = pc;
+
+    // 有新的提示时放弃当前的遍历
+    while ((head < tail) && !prefetch->hint && !prefetch->stop) {
+        pc = queue[head++];
+
+        // 只有预译码线程写入 自己读取不需要检查序号
+        riscv_prefetch_slot_t* slot = riscv_prefetch_slot(prefetch, pc);
+        riscv_block_t* block = &slot->block;
+        if (!block->count || (slot->gen != gen) || (block->start_pc != pc)) {
+            riscv_block_t decoded;
+            riscv_word_t cause, fault_addr;
+            if (riscv_block_decode(riscv, 0, &decoded, pc, &cause, &fault_addr) == 0) {
+                continue;
+            }
+            riscv_prefetch_publish(slot, gen, &decoded);
+        }
+
+        riscv_decoded_t* last = &block->instrs[block->count - 1];
+        riscv_word_t next[2];
+        int next_count = 0;
+        switch (last->instr.opcode) {
+        case OP_JAL:
+            next[next_count++] = last->pc + j_get_imm(last->instr);
+            break;
+        case OP_BEQ:
+            next[next_count++] = block->end_pc;
+            next[next_count++] = last->pc + b_get_imm(last->instr);
+            break;
+        case OP_JALR:
+            break;
+        default:
+            // 块已满 或者是 fence/系统指令 都继续向后
+            next[next_count++] = block->end_pc;
+            break;
+        }
+
+        for (int i = 0; (i < next_count) && (tail < RISCV_PREFETCH_DEPTH); i++) {
+            queue[tail++] = next[i];
+        }
+    }
+}
+
+static void riscv_prefetch_entry(void* param) {
+    riscv_prefetch_t* prefetch = (riscv_prefetch_t*)param;
+    int idle = 0;
+    while (!prefetch->stop) {
+        uint64_t hint = atomic_xchg_u64(&prefetch->hint, 0);
+        if (hint) {
+            riscv_prefetch_walk(prefetch, (riscv_word_t)(hint - 1));
+            idle = 0;
+        }
+        else if (++idle >= RISCV_PREFETCH_SPIN) {
+            thread_msleep(1);
+            idle = 0;
+        }
+    }
+    atomic_store_u32(&prefetch->done, 1);
+}
+
+int riscv_prefetch_start(riscv_t* riscv) {
+    riscv_prefetch_t* prefetch = (riscv_prefetch_t*)calloc(1, sizeof(riscv_prefetch_t));
+    if (prefetch == NULL) {
+        return -1;
+    }
+    prefetch->riscv = riscv;
+    riscv->prefetch = prefetch;
+    thread_create(riscv_prefetch_entry, prefetch);
+    return 0;
+}
+
+// 等待预译码线程退出后再释放
+static void riscv_prefetch_stop(riscv_t* riscv) {
+    riscv_prefetch_t* prefetch = riscv->prefetch;
+    if (prefetch == NULL) {
+        return;
+    }
+    atomic_store_u32(&prefetch->stop, 1);
+    while (!atomic_load_u32(&prefetch->done)) {
+        thread_msleep(1);
+    }
+    free(prefetch);
+    riscv->prefetch = NULL;
+}
+
+// 取指: 从预译码缓存中取出以 pc 开始的块  失败时触发取指异常并返回 NULL
+static riscv_block_t* riscv_block_fetch(riscv_t* riscv, riscv_word_t pc) {
+    riscv_block_t* block = &riscv->block_cache[(pc >> 1) & (RISCV_BLOCK_CACHE_SIZE - 1)];
+    if (block->count && (block->start_pc == pc) && (block->ctx == riscv->fetch_ctx)) {
+        return block;
+    }
+
+    // 缓存项被替换 译码完成之前保持无效
+    block->count = 0;
+
+    // 未命中说明进入了新的代码 通知预译码线程从这里继续向前
+    riscv_prefetch_t* prefetch = riscv->prefetch;
+    if (prefetch && (riscv->fetch_ctx == 0)) {
+        atomic_xchg_u64(&prefetch->hint, (uint64_t)pc + 1);
+        if (riscv_prefetch_take(prefetch, pc, block)) {
+            return block;
+        }
+    }
+
+    riscv_word_t cause, fault_addr;
+    if (riscv_block_decode(riscv, riscv->fetch_ctx, block, pc, &cause, &fault_addr) == 0) {
+        riscv_raise_exception(riscv, cause, fault_addr);
+        return NULL;
+    }
+    return block;
+}
+
+// 中途离开块时 把 pc 之前已经执行的指令计入退休数
+static void riscv_retire_block(riscv_t* riscv) {
+    riscv->instret = riscv_get_instret(riscv);
+    riscv->exec_block = NULL;
+}
+
+// 按 mtvec/stvec 计算 trap 入口  向量模式下只有中断按编号偏移 同步异常总是进入基地址
+static riscv_word_t riscv_trap_vector(riscv_word_t tvec, riscv_word_t cause) {
+    riscv_word_t base = tvec & ~0x3;
+    if ((tvec & 0x1) && (cause & MCAUSE_INTERRUPT)) {
+        base += (cause & ~MCAUSE_INTERRUPT) * 4;
+    }
+    return base;
+}
+
+// 进入 trap: 保存现场 关中断 跳转到异常处理程序   pc 指向出错的指令 该指令不计入退休数
+// 在 S/U 模式下发生并且被 medeleg/mideleg 委托的 trap 交给 S 模式 其余都进入 M 模式
+// 没有安装 M 模式异常处理程序 (mtvec 为 0) 时返回 -1 由调用者退回宿主 与裸机测试程序原来的行为一致
+static int riscv_trap_enter(riscv_t* riscv, riscv_word_t cause, riscv_word_t tval) {
+    riscv_retire_block(riscv);
+    riscv->trap_pending = 0;
+
+    riscv_csr_t* csr = &riscv->riscv_csr_regs;
+    riscv_word_t deleg = (cause & MCAUSE_INTERRUPT) ? csr->mideleg : csr->medeleg;
+    riscv_word_t mstatus = csr->mstatus;
+
+    if ((riscv->priv <= RISCV_PRIV_S) && ((deleg >> (cause & ~MCAUSE_INTERRUPT)) & 1)) {
+        csr->sepc = riscv->pc;
+        csr->scause = cause;
+        csr->stval = tval;
+        mstatus &= ~(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP);
+        mstatus |= ((csr->mstatus & MSTATUS_SIE) ? MSTATUS_SPIE : 0) | ((riscv->priv == RISCV_PRIV_S) ? MSTATUS_SPP : 0);
+        csr->mstatus = mstatus;
+
+        riscv->priv = RISCV_PRIV_S;
+        riscv->pc = riscv_trap_vector(csr->stvec, cause);
+    }
+    else {
+        if (csr->mtvec == 0) {
+            return -1;
+        }
+
+        csr->mepc = riscv->pc;
+        csr->mcause = cause;
+        csr->mtval = tval;
+        mstatus &= ~(MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP);
+        mstatus |= ((csr->mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0) | ((riscv_word_t)riscv->priv << MSTATUS_MPP_SHIFT);
+        csr->mstatus = mstatus;
+
+        riscv->priv = RISCV_PRIV_M;
+        riscv->pc = riscv_trap_vector(csr->mtvec, cause);
+    }
+
+    riscv_mmu_update(riscv);
+    return 0;
+}
+
+// 从挂起并且使能的中断中按优先级选出一个: 外部 > 软件 > 定时器  M 级先于 S 级
+static int riscv_irq_select(riscv_word_t pending) {
+    static const int order[] = { IRQ_M_EXT, IRQ_M_SOFT, IRQ_M_TIMER, IRQ_S_EXT, IRQ_S_SOFT, IRQ_S_TIMER };
+    for (int i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++) {
+        if (pending & (1u << order[i])) {
+            return order[i];
+        }
+    }
+    return -1;
+}
+
+int riscv_work_register(riscv_t* riscv, riscv_device_t* dev, void (*fn)(riscv_device_t* dev)) {
+    if (riscv->work_count >= RISCV_WORK_MAX) {
+        return -1;
+    }
+    riscv->work_dev[riscv->work_count] = dev;
+    riscv->work_fn[riscv->work_count] = fn;
+    return riscv->work_count++;
+}
+
+static void riscv_pool_wake(riscv_t* riscv);
+
+void riscv_work_post(riscv_t* riscv, int work) {
+    // 确定性调度: 到达时间取决于设备线程 先锁存 由调度循环在轮转边界送达
+    if (riscv->machine->quantum) {
+        atomic_or_u32(&riscv->work_latched, 1u << work);
+        return;
+    }
+
+    atomic_or_u32(&riscv->work_pending, 1u << work);
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+
+    // 挂起在 wfi 中的 hart 也要先处理工作 处理结果可能是一个中断  wfi 允许被提前唤醒
+    if (riscv->machine->pool) {
+        riscv_pool_wake(riscv);
+    }
+}
+
+void riscv_timer_set(riscv_t* riscv, riscv_device_t* dev, void (*fn)(riscv_device_t* dev), uint64_t time) {
+    riscv->timer_dev = dev;
+    riscv->timer_fn = fn;
+    riscv->timer_time = time;
+    riscv_timer_update(riscv);
+}
+
+void riscv_timer_update(riscv_t* riscv) {
+    if (riscv->timer_fn == NULL) {
+        riscv->timer_instret = UINT64_MAX;
+        return;
+    }
+
+    // 与 csr_time_cycles 相同 本 hart 的周期数包括修改 CPI 时记录的差值
+    uint64_t instret = riscv_get_instret(riscv);
+    uint64_t now = instret * riscv->cpi + riscv->riscv_csr_regs.time_offset;
+    uint64_t target = riscv->timer_time * RISCV_CYCLES_PER_TICK;
+    riscv->timer_instret = (target > now) ? instret + (target - now + riscv->cpi - 1) / riscv->cpi : instret;
+}
+
+// 定时器到期: 先取消再回调
+static void riscv_timer_fire(riscv_t* riscv) {
+    void (*fn)(riscv_device_t* dev) = riscv->timer_fn;
+    riscv->timer_fn = NULL;
+    riscv->timer_instret = UINT64_MAX;
+    fn(riscv->timer_dev);
+}
+
+// 一次取走所有已投递的工作  回调中可以再次投递 留到下一个块边界处理
+static void riscv_work_run(riscv_t* riscv) {
+    uint32_t pending = atomic_xchg_u32(&riscv->work_pending, 0);
+    while (pending) {
+        int work = (int)bit_ctz(pending);
+        pending &= pending - 1;
+        riscv->work_fn[work](riscv->work_dev[work]);
+    }
+}
+
+// 块边界检查中断 只有 irq_pending 置位时才会进来
+static void riscv_irq_check(riscv_t* riscv) {
+    // 先清除标志再读取 mip  设备在两者之间置位也不会丢失
+    atomic_xchg_u32(&riscv->irq_pending, 0);
+
+    // 设备工作先于中断处理 它们可能会改变中断线
+    if (riscv->work_pending) {
+        riscv_work_run(riscv);
+    }
+
+    riscv_csr_t* csr = &riscv->riscv_csr_regs;
+    riscv_word_t pending = atomic_load_u32(&csr->mip) & csr->mie;
+    if (pending == 0) {
+        return;
+    }
+
+    // 没有委托的中断在低于 M 的特权级总是响应 在 M 模式由 MIE 决定
+    // 委托给 S 的中断在 U 模式总是响应 在 S 模式由 SIE 决定 在 M 模式不响应
+    riscv_word_t enabled = 0;
+    if ((riscv->priv < RISCV_PRIV_M) || (csr->mstatus & MSTATUS_MIE)) {
+        enabled |= pending & ~csr->mideleg;
+    }
+    if ((riscv->priv < RISCV_PRIV_S) || ((riscv->priv == RISCV_PRIV_S) && (csr->mstatus & MSTATUS_SIE))) {
+        enabled |= pending & csr->mideleg;
+    }
+
+    int irq = riscv_irq_select(enabled);
+    if (irq >= 0) {
+        riscv_trap_enter(riscv, MCAUSE_INTERRUPT | irq, 0);
+    }
+}
+
+void riscv_mip_update(riscv_t* riscv, riscv_word_t mask, int level) {
+    if (level) {
+        atomic_or_u32(&riscv->riscv_csr_regs.mip, mask);
+    }
+    else {
+        atomic_and_u32(&riscv->riscv_csr_regs.mip, ~mask);
+    }
+    atomic_xchg_u32(&riscv->irq_pending, 1);
+
+    // 挂起的 hart 不会再执行到块边界 需要在这里放回就绪队列   挂起期间 mie 不会变化
+    if (level && (mask & riscv->riscv_csr_regs.mie) && riscv->machine->pool) {
+        riscv_pool_wake(riscv);
+    }
+}
+
+void riscv_irq_set(riscv_t* riscv, int line, int level) {
+    uint32_t bit = 1u << line;
+    uint32_t lines = level ? (atomic_or_u32(&riscv->irq_lines, bit) | bit) : (atomic_and_u32(&riscv->irq_lines, ~bit) & ~bit);
+    riscv_mip_update(riscv, MIP_MEIP, lines != 0);
+}
+
+// 边覆盖: 上一个块以 jal/jalr/分支结束 或者进入/返回 trap 改变了 pc 时 进入当前块经过了一条边  散列方式与 AFL 的 QEMU 模式相同
+// 块因为长度上限 CSR 或 fence 被截断后顺序执行到下一个块 仍然是同一个基本块 不记录
+static inline void riscv_cov_edge(riscv_t* riscv, riscv_block_t* block) {
+    if (block->start_pc != riscv->cov_next) {
+        riscv_word_t pc = block->start_pc;
+        riscv_word_t cur = ((pc >> 4) ^ (pc << 8)) & (RISCV_COV_MAP_SIZE - 1);
+        riscv->machine->cov_map[cur ^ riscv->cov_prev]++;
+        riscv->cov_prev = cur >> 1;
+    }
+
+    uint32_t opcode = block->instrs[block->count - 1].instr.opcode;
+    int transfer = (opcode == OP_JAL) || (opcode == OP_JALR) || (opcode == OP_BEQ);     // 所有分支的 opcode 相同
+    riscv->cov_next = transfer ? RISCV_COV_NO_NEXT : block->end_pc;
+}
+
+// 取值 -> 分析指令 -> 执行指令 流程模拟(核心)
+// 最多执行 budget 条指令 (进入 trap 的指令也计入) 用完返回 0  ebreak 或无法继续执行时返回 -1  wfi 请求挂起时返回 1
+// coverage 只以常量传入: 强制内联后得到记录覆盖和不记录覆盖的两个版本 不记录时执行路径上没有额外的判断
+static FORCE_INLINE int riscv_execute_loop(riscv_t* riscv, uint64_t budget, const int coverage) {
     // 对执行的指令进行判断
-    do
+    while (budget)
     {
-        // 判断指令的地址合法性
-        if (riscv->pc < riscv->riscv_flash->riscv_dev.addr_start || riscv->pc > riscv->riscv_flash->riscv_dev.addr_end) {
-            fprintf(stderr, "Illegal Instruction Address\n");
-            return;
+        // 中断只在块边界检查 没有挂起的中断时只多一次读取  机器停止也借用这个标志通知
+        if (riscv->irq_pending) {
+            if (riscv->machine->halt) {
+                return -1;
+            }
+            if (riscv->wfi) {
+                riscv->wfi = 0;
+                return 1;
+            }
+            riscv_irq_check(riscv);
         }
 
-        // 根据 pc 得到指令的具体内容   单个指令的单位长度为 4B    这里通过下标访问
-        riscv_word_t instruc = mem[(riscv->pc - riscv->riscv_flash->riscv_dev.addr_start) >> 2];
-        
-        // 也可以直接访问 pc
-        // riscv_word_t instruc = (riscv_word_t *) riscv->pc;   直接访问肯定不行 因为访问的是 0x0000 是本机的地址 一定会被 OS 阻止 所以一定要加上 mem 的首地址
-        // riscv_word_t instruc = (riscv_word_t *)(riscv->pc + mem);
+        // 没有设置定时器时 timer_instret 为最大值 只多一次比较
+        if (riscv->instret >= riscv->timer_instret) {
+            riscv_timer_fire(riscv);
+        }
+
+        // 取指: 从预译码缓存中取出以 pc 开始的块
+        riscv_block_t* block = riscv_block_fetch(riscv, riscv->pc);
+        if (block == NULL) {
+            // 异常处理程序本身无法取指时直接退出 避免反复进入 trap
+            riscv_word_t fault_pc = riscv->pc;
+            if ((riscv_trap_enter(riscv, riscv->trap_cause, riscv->trap_tval) < 0) || (riscv->pc == fault_pc)) {
+                fprintf(stderr, "Illegal Instruction Address\n");
+                return -1;
+            }
+            budget--;
+            continue;
+        }
+        if (coverage) {
+            riscv_cov_edge(riscv, block);
+        }
+
+        // 块内除最后一条外都不会改变控制流 可以顺序执行   剩余配额不足一个块时只执行前面一部分
+        // 执行期间只记录当前块 退休指令数在块结束时一次累加
+        riscv->exec_block = block;
+        riscv_decoded_t* curr = block->instrs;
+        riscv_decoded_t* end = (block->count < budget) ? curr + block->count : curr + budget;
+        uint64_t used = end - curr;
 
-        // 把指令放到 IR 中
-        riscv->instr.raw = instruc;
+        for (; curr < end; curr++) {
+            // 把指令放到 IR 中
+            riscv->instr = curr->instr;
+            riscv->instr_size = curr->size;
 
-        switch (riscv->instr.opcode)
-        {
-        case OP_BREAK: {
-            switch (riscv->instr.i.funct3)
+            switch (riscv->instr.opcode)
             {
-            case FUNC3_EBREAK:
-                fprintf(stdout, "found ebreak!\n");
-                return;
-            case FUNC3_CSRRW:
-                handle_csrrw(riscv);
-                break;
-            case FUNC3_CSRRS:
-                handle_csrrs(riscv);
-                break;
-            case FUNC3_CSRRC:
-                handle_csrrc(riscv);
+            case OP_BREAK: {
+                if (riscv->instr.i.funct3 == FUNC3_EBREAK) {
+                    switch (riscv->instr.i.imm11_0)
+                    {
+                    case IMM_EBREAK:
+                        // ebreak 仍然交还给宿主 (测试程序和调试器用它停止运行)
+                        if (!riscv->machine->quiet) {
+                            fprintf(stdout, "found ebreak!\n");
+                        }
+                        riscv_retire_block(riscv);
+                        return -1;
+                    case IMM_ECALL:
+                        handle_ecall(riscv);
+                        break;
+                    case IMM_MRET:
+                        handle_mret(riscv);
+                        break;
+                    case IMM_SRET:
+                        handle_sret(riscv);
+                        break;
+                    case IMM_WFI:
+                        handle_wfi(riscv);
+                        break;
+                    default:
+                        if ((riscv->instr.i.imm11_0 >> 5) == FUNC7_SFENCE_VMA) {
+                            handle_sfence_vma(riscv);
+                            break;
+                        }
+                        goto cond_end;
+                    }
+                    break;
+                }
+
+                // csrrw/csrrwi 总是写入  csrrs/csrrc 及立即数形式在 rs1/uimm 为 0 时只读
+                int write = ((riscv->instr.i.funct3 & 0x3) == 0x1) || riscv->instr.i.rs1;
+                if (riscv_csr_check(riscv, riscv->instr.i.imm11_0, write) < 0) {
+                    goto cond_end;
+                }
+
+                switch (riscv->instr.i.funct3)
+                {
+                case FUNC3_CSRRW:
+                    handle_csrrw(riscv);
+                    break;
+                case FUNC3_CSRRS:
+                    handle_csrrs(riscv);
+                    break;
+                case FUNC3_CSRRC:
+                    handle_csrrc(riscv);
+                    break;
+                case FUNC3_CSRRWI:
+                    handle_csrrwi(riscv);
+                    break;
+                case FUNC3_CSRRSI:
+                    handle_csrrsi(riscv);
+                    break;
+                case FUNC3_CSRRCI:
+                    handle_csrrci(riscv);
+                    break;
+                default:
+                    goto cond_end;
+                }
                 break;
-            case FUNC3_CSRRWI:
-                handle_csrrwi(riscv);
+            }
+
+            case OP_ADDI: {
+                switch (riscv->instr.i.funct3){
+                    case FUNC3_ADDI: {
+                        handle_addi(riscv);
+                        break;
+                    }
+                    case FUNC3_SLTI: {
+                        handle_slti(riscv);
+                        break;
+                    }
+                    case FUNC3_SLTIU: {
+                        handle_sltiu(riscv);
+                        break;
+                    }
+                    case FUNC3_XORI: {
+                        handle_xori(riscv);
+                        break;
+                    }
+                    case FUNC3_ORI: {
+                        handle_ori(riscv);
+                        break;
+                    }
+                    case FUNC3_ANDI: {
+                        handle_andi(riscv);
+                        break;
+                    }
+                    // funct3 = 001/101 还需要检查 imm[11:5] 区分移位和 Zbb 指令
+                    case FUNC3_SLLI: {
+                        switch (i_get_shift_funct7(riscv->instr))
+                        {
+                        case FUNC7_ADD:
+                            handle_slli(riscv);
+                            break;
+                        case FUNC7_ROTATE:
+                            if ((riscv->instr.i.imm11_0 & 0x1F) > UNARY_SEXT_H || (riscv->instr.i.imm11_0 & 0x1F) == 0b00011) {
+                                goto cond_end;
+                            }
+                            handle_bit_unary(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+
+                    // 注意手册上 SRLI 和 SRAI 是两个指令 但是它们的 funct3 是相同的 所以用一条指令 SR 表示
+                    case FUNC3_SR: {
+                        switch (i_get_shift_funct7(riscv->instr))
+                        {
+                        case FUNC7_ADD:
+                        case FUNC7_SRA:
+                            handle_srai_srli(riscv);
+                            break;
+                        case FUNC7_ROTATE:
+                            handle_rori(riscv);
+                            break;
+                        default:
+                            if (riscv->instr.i.imm11_0 == IMM_ORC_B) {
+                                handle_orc_b(riscv);
+                            }
+                            else if (riscv->instr.i.imm11_0 == IMM_REV8) {
+                                handle_rev8(riscv);
+                            }
+                            else {
+                                goto cond_end;
+                            }
+                            break;
+                        }
+                        break;
+                    }
+
+                    default:
+                        goto cond_end;
+                }
                 break;
-            case FUNC3_CSRRSI:
-                handle_csrrsi(riscv);
+            }
+
+            case OP_ADD: {
+                switch (riscv->instr.r.funct3)
+                {
+                    case FUNC3_ADD: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_ADD:
+                            handle_add(riscv);
+                            break;
+                        case FUNC7_SUB:
+                            handle_sub(riscv);
+                            break;
+                        case FUNC7_MUL:
+                            handle_mul(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+                
+                    case FUNC3_SLL: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_MUL:
+                            handle_mulh(riscv);
+                            break;
+                        case FUNC7_ADD:
+                            handle_sll(riscv);
+                            break;
+                        case FUNC7_ROTATE:
+                            handle_rol(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+                    
+                    case FUNC3_SLT: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_MUL:
+                            handle_mulhsu(riscv);
+                            break;
+                        case FUNC7_ADD:
+                            handle_slt(riscv);
+                            break;
+                        case FUNC7_SHADD:
+                            handle_shxadd(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+                    
+                    case FUNC3_SLTU: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_ADD:
+                            handle_sltu(riscv);
+                            break;
+                        case FUNC7_MUL:
+                            handle_mulhu(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+                
+                    case FUNC3_XOR: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_DIV:
+                            handle_div(riscv);
+                            break;
+                        case FUNC7_ADD:
+                            handle_xor(riscv);
+                            break;
+                        case FUNC7_NEGATE:
+                            handle_logic_neg(riscv);
+                            break;
+                        case FUNC7_MINMAX:
+                            handle_minmax(riscv);
+                            break;
+                        case FUNC7_SHADD:
+                            handle_shxadd(riscv);
+                            break;
+#if RISCV_XLEN == 32
+                        // RV64 的 zext.h 编码在 OP-32 中
+                        case FUNC7_ZEXT_H:
+                            if (riscv->instr.r.rs2 != 0) {
+                                goto cond_end;
+                            }
+                            handle_zext_h(riscv);
+                            break;
+#endif
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+
+                    case FUNC3_SR: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_DIV:
+                            handle_divu(riscv);
+                            break;
+                        case FUNC7_ADD:
+                            handle_srl(riscv);
+                            break;
+                        case FUNC7_SRA:
+                            handle_sra(riscv);
+                            break;
+                        case FUNC7_MINMAX:
+                            handle_minmax(riscv);
+                            break;
+                        case FUNC7_ROTATE:
+                            handle_ror(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+
+                    case FUNC3_OR: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_ADD:
+                            handle_or(riscv);
+                            break;
+                        case FUNC7_DIV:
+                            handle_rem(riscv);
+                            break;
+                        case FUNC7_NEGATE:
+                            handle_logic_neg(riscv);
+                            break;
+                        case FUNC7_MINMAX:
+                            handle_minmax(riscv);
+                            break;
+                        case FUNC7_SHADD:
+                            handle_shxadd(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+
+                    case FUNC3_AND: {
+                        switch (riscv->instr.r.funct7)
+                        {
+                        case FUNC7_ADD:
+                            handle_and(riscv);
+                            break;
+                        case FUNC7_DIV:
+                            handle_remu(riscv);
+                            break;
+                        case FUNC7_NEGATE:
+                            handle_logic_neg(riscv);
+                            break;
+                        case FUNC7_MINMAX:
+                            handle_minmax(riscv);
+                            break;
+                        default:
+                            goto cond_end;
+                        }
+                        break;
+                    }
+
+                    default:
+                        goto cond_end;
+                    }
                 break;
-            case FUNC3_CSRRCI:
-                handle_csrrci(riscv);
+            }
+        
+            case OP_LUI: {
+                handle_lui(riscv);
                 break;
-            default:
-                goto cond_end;
             }
-            break;
-        }
 
-        case OP_ADDI: {
-            switch (riscv->instr.i.funct3){
-                case FUNC3_ADDI: {
-                    handle_addi(riscv);
+            case OP_SB: {
+                switch (riscv->instr.s.funct3)
+                {
+                case FUNC3_SB:
+                    handle_sb(riscv);
                     break;
-                }
-                case FUNC3_SLTI: {
-                    handle_slti(riscv);
+                case FUNC3_SH:
+                    handle_sh(riscv);
                     break;
-                }
-                case FUNC3_SLTIU: {
-                    handle_sltiu(riscv);
+                case FUNC3_SW:
+                    handle_sw(riscv);
                     break;
-                }
-                case FUNC3_XORI: {
-                    handle_xori(riscv);
+#if RISCV_XLEN == 64
+                case FUNC3_SD:
+                    handle_sd(riscv);
                     break;
+#endif
+                default:
+                    goto cond_end;
                 }
-                case FUNC3_ORI: {
-                    handle_ori(riscv);
+                break;
+            }
+
+            case OP_LB: {
+                switch (riscv->instr.i.funct3)
+                {
+                case FUNC3_LB:
+                    handle_lb(riscv);
+                    break;
+                case FUNC3_LH:
+                    handle_lh(riscv);
+                    break;
+                case FUNC3_LW:
+                    handle_lw(riscv);
+                    break;
+                case FUNC3_LBU:
+                    handle_lbu(riscv);
+                    break;
+                case FUNC3_LHU:
+                    handle_lhu(riscv);
+                    break;
+#if RISCV_XLEN == 64
+                case FUNC3_LWU:
+                    handle_lwu(riscv);
+                    break;
+                case FUNC3_LD:
+                    handle_ld(riscv);
                     break;
+#endif
+                default:
+                    goto cond_end;
                 }
-                case FUNC3_ANDI: {
-                    handle_andi(riscv);
+                break;
+            }
+
+#if RISCV_XLEN == 64
+            // RV64 的 32 位运算 结果符号扩展到 64 位
+            case OP_IMM_32: {
+                switch (riscv->instr.i.funct3)
+                {
+                case FUNC3_ADDI:
+                    handle_addiw(riscv);
                     break;
+                case FUNC3_SLLI:
+                    if ((riscv->instr.i.imm11_0 >> 5) == FUNC7_ADD) {
+                        handle_shiftiw(riscv);
+                    }
+                    else if (i_get_shift_funct7(riscv->instr) == FUNC7_SLLI_UW) {
+                        handle_slli_uw(riscv);
+                    }
+                    else if ((riscv->instr.i.imm11_0 >> 5) == FUNC7_ROTATE && (riscv->instr.i.imm11_0 & 0x1F) <= UNARY_CPOP) {
+                        handle_bit_unary_w(riscv);
+                    }
+                    else {
+                        goto cond_end;
+                    }
+                    break;
+                case FUNC3_SR:
+                    switch (riscv->instr.i.imm11_0 >> 5)
+                    {
+                    case FUNC7_ADD:
+                    case FUNC7_SRA:
+                        handle_shiftiw(riscv);
+                        break;
+                    case FUNC7_ROTATE:
+                        handle_roriw(riscv);
+                        break;
+                    default:
+                        goto cond_end;
+                    }
+                    break;
+                default:
+                    goto cond_end;
                 }
-                case FUNC3_SLLI: {
-                    handle_slli(riscv);
+                break;
+            }
+
+            case OP_32: {
+                switch (riscv->instr.r.funct7)
+                {
+                case FUNC7_ADD:
+                    if (riscv->instr.r.funct3 != FUNC3_ADD && riscv->instr.r.funct3 != FUNC3_SLL && riscv->instr.r.funct3 != FUNC3_SR) {
+                        goto cond_end;
+                    }
+                    handle_opw(riscv);
                     break;
+                case FUNC7_SUB:
+                    if (riscv->instr.r.funct3 != FUNC3_ADD && riscv->instr.r.funct3 != FUNC3_SR) {
+                        goto cond_end;
+                    }
+                    handle_opw(riscv);
+                    break;
+                case FUNC7_MUL:
+                    if (riscv->instr.r.funct3 != FUNC3_MUL && riscv->instr.r.funct3 < FUNC3_DIV) {
+                        goto cond_end;
+                    }
+                    handle_mulw_divw(riscv);
+                    break;
+                case FUNC7_ADD_UW:
+                    if (riscv->instr.r.funct3 == FUNC3_ADD) {
+                        handle_shxadd_uw(riscv);
+                    }
+                    else if (riscv->instr.r.funct3 == FUNC3_XOR && riscv->instr.r.rs2 == 0) {
+                        handle_zext_h(riscv);
+                    }
+                    else {
+                        goto cond_end;
+                    }
+                    break;
+                case FUNC7_SHADD:
+                    if (riscv->instr.r.funct3 != FUNC3_SLT && riscv->instr.r.funct3 != FUNC3_XOR && riscv->instr.r.funct3 != FUNC3_OR) {
+                        goto cond_end;
+                    }
+                    handle_shxadd_uw(riscv);
+                    break;
+                case FUNC7_ROTATE:
+                    if (riscv->instr.r.funct3 == FUNC3_SLL) {
+                        handle_rolw(riscv);
+                    }
+                    else if (riscv->instr.r.funct3 == FUNC3_SR) {
+                        handle_rorw(riscv);
+                    }
+                    else {
+                        goto cond_end;
+                    }
+                    break;
+                default:
+                    goto cond_end;
                 }
+                break;
+            }
+#endif
+        
+            case OP_AUIPC: {
+                handle_auipc(riscv);
+                break;
+            }
+        
+            case OP_JAL: {
+                handle_jal(riscv);
+                break;
+            }
 
-                // 注意手册上 SRLI 和 SRAI 是两个指令 但是它们的 funct3 是相同的 所以用一条指令 SR 表示
-                case FUNC3_SR: {
-                    handle_srai_srli(riscv);
+            // 标量浮点与向量共用 funct3 区分访问宽度
+            case OP_LOAD_FP: {
+                int rc = 0;
+                switch (riscv->instr.i.funct3)
+                {
+                case FUNC3_FLW:
+                    if (!(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                        goto cond_end;
+                    }
+                    handle_flw(riscv);
                     break;
+                case FUNC3_VLE8:
+                    rc = handle_vle(riscv, 1);
+                    break;
+                case FUNC3_VLE16:
+                    rc = handle_vle(riscv, 2);
+                    break;
+                case FUNC3_VLE32:
+                    rc = handle_vle(riscv, 4);
+                    break;
+                default:
+                    goto cond_end;
+                }
+                if (rc < 0) {
+                    goto cond_end;
                 }
+                break;
+            }
 
+            case OP_STORE_FP: {
+                int rc = 0;
+                switch (riscv->instr.s.funct3)
+                {
+                case FUNC3_FSW:
+                    if (!(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                        goto cond_end;
+                    }
+                    handle_fsw(riscv);
+                    break;
+                case FUNC3_VLE8:
+                    rc = handle_vse(riscv, 1);
+                    break;
+                case FUNC3_VLE16:
+                    rc = handle_vse(riscv, 2);
+                    break;
+                case FUNC3_VLE32:
+                    rc = handle_vse(riscv, 4);
+                    break;
                 default:
                     goto cond_end;
+                }
+                if (rc < 0) {
+                    goto cond_end;
+                }
+                break;
             }
-            break;
-        }
 
-        case OP_ADD: {
-            switch (riscv->instr.r.funct3)
-            {
-                case FUNC3_ADD: {
-                    switch (riscv->instr.r.funct7)
+            case OP_V: {
+                int rc = -1;
+                riscv_word_t funct3 = riscv->instr.r.funct3;
+                switch (funct3)
+                {
+                case FUNC3_OPCFG:
+                    // vsetvl 要求 funct7 = 1000000
+                    if (((riscv->instr.raw >> 30) == 0x2) && (riscv->instr.r.funct7 != 0x40)) {
+                        break;
+                    }
+                    handle_vsetvl(riscv);
+                    rc = 0;
+                    break;
+                case FUNC3_OPIVV:
+                case FUNC3_OPIVX:
+                case FUNC3_OPIVI:
+                    switch (v_get_funct6(riscv->instr))
                     {
-                    case FUNC7_ADD:
-                        handle_add(riscv);
+                    case FUNC6_VADD:
+                        rc = handle_vop(riscv, RVV_OP_ADD, 0);
+                        break;
+                    case FUNC6_VSUB:
+                        rc = (funct3 == FUNC3_OPIVI) ? -1 : handle_vop(riscv, RVV_OP_SUB, 0);
+                        break;
+                    case FUNC6_VRSUB:
+                        rc = (funct3 == FUNC3_OPIVV) ? -1 : handle_vop(riscv, RVV_OP_SUB, 1);
+                        break;
+                    case FUNC6_VAND:
+                        rc = handle_vop(riscv, RVV_OP_AND, 0);
                         break;
-                    case FUNC7_SUB:
-                        handle_sub(riscv);
+                    case FUNC6_VOR:
+                        rc = handle_vop(riscv, RVV_OP_OR, 0);
                         break;
-                    case FUNC7_MUL:
-                        handle_mul(riscv);
+                    case FUNC6_VXOR:
+                        rc = handle_vop(riscv, RVV_OP_XOR, 0);
+                        break;
+                    case FUNC6_VMV:
+                        rc = handle_vmv_v(riscv);
                         break;
                     default:
-                        goto cond_end;
+                        break;
                     }
                     break;
-                }
-                
-                case FUNC3_SLL: {
-                    switch (riscv->instr.r.funct7)
+                case FUNC3_OPMVV:
+                    switch (v_get_funct6(riscv->instr))
                     {
-                    case FUNC7_MUL:
-                        handle_mulh(riscv);
+                    case FUNC6_VREDSUM:
+                        rc = handle_vred(riscv, RVV_OP_ADD);
                         break;
-                    case FUNC7_ADD:
-                        handle_sll(riscv);
+                    case FUNC6_VREDAND:
+                        rc = handle_vred(riscv, RVV_OP_AND);
+                        break;
+                    case FUNC6_VREDOR:
+                        rc = handle_vred(riscv, RVV_OP_OR);
+                        break;
+                    case FUNC6_VREDXOR:
+                        rc = handle_vred(riscv, RVV_OP_XOR);
+                        break;
+                    case FUNC6_VMUL:
+                        rc = handle_vop(riscv, RVV_OP_MUL, 0);
+                        break;
+                    case FUNC6_VMV_S:
+                        rc = handle_vmv_x_s(riscv);
+                        break;
+                    default:
+                        break;
+                    }
+                    break;
+                case FUNC3_OPMVX:
+                    switch (v_get_funct6(riscv->instr))
+                    {
+                    case FUNC6_VMUL:
+                        rc = handle_vop(riscv, RVV_OP_MUL, 0);
+                        break;
+                    case FUNC6_VMV_S:
+                        rc = handle_vmv_s_x(riscv);
                         break;
                     default:
+                        break;
+                    }
+                    break;
+                default:
+                    break;
+                }
+                if (rc < 0) {
+                    goto cond_end;
+                }
+                break;
+            }
+
+            // R4-Type 只支持单精度格式  mstatus.FS 为 Off 时所有浮点指令都是非法指令
+            case OP_FMADD: {
+                if (((riscv->instr.r.funct7 & 0x3) != FMT_S) || !(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                    goto cond_end;
+                }
+                handle_fmadd_s(riscv);
+                break;
+            }
+
+            case OP_FMSUB: {
+                if (((riscv->instr.r.funct7 & 0x3) != FMT_S) || !(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                    goto cond_end;
+                }
+                handle_fmsub_s(riscv);
+                break;
+            }
+
+            case OP_FNMSUB: {
+                if (((riscv->instr.r.funct7 & 0x3) != FMT_S) || !(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                    goto cond_end;
+                }
+                handle_fnmsub_s(riscv);
+                break;
+            }
+
+            case OP_FNMADD: {
+                if (((riscv->instr.r.funct7 & 0x3) != FMT_S) || !(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                    goto cond_end;
+                }
+                handle_fnmadd_s(riscv);
+                break;
+            }
+
+            case OP_FP: {
+                if (!(riscv->riscv_csr_regs.mstatus & MSTATUS_FS)) {
+                    goto cond_end;
+                }
+                switch (riscv->instr.r.funct7)
+                {
+                case FUNC7_FADD_S:
+                    handle_fadd_s(riscv);
+                    break;
+                case FUNC7_FSUB_S:
+                    handle_fsub_s(riscv);
+                    break;
+                case FUNC7_FMUL_S:
+                    handle_fmul_s(riscv);
+                    break;
+                case FUNC7_FDIV_S:
+                    handle_fdiv_s(riscv);
+                    break;
+                case FUNC7_FSQRT_S:
+                    if (riscv->instr.r.rs2 != 0) {
                         goto cond_end;
                     }
+                    handle_fsqrt_s(riscv);
                     break;
-                }
-                    
-                case FUNC3_SLT: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_MUL:
-                        handle_mulhsu(riscv);
-                        break;
-                    case FUNC7_ADD:
-                        handle_slt(riscv);
-                        break;
-                    default:
+                case FUNC7_FSGNJ_S:
+                    if (riscv->instr.r.funct3 > FUNC3_FSGNJX) {
                         goto cond_end;
                     }
+                    handle_fsgnj_s(riscv);
                     break;
-                }
-                    
-                case FUNC3_SLTU: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_ADD:
-                        handle_sltu(riscv);
-                        break;
-                    case FUNC7_MUL:
-                        handle_mulhu(riscv);
-                        break;
-                    default:
+                case FUNC7_FMINMAX_S:
+                    if (riscv->instr.r.funct3 > FUNC3_FMAX) {
                         goto cond_end;
                     }
+                    handle_fminmax_s(riscv);
                     break;
-                }
-                
-                case FUNC3_XOR: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_DIV:
-                        handle_div(riscv);
-                        break;
-                    case FUNC7_ADD:
-                        handle_xor(riscv);
-                        break;
-                    default:
+                case FUNC7_FCMP_S:
+                    if (riscv->instr.r.funct3 > FUNC3_FEQ) {
                         goto cond_end;
                     }
+                    handle_fcmp_s(riscv);
                     break;
-                }
-
-                case FUNC3_SR: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_DIV:
-                        handle_divu(riscv);
-                        break;
-                    case FUNC7_ADD:
-                        handle_srl(riscv);
-                        break;
-                    case FUNC7_SRA:
-                        handle_sra(riscv);
-                        break;
-                    default:
+                case FUNC7_FCVT_W_S:
+                    // rs2 = 2/3 为 RV64 的 l/lu 形式
+                    if (riscv->instr.r.rs2 > ((RISCV_XLEN == 64) ? 3 : 1)) {
                         goto cond_end;
                     }
+                    handle_fcvt_w_s(riscv);
                     break;
-                }
-
-                case FUNC3_OR: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_ADD:
-                        handle_or(riscv);
-                        break;
-                    case FUNC7_DIV:
-                        handle_rem(riscv);
-                        break;
-                    default:
+                case FUNC7_FCVT_S_W:
+                    // rs2 = 2/3 为 RV64 的 l/lu 形式
+                    if (riscv->instr.r.rs2 > ((RISCV_XLEN == 64) ? 3 : 1)) {
                         goto cond_end;
                     }
+                    handle_fcvt_s_w(riscv);
                     break;
-                }
-
-                case FUNC3_AND: {
-                    switch (riscv->instr.r.funct7)
-                    {
-                    case FUNC7_ADD:
-                        handle_and(riscv);
-                        break;
-                    case FUNC7_DIV:
-                        handle_remu(riscv);
-                        break;
-                    default:
+                case FUNC7_FMV_X_W:
+                    if (riscv->instr.r.funct3 == FUNC3_FMV_X_W) {
+                        handle_fmv_x_w(riscv);
+                    }
+                    else if (riscv->instr.r.funct3 == FUNC3_FCLASS) {
+                        handle_fclass_s(riscv);
+                    }
+                    else {
                         goto cond_end;
                     }
                     break;
+                case FUNC7_FMV_W_X:
+                    handle_fmv_w_x(riscv);
+                    break;
+                default:
+                    goto cond_end;
                 }
+                break;
+            }
 
-                default:
+            case OP_AMO: {
+                // .w 访问 4 字节  RV64 上 .d 访问 8 字节
+                int width;
+                if (riscv->instr.r.funct3 == FUNC3_AMO_W) {
+                    width = 4;
+                }
+#if RISCV_XLEN == 64
+                else if (riscv->instr.r.funct3 == FUNC3_AMO_D) {
+                    width = 8;
+                }
+#endif
+                else {
                     goto cond_end;
                 }
-            break;
-        }
-        
-        case OP_LUI: {
-            handle_lui(riscv);
-            break;
-        }
 
-        case OP_SB: {
-            switch (riscv->instr.s.funct3)
-            {
-            case FUNC3_SB:
-                handle_sb(riscv);
-                break;
-            case FUNC3_SH:
-                handle_sh(riscv);
-                break;
-            case FUNC3_SW:
-                handle_sw(riscv);
+                // funct7 低 2 位是 aq/rl 标志 所有原子操作都按顺序一致执行 可以忽略
+                switch (riscv->instr.r.funct7 >> 2)
+                {
+                case FUNC5_LR:
+                    handle_lr(riscv, width);
+                    break;
+                case FUNC5_SC:
+                    handle_sc(riscv, width);
+                    break;
+                case FUNC5_AMOSWAP:
+                case FUNC5_AMOADD:
+                case FUNC5_AMOXOR:
+                case FUNC5_AMOAND:
+                case FUNC5_AMOOR:
+                case FUNC5_AMOMIN:
+                case FUNC5_AMOMAX:
+                case FUNC5_AMOMINU:
+                case FUNC5_AMOMAXU:
+                    handle_amo(riscv, width);
+                    break;
+                default:
+                    goto cond_end;
+                }
                 break;
-            default:
-                goto cond_end;
             }
-            break;
-        }
 
-        case OP_LB: {
-            switch (riscv->instr.i.funct3)
-            {
-            case FUNC3_LB:
-                handle_lb(riscv);
-                break;
-            case FUNC3_LH:
-                handle_lh(riscv);
+            case OP_JALR: {
+                handle_jalr(riscv);
                 break;
-            case FUNC3_LW:
-                handle_lw(riscv);
-                break;
-            case FUNC3_LBU:
-                handle_lbu(riscv);
+            }
+
+            case OP_FENCE: {
+                switch (riscv->instr.i.funct3)
+                {
+                case FUNC3_FENCE:
+                    handle_fence(riscv);
+                    break;
+                case FUNC3_FENCE_I:
+                    handle_fence_i(riscv);
+                    break;
+                default:
+                    goto cond_end;
+                }
                 break;
-            case FUNC3_LHU:
-                handle_lhu(riscv);
+            }
+
+            case OP_BEQ: {
+                switch (riscv->instr.r.funct3)
+                {
+                case FUNC3_BEQ:
+                    handle_beq(riscv);
+                    break;
+                case FUNC3_BNE:
+                    handle_bne(riscv);
+                    break;
+                case FUNC3_BLT:
+                    handle_blt(riscv);
+                    break;
+                case FUNC3_BGE:
+                    handle_bge(riscv);
+                    break;
+                case FUNC3_BLTU:
+                    handle_bltu(riscv);
+                    break;
+                case FUNC3_BGEU:
+                    handle_bgeu(riscv);
+                    break;
+                default:
+                    goto cond_end;
+                }
                 break;
+            }
+        
             default:
                 goto cond_end;
             }
-            break;
-        }
-        
-        case OP_AUIPC: {
-            handle_auipc(riscv);
-            break;
-        }
-        
-        case OP_JAL: {
-            handle_jal(riscv);
-            break;
-        }
 
-        case OP_JALR: {
-            handle_jalr(riscv);
-            break;
-        }
+            // 同步异常: 出错的指令不提交 转到异常处理程序
+            if (riscv->trap_pending) {
+                goto trap;
+            }
+            continue;
 
-        case OP_BEQ: {
-            switch (riscv->instr.r.funct3)
-            {
-            case FUNC3_BEQ:
-                handle_beq(riscv);
-                break;
-            case FUNC3_BNE:
-                handle_bne(riscv);
-                break;
-            case FUNC3_BLT:
-                handle_blt(riscv);
-                break;
-            case FUNC3_BGE:
-                handle_bge(riscv);
-                break;
-            case FUNC3_BLTU:
-                handle_bltu(riscv);
-                break;
-            case FUNC3_BGEU:
-                handle_bgeu(riscv);
-                break;
-            default:
-                goto cond_end;
+cond_end:
+            // 压缩指令只保存了展开后的形式 mtval 允许写 0
+            riscv_raise_exception(riscv, EXCP_ILLEGAL_INSTR, (curr->size == 4) ? riscv->instr.raw : 0);
+trap:
+            if (riscv_trap_enter(riscv, riscv->trap_cause, riscv->trap_tval) < 0) {
+                if (riscv->trap_cause == EXCP_ILLEGAL_INSTR) {
+                    fprintf(stderr, "Unable to recognize %x\n", riscv->instr.raw);
+                }
+                else {
+                    fprintf(stderr, "Unhandled exception %" PRIuWORD " at pc %" PRIxWORD " (mtval %" PRIxWORD ")\n", riscv->trap_cause, riscv->pc, riscv->trap_tval);
+                }
+                return -1;
             }
+            used = curr - block->instrs + 1;
             break;
         }
-        
-        default:
-            goto cond_end;
+
+        // 进入 trap 时已经按出错位置结算过 这里只处理完整执行的块
+        if (riscv->exec_block) {
+            riscv->instret += end - block->instrs;
+            riscv->exec_block = NULL;
+
+            // 配额在块中间用完 下次从中间的指令继续执行也不是新的边
+            if (coverage && (used < (uint64_t)block->count)) {
+                riscv->cov_next = riscv->pc;
+            }
         }
-    } while (forever);
-    return;
+        budget -= used;
+    }
+    return 0;
+}
 
-cond_end:
-    fprintf(stderr, "Unable to recognize %x\n", riscv->instr.raw);
+static int riscv_execute(riscv_t* riscv, uint64_t budget) {
+    return riscv_execute_loop(riscv, budget, 0);
+}
+
+static int riscv_execute_cov(riscv_t* riscv, uint64_t budget) {
+    return riscv_execute_loop(riscv, budget, 1);
+}
+
+int riscv_run_budget(riscv_t* riscv, uint64_t budget) {
+    // 浮点环境是线程私有的: 进入时按 frm 设置宿主机的舍入模式 退出时把累积的异常标志收回 fflags
+    feclearexcept(FE_ALL_EXCEPT);
+    fesetround(fpu_host_round(riscv->frm));
+
+    int rc = riscv->machine->cov_map ? riscv_execute_cov(riscv, budget) : riscv_execute(riscv, budget);
+
+    riscv_fpu_flags(riscv);
+    fesetround(FE_TONEAREST);
+    return rc;
 }
 
-// 遍历外设链表 根据地址找到对应设备
+void riscv_continue(riscv_t* riscv, int forever) {
+    riscv_run_budget(riscv, forever ? RISCV_BUDGET_FOREVER : 1);
+}
+
+// 在有序设备表中二分查找 根据地址找到对应设备
 riscv_device_t* device_find(riscv_t* riscv, riscv_word_t addr) {
     // 在有 device_buffer 的情况下仍然没有找到 必须进行查找
-    riscv_device_t* dev = riscv->device_list;
-    while (dev) {
-        if (addr >= dev->addr_start && addr < dev->addr_end) {
-            return dev;
+    // 找到最后一个起始地址 <= addr 的设备 区间互不重叠 所以只可能是它
+    int low = 0;
+    riscv_machine_t* machine = riscv->machine;
+    int high = machine->device_count - 1;
+    riscv_device_t* candidate = NULL;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (machine->device_map[mid]->addr_start <= addr) {
+            candidate = machine->device_map[mid];
+            low = mid + 1;
+        } else {
+            high = mid - 1;
         }
-        dev = dev->next;
+    }
+
+    if (candidate && addr < candidate->addr_end) {
+        return candidate;
     }
     return NULL;
 }
 
 // 从模拟器的角度找到读写区域对应的设备 根据设备的特性去调用读写函数
-int riscv_mem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
+int riscv_pmem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
     // 利用读缓存设备优化
     if (start_addr >= riscv->dev_read_buffer->addr_start && start_addr < riscv->dev_read_buffer->addr_end) {
         return riscv->dev_read_buffer->read(riscv->dev_read_buffer, start_addr, val, width);
@@ -465,7 +1735,7 @@ int riscv_mem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int wi
     return targetDevice->read(targetDevice, start_addr, val, width);
 }
 
-int riscv_mem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
+int riscv_pmem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
     // 利用写缓存设备优化
     if (start_addr >= riscv->dev_write_buffer->addr_start && start_addr < riscv->dev_write_buffer->addr_end) {
         return riscv->dev_write_buffer->write(riscv->dev_write_buffer, start_addr, val, width);
@@ -482,17 +1752,381 @@ int riscv_mem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int w
     return targetDevice->write(targetDevice, start_addr, val, width);
 }
 
+uint8_t* riscv_pmem_ptr(riscv_t* riscv, riscv_word_t start_addr, riscv_word_t size, riscv_word_t attr) {
+    // 原子指令会反复访问同一片 RAM 先检查写缓存设备
+    riscv_device_t* targetDevice = riscv->dev_write_buffer;
+    if ((targetDevice == NULL) || (start_addr < targetDevice->addr_start) || (start_addr >= targetDevice->addr_end)) {
+        targetDevice = device_find(riscv, start_addr);
+    }
+    if ((targetDevice == NULL) || (targetDevice->host_ptr == NULL)) {
+        return NULL;
+    }
+    return targetDevice->host_ptr(targetDevice, start_addr, size, attr);
+}
+
+// 指令访存的入口 没有开启分页时只多一次判断
+int riscv_mem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
+    if (riscv->data_mmu) {
+        return riscv_vmem_read(riscv, start_addr, val, width);
+    }
+    return riscv_pmem_read(riscv, start_addr, val, width);
+}
+
+int riscv_mem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width) {
+    if (riscv->write_log) {
+        riscv_write_log_add(riscv, start_addr, val, width);
+    }
+    if (riscv->data_mmu) {
+        return riscv_vmem_write(riscv, start_addr, val, width);
+    }
+    return riscv_pmem_write(riscv, start_addr, val, width);
+}
+
+uint8_t* riscv_mem_ptr(riscv_t* riscv, riscv_word_t start_addr, riscv_word_t size, riscv_word_t attr) {
+    if (riscv->data_mmu) {
+        return riscv_vmem_ptr(riscv, start_addr, size, attr);
+    }
+    return riscv_pmem_ptr(riscv, start_addr, size, attr);
+}
+
+// FNV-1a 按 64 位字累积 地址 宽度和内容都参与  写入失败的访问也记录 它同样是执行结果的一部分
+void riscv_write_log_add(riscv_t* riscv, riscv_word_t addr, const uint8_t* val, int width) {
+    riscv_write_log_t* log = riscv->write_log;
+    riscv_write_entry_t* entry = &log->entries[log->count & (RISCV_WRITE_LOG_SIZE - 1)];
+    entry->addr = addr;
+    entry->width = width;
+    entry->value = 0;
+    memcpy(&entry->value, val, (width < 8) ? width : 8);
+
+    uint64_t hash = log->hash ? log->hash : 0xcbf29ce484222325ull;
+    hash = (hash ^ (uint64_t)addr) * 0x100000001b3ull;
+    hash = (hash ^ (uint64_t)width) * 0x100000001b3ull;
+    hash = (hash ^ entry->value) * 0x100000001b3ull;
+    log->hash = hash;
+    log->count++;
+}
+
+// 从 hart 的线程入口 停止后减少运行计数
+static void riscv_hart_thread(void* param) {
+    riscv_t* riscv = (riscv_t*)param;
+    riscv_continue(riscv, 1);
+    atomic_add_u32(&riscv->machine->running, (uint32_t)-1);
+}
+
+// 通知所有 hart 在下一个块边界退出
+static void riscv_machine_halt(riscv_machine_t* machine) {
+    atomic_xchg_u32(&machine->halt, 1);
+    for (int i = 0; i < machine->hart_count; i++) {
+        atomic_xchg_u32(&machine->harts[i]->irq_pending, 1);
+    }
+}
+
+// 确定性调度: 所有 hart 在当前线程中轮流执行 quantum 条指令  设备寄存器访问都是同步完成的
+// 设备线程投递的工作 (键盘等外部输入) 被锁存 只在每一轮开始时交给 hart  不会在配额中间的任意块边界插入
+// seed 不为 0 时每一轮的顺序由它产生的伪随机序列打乱  没有外部输入时同样的镜像 + quantum + seed 可以逐位复现
+// 有外部输入时它落在哪一轮取决于输入的时间 除此之外的执行过程仍然与线程调度无关
+static void riscv_run_quantum(riscv_t* riscv) {
+    riscv_machine_t* machine = riscv->machine;
+    riscv_t* order[RISCV_MAX_HARTS];
+    int count = machine->hart_count;
+    memcpy(order, machine->harts, count * sizeof(riscv_t*));
+
+    uint64_t state = machine->seed;
+    while (count) {
+        // xorshift64 + Fisher-Yates 洗牌
+        for (int i = count - 1; state && (i > 0); i--) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            int j = (int)(state % (uint64_t)(i + 1));
+            riscv_t* tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        // 送达上一轮期间锁存的工作  所有 hart 都停在配额边界上
+        for (int i = 0; i < count; i++) {
+            uint32_t latched = atomic_xchg_u32(&order[i]->work_latched, 0);
+            if (latched) {
+                atomic_or_u32(&order[i]->work_pending, latched);
+                atomic_xchg_u32(&order[i]->irq_pending, 1);
+            }
+        }
+
+        for (int i = 0; i < count; ) {
+            // 配额用完或者 wfi 让出时轮到下一个 hart
+            if (riscv_run_budget(order[i], machine->quantum) >= 0) {
+                i++;
+                continue;
+            }
+
+            // 启动 hart 停止后整个机器停止  其它 hart 停止后退出轮转
+            if (order[i] == riscv) {
+                return;
+            }
+            memmove(order + i, order + i + 1, (count - i - 1) * sizeof(riscv_t*));
+            count--;
+        }
+    }
+}
+
+// 线程池调度: 每个工作线程有自己的就绪队列 从头部取出 hart 执行 slice 条指令后放回尾部
+// 自己的队列为空时从其它线程的队列尾部偷取  刚换下来的 hart 在原队列中要等最久 偷走它代价最小
+// 每个 hart 同一时刻最多在一个队列中  队列用互斥锁保护 临界区只有几次读写
+typedef struct _riscv_deque_t {
+    mutex_t lock;
+    riscv_t* harts[RISCV_MAX_HARTS];
+    int head;
+    int count;
+}riscv_deque_t;
+
+typedef struct _riscv_worker_t {
+    struct _riscv_pool_t* pool;
+    int index;
+    uint64_t rand;                          // 选择偷取对象的伪随机状态
+}riscv_worker_t;
+
+typedef struct _riscv_pool_t {
+    riscv_machine_t* machine;
+    riscv_t* boot;
+    int count;
+    riscv_deque_t deques[RISCV_MAX_HARTS];
+    riscv_worker_t workers[RISCV_MAX_HARTS];
+
+    // 所有队列中的 hart 总数  为 0 时工作线程在条件变量上等待 入队时只有存在等待的线程才加锁唤醒
+    volatile uint32_t queued;
+    volatile uint32_t idle;
+    mutex_t idle_lock;
+    cond_t idle_cond;
+}riscv_pool_t;
+
+static void riscv_pool_notify(riscv_pool_t* pool) {
+    mutex_lock(&pool->idle_lock);
+    cond_broadcast(&pool->idle_cond);
+    mutex_unlock(&pool->idle_lock);
+}
+
+static void riscv_pool_push(riscv_pool_t* pool, int index, riscv_t* hart) {
+    riscv_deque_t* deque = &pool->deques[index];
+    hart->worker = index;
+
+    mutex_lock(&deque->lock);
+    deque->harts[(deque->head + deque->count) % RISCV_MAX_HARTS] = hart;
+    deque->count++;
+    mutex_unlock(&deque->lock);
+
+    // 先增加计数再检查等待的线程  与 riscv_pool_wait 的顺序相反 两边至少有一边能看到对方
+    atomic_add_u32(&pool->queued, 1);
+    if (atomic_load_u32(&pool->idle)) {
+        riscv_pool_notify(pool);
+    }
+}
+
+// steal 为 0 时从头部取出 否则从尾部偷取
+static riscv_t* riscv_pool_pop(riscv_pool_t* pool, int index, int steal) {
+    riscv_deque_t* deque = &pool->deques[index];
+    riscv_t* hart = NULL;
+
+    mutex_lock(&deque->lock);
+    if (deque->count) {
+        deque->count--;
+        if (steal) {
+            hart = deque->harts[(deque->head + deque->count) % RISCV_MAX_HARTS];
+        }
+        else {
+            hart = deque->harts[deque->head];
+            deque->head = (deque->head + 1) % RISCV_MAX_HARTS;
+        }
+    }
+    mutex_unlock(&deque->lock);
+
+    if (hart) {
+        atomic_add_u32(&pool->queued, (uint32_t)-1);
+    }
+    return hart;
+}
+
+static riscv_t* riscv_pool_take(riscv_worker_t* worker) {
+    riscv_pool_t* pool = worker->pool;
+    riscv_t* hart = riscv_pool_pop(pool, worker->index, 0);
+    if (hart || (pool->count == 1)) {
+        return hart;
+    }
+
+    // 从随机位置开始依次尝试其它线程的队列 避免所有空闲线程同时争抢同一个队列
+    worker->rand ^= worker->rand << 13;
+    worker->rand ^= worker->rand >> 7;
+    worker->rand ^= worker->rand << 17;
+    int start = (int)(worker->rand % (uint64_t)pool->count);
+    for (int i = 0; i < pool->count; i++) {
+        int victim = (start + i) % pool->count;
+        if (victim == worker->index) {
+            continue;
+        }
+        hart = riscv_pool_pop(pool, victim, 1);
+        if (hart) {
+            return hart;
+        }
+    }
+    return NULL;
+}
+
+// 所有队列都为空时等待 有 hart 入队或者机器停止时返回
+static void riscv_pool_wait(riscv_pool_t* pool) {
+    mutex_lock(&pool->idle_lock);
+    atomic_add_u32(&pool->idle, 1);
+    while (!atomic_load_u32(&pool->queued) && !pool->machine->halt) {
+        cond_wait(&pool->idle_cond, &pool->idle_lock);
+    }
+    atomic_add_u32(&pool->idle, (uint32_t)-1);
+    mutex_unlock(&pool->idle_lock);
+}
+
+// wfi 让出的 hart 挂起 不在任何队列中  与 riscv_pool_wake 一样先写自己的标志再检查对方的
+// 挂起之前已经有可响应的中断时立即放回队列
+static void riscv_pool_park(riscv_pool_t* pool, riscv_t* hart) {
+    atomic_xchg_u32(&hart->parked, 1);
+    if ((atomic_load_u32(&hart->riscv_csr_regs.mip) & hart->riscv_csr_regs.mie) && atomic_cas_u32(&hart->parked, 1, 0)) {
+        riscv_pool_push(pool, hart->worker, hart);
+    }
+}
+
+// 设备置位中断后调用  只有抢到挂起标志的一方把 hart 放回原来的队列
+static void riscv_pool_wake(riscv_t* riscv) {
+    if (atomic_load_u32(&riscv->parked) && atomic_cas_u32(&riscv->parked, 1, 0)) {
+        riscv_pool_push(riscv->machine->pool, riscv->worker, riscv);
+    }
+}
+
+static void riscv_pool_worker(riscv_worker_t* worker) {
+    riscv_pool_t* pool = worker->pool;
+    riscv_machine_t* machine = pool->machine;
+
+    while (!atomic_load_u32(&machine->halt)) {
+        riscv_t* hart = riscv_pool_take(worker);
+        if (hart == NULL) {
+            riscv_pool_wait(pool);
+            continue;
+        }
+
+        int rc = riscv_run_budget(hart, machine->slice);
+        if (rc == 0) {
+            riscv_pool_push(pool, worker->index, hart);
+        }
+        else if (rc > 0) {
+            riscv_pool_park(pool, hart);
+        }
+        else if (hart == pool->boot) {
+            // 启动 hart 停止后整个机器停止  其它 hart 停止后不再调度
+            riscv_machine_halt(machine);
+            riscv_pool_notify(pool);
+        }
+    }
+}
+
+static void riscv_pool_thread(void* param) {
+    riscv_worker_t* worker = (riscv_worker_t*)param;
+    riscv_pool_worker(worker);
+    atomic_add_u32(&worker->pool->machine->running, (uint32_t)-1);
+}
+
+// 当前线程作为 0 号工作线程  启动 hart 放在 0 号队列的最前面 其余 hart 依次分配到各个队列
+// 线程池只分配一次 设备线程在运行结束后仍可能通过 machine->pool 唤醒 hart
+static void riscv_run_pool(riscv_t* riscv) {
+    riscv_machine_t* machine = riscv->machine;
+    riscv_pool_t* pool = machine->pool;
+    if (pool == NULL) {
+        pool = (riscv_pool_t*)calloc(1, sizeof(riscv_pool_t));
+        assert(pool != NULL);
+        for (int i = 0; i < RISCV_MAX_HARTS; i++) {
+            mutex_init(&pool->deques[i].lock);
+        }
+        mutex_init(&pool->idle_lock);
+        cond_init(&pool->idle_cond);
+        pool->machine = machine;
+    }
+
+    pool->boot = riscv;
+    pool->count = (machine->workers < machine->hart_count) ? machine->workers : machine->hart_count;
+    pool->queued = 0;
+    for (int i = 0; i < pool->count; i++) {
+        pool->deques[i].head = 0;
+        pool->deques[i].count = 0;
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pool->workers[i].rand = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+    if (machine->slice == 0) {
+        machine->slice = RISCV_SLICE_DEFAULT;
+    }
+
+    int next = 0;
+    riscv_pool_push(pool, next++, riscv);
+    for (int i = 0; i < machine->hart_count; i++) {
+        riscv_t* hart = machine->harts[i];
+        hart->wfi = 0;
+        hart->parked = 0;
+        if (hart != riscv) {
+            riscv_pool_push(pool, next++ % pool->count, hart);
+        }
+    }
+
+    machine->pool = pool;
+    machine->halt = 0;
+    machine->running = pool->count - 1;
+    for (int i = 1; i < pool->count; i++) {
+        thread_create(riscv_pool_thread, &pool->workers[i]);
+    }
+
+    riscv_pool_worker(&pool->workers[0]);
+    while (atomic_load_u32(&machine->running)) {
+        thread_msleep(1);
+    }
+    machine->halt = 0;
+}
+
 // 模拟器运行主体
 void riscv_run(riscv_t* riscv) {
     // 参考 instr_test 的执行流程
-    
+    riscv_machine_t* machine = riscv->machine;
+
     // 复位内核
-    riscv_reset(riscv);
+    for (int i = 0; i < machine->hart_count; i++) {
+        riscv_reset(machine->harts[i]);
+    }
 
+    // 调试器只控制当前 hart 其它 hart 保持复位状态
     if (riscv->gdb_server) {
         gdb_server_run(riscv->gdb_server);
+        return;
     }
-    else {
-        riscv_continue(riscv, 1);
+
+    if (machine->quantum) {
+        riscv_run_quantum(riscv);
+        return;
+    }
+
+    if (machine->workers) {
+        riscv_run_pool(riscv);
+        return;
+    }
+
+    machine->halt = 0;
+    machine->running = machine->hart_count - 1;
+    for (int i = 0; i < machine->hart_count; i++) {
+        if (machine->harts[i] != riscv) {
+            thread_create(riscv_hart_thread, machine->harts[i]);
+        }
+    }
+
+    riscv_continue(riscv, 1);
+
+    // 启动 hart 停止后整个机器停止 等待其它 hart 的线程退出
+    if (machine->hart_count > 1) {
+        riscv_machine_halt(machine);
+        while (atomic_load_u32(&machine->running)) {
+            thread_msleep(1);
+        }
+        machine->halt = 0;
     }
 }
\ No newline at end of file
@@ -4,41 +4,387 @@
 #include "device/mem.h"
 #include "instr.h"
 #include "gdb/gdb_server.h"
+#include "rvv.h"
 
 #define RISCV_REG_NUM 32
 
 // CSR 内存映射地址
+#define RISCV_CSR_NUM   4096
+#define RISCV_SSTATUS   0x100
+#define RISCV_SIE       0x104
+#define RISCV_STVEC     0x105
+#define RISCV_SCOUNTEREN 0x106
+#define RISCV_SSCRATCH  0x140
+#define RISCV_SEPC      0x141
+#define RISCV_SCAUSE    0x142
+#define RISCV_STVAL     0x143
+#define RISCV_SIP       0x144
+#define RISCV_SATP      0x180
+#define RISCV_MSTATUS   0x300
+#define RISCV_MISA      0x301
+#define RISCV_MEDELEG   0x302
+#define RISCV_MIDELEG   0x303
+#define RISCV_MIE       0x304
+#define RISCV_MTVEC     0x305
+#define RISCV_MCOUNTEREN 0x306
+#define RISCV_MSTATUSH  0x310
 #define RISCV_MSCRATCH  0x340
+#define RISCV_MEPC      0x341
+#define RISCV_MCAUSE    0x342
+#define RISCV_MTVAL     0x343
+#define RISCV_MIP       0x344
+#define RISCV_MCYCLE    0xB00
+#define RISCV_MINSTRET  0xB02
+#define RISCV_MCYCLEH   0xB80
+#define RISCV_MINSTRETH 0xB82
+#define RISCV_CYCLE     0xC00           // 用户级只读计数器 受 mcounteren/scounteren 控制
+#define RISCV_TIME      0xC01
+#define RISCV_INSTRET   0xC02
+#define RISCV_CYCLEH    0xC80
+#define RISCV_TIMEH     0xC81
+#define RISCV_INSTRETH  0xC82
+#define RISCV_MVENDORID 0xF11
+#define RISCV_MARCHID   0xF12
+#define RISCV_MIMPID    0xF13
+#define RISCV_MHARTID   0xF14
+#define RISCV_FFLAGS    0x001
+#define RISCV_FRM       0x002
+#define RISCV_FCSR      0x003
+#define RISCV_CSR_VSTART    0x008
+#define RISCV_CSR_VL        0xC20
+#define RISCV_CSR_VTYPE     0xC21
+#define RISCV_CSR_VLENB     0xC22
+
+// 特权级
+#define RISCV_PRIV_U    0
+#define RISCV_PRIV_S    1
+#define RISCV_PRIV_M    3
+
+// mstatus 字段  sstatus 是它的一部分
+#define MSTATUS_SIE     (1 << 1)
+#define MSTATUS_MIE     (1 << 3)
+#define MSTATUS_SPIE    (1 << 5)
+#define MSTATUS_MPIE    (1 << 7)
+#define MSTATUS_SPP     (1 << 8)
+#define MSTATUS_MPP_SHIFT   11
+#define MSTATUS_MPP     (3 << MSTATUS_MPP_SHIFT)
+#define MSTATUS_FS      (3 << 13)      // 只实现 Off 和 Dirty 两种状态 写入其它非 0 值都按 Dirty
+#define MSTATUS_MPRV    (1 << 17)
+#define MSTATUS_SUM     (1 << 18)
+#define MSTATUS_MXR     (1 << 19)
+#define SSTATUS_MASK    (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_FS | MSTATUS_SUM | MSTATUS_MXR)
+
+// RV64: U/S 模式的 XLEN 只读 固定为 64 位   RV32 没有这两个字段
+// SD 在最高位 FS 为 Dirty 时只读的置位
+#if RISCV_XLEN == 64
+#define MSTATUS_UXL     (2ULL << 32)
+#define MSTATUS_SXL     (2ULL << 34)
+#define MSTATUS_SD      (1ULL << 63)
+#else
+#define MSTATUS_UXL     0
+#define MSTATUS_SXL     0
+#define MSTATUS_SD      (1U << 31)
+#endif
+
+// mie/mip 字段
+#define MIP_SSIP        (1 << 1)
+#define MIP_MSIP        (1 << 3)
+#define MIP_STIP        (1 << 5)
+#define MIP_MTIP        (1 << 7)
+#define MIP_SEIP        (1 << 9)
+#define MIP_MEIP        (1 << 11)
+#define MIP_S_MASK      (MIP_SSIP | MIP_STIP | MIP_SEIP)
+
+// satp: 模式位和根页表的物理页号  ASID 固定为 0   RV32 只支持 Sv32  RV64 只支持 Sv39
+#if RISCV_XLEN == 64
+#define SATP_MODE       0xF000000000000000ULL
+#define SATP_MODE_PAGED 0x8000000000000000ULL       // Sv39
+#define SATP_ASID_SHIFT 44
+#define SATP_PPN        0x00000FFFFFFFFFFFULL
+#else
+#define SATP_MODE       0x80000000
+#define SATP_MODE_PAGED 0x80000000                  // Sv32
+#define SATP_ASID_SHIFT 22
+#define SATP_PPN        0x003FFFFF
+#endif
+
+// mcause: 最高位为 1 表示中断 低位是异常/中断编号
+#define MCAUSE_INTERRUPT            ((riscv_word_t)1 << (RISCV_XLEN - 1))
+#define EXCP_INSTR_ACCESS_FAULT     1
+#define EXCP_ILLEGAL_INSTR          2
+#define EXCP_BREAKPOINT             3
+#define EXCP_LOAD_MISALIGNED        4
+#define EXCP_LOAD_ACCESS_FAULT      5
+#define EXCP_STORE_MISALIGNED       6       // 也用于 AMO
+#define EXCP_STORE_ACCESS_FAULT     7
+#define EXCP_ECALL_U                8       // S/M 模式依次加上特权级
+#define EXCP_ECALL_M                11
+#define EXCP_INSTR_PAGE_FAULT       12
+#define EXCP_LOAD_PAGE_FAULT        13
+#define EXCP_STORE_PAGE_FAULT       15
+#define IRQ_S_SOFT                  1
+#define IRQ_M_SOFT                  3
+#define IRQ_S_TIMER                 5
+#define IRQ_M_TIMER                 7
+#define IRQ_S_EXT                   9
+#define IRQ_M_EXT                   11
+
+// fflags 各个异常标志位
+#define FFLAGS_NX       (1 << 0)        // 不精确
+#define FFLAGS_UF       (1 << 1)        // 下溢
+#define FFLAGS_OF       (1 << 2)        // 上溢
+#define FFLAGS_DZ       (1 << 3)        // 除零
+#define FFLAGS_NV       (1 << 4)        // 无效操作
+
+// 预译码块缓存: 从某个 pc 开始顺序译码 遇到跳转/分支/系统指令为止
+// 压缩指令在这里展开为 32 位形式 执行阶段直接取用 不再重复判断指令长度
+#define RISCV_BLOCK_MAX_INSTR   32
+#define RISCV_BLOCK_CACHE_SIZE  1024        // 必须是 2 的幂 按 pc 直接映射
+
+typedef struct _riscv_decoded_t
+{
+    instr_t instr;                  // 展开后的 32 位指令
+    riscv_word_t pc;
+    riscv_word_t size;              // 原始指令长度 2 或 4
+}riscv_decoded_t;
+
+typedef struct _riscv_block_t
+{
+    riscv_word_t start_pc;
+    riscv_word_t end_pc;            // 最后一条指令之后的地址
+    riscv_word_t ctx;               // 译码时的地址转换上下文 与 riscv_t.fetch_ctx 相同才能命中
+    int count;                      // 为 0 表示该缓存项无效
+    riscv_decoded_t instrs[RISCV_BLOCK_MAX_INSTR];
+}riscv_block_t;
+
+// 存储器写入记录: 所有写入按顺序累积成一个散列 只保留最近几次的内容用于报告  对比两次执行时使用
+#define RISCV_WRITE_LOG_SIZE    16          // 必须是 2 的幂
+
+typedef struct _riscv_write_entry_t
+{
+    riscv_word_t addr;
+    uint64_t value;                 // 超过 8 字节的写入按元素分别记录
+    int width;
+}riscv_write_entry_t;
+
+typedef struct _riscv_write_log_t
+{
+    uint64_t hash;
+    uint64_t count;
+    riscv_write_entry_t entries[RISCV_WRITE_LOG_SIZE];     // 第 i 次写入在 entries[i % SIZE]
+}riscv_write_log_t;
+
+// 页表项 Sv32 和 Sv39 的低 8 位相同
+#define RISCV_PAGE_SHIFT    12
+#define RISCV_PAGE_SIZE     (1 << RISCV_PAGE_SHIFT)
+#define RISCV_PAGE_MASK     (RISCV_PAGE_SIZE - 1)
+#define PTE_V           (1 << 0)
+#define PTE_R           (1 << 1)
+#define PTE_W           (1 << 2)
+#define PTE_X           (1 << 3)
+#define PTE_U           (1 << 4)
+#define PTE_A           (1 << 6)
+#define PTE_D           (1 << 7)
+
+// 地址转换的访问类型
+#define RISCV_ACCESS_READ   0
+#define RISCV_ACCESS_WRITE  1
+#define RISCV_ACCESS_EXEC   2
+
+// time 的计数频率: 每隔多少个模型周期加一  与指令数挂钩 同一程序每次运行读到的值都相同
+#define RISCV_CYCLES_PER_TICK   100
+// time 每秒的计数 (10MHz 模型周期相当于 1GHz)  把毫秒等实际时间单位换算为虚拟时间时使用
+#define RISCV_TIME_FREQ         10000000
+
+// TLB: 按虚拟页号直接映射 取指和数据分开  大页也按 4K 分别缓存
+// 页落在普通存储器中时缓存本机指针 命中后直接 memcpy 不再经过设备查找
+#define RISCV_TLB_SIZE      64      // 必须是 2 的幂
+
+typedef struct _riscv_tlb_entry_t
+{
+    int valid;
+    riscv_word_t vpn;               // 虚拟页号
+    riscv_word_t ppage;             // 物理页起始地址
+    riscv_word_t pte;               // 叶子页表项的低 8 位 权限在每次访问时按当前特权级检查
+    uint8_t* host_read;             // 可读的普通存储器页 否则为 NULL
+    uint8_t* host_write;            // 可写的普通存储器页 否则为 NULL
+}riscv_tlb_entry_t;
 
 // 由于无法解决头文件的嵌套问题 所以还是写在同一个文件里
+// 大部分 CSR 只是一个字段 读写由 csr.c 中的查找表按偏移完成
 typedef struct _riscv_csr_t
 {
+    riscv_word_t mstatus;
+    riscv_word_t misa;
+    riscv_word_t mie;
+    uint32_t mip;                           // 挂起位都在低 32 位 设备线程用 32 位原子操作修改
+    riscv_word_t mtvec;
     riscv_word_t mscratch;
+    riscv_word_t mepc;
+    riscv_word_t mcause;
+    riscv_word_t mtval;
+    riscv_word_t mhartid;
+    riscv_word_t medeleg;
+    riscv_word_t mideleg;
+    riscv_word_t mcounteren;
+    riscv_word_t zero;                      // 只读为 0 的 CSR 都指向这里
+
+    // S 模式  sstatus/sie/sip 只是 M 模式寄存器的一部分 没有单独的字段
+    riscv_word_t stvec;
+    riscv_word_t scounteren;
+    riscv_word_t sscratch;
+    riscv_word_t sepc;
+    riscv_word_t scause;
+    riscv_word_t stval;
+    riscv_word_t satp;
+
+    // mcycle/minstret 由退休指令数推算 写入时只记录差值  time 没有对应的 M 模式 CSR 不可写
+    uint64_t mcycle_offset;
+    uint64_t minstret_offset;
+    // 修改 CPI 时记录的周期差值 使本 hart 推算的 time 不随 CPI 跳变  软件写 mcycle 不影响它
+    uint64_t time_offset;
 }riscv_csr_t;
 
+#define RISCV_MAX_HARTS     256
+#define RISCV_WORK_MAX      32              // 每个 hart 最多登记的设备工作数量
+#define RISCV_SLICE_DEFAULT 10000           // 线程池调度时每个 hart 一次连续执行的指令数
+#define RISCV_COV_MAP_SIZE  (1 << 16)       // 边覆盖位图的字节数 与 AFL 默认的 MAP_SIZE 相同
+#define RISCV_COV_NO_NEXT   1               // cov_next 不会是指令地址的值
+
+// 整个机器: 存储器和外设由所有 hart 共享 每个 hart 运行在自己的宿主机线程中
+// 内存模型 RVWMO 直接映射到宿主机: 对齐的普通访存是单条读写 AMO/LR/SC 使用原子指令 fence 使用内存屏障
+// 预译码块和 TLB 属于各个 hart  与硬件一样 fence.i/sfence.vma 只作用于执行它的 hart
+typedef struct _riscv_machine_t
+{
+    // 外部设备表 按起始地址升序排列 注册时整体重建 之后只读   查找时二分
+    riscv_device_t** device_map;
+    int device_count;
+
+    // 挂载 Flash 外设  其实就是添加该外设对应的结构体
+    // 仍然需要对应的函数进行初始化
+    mem_t* flash;
+
+    struct _riscv_t* harts[RISCV_MAX_HARTS];
+    int hart_count;
+
+    // 不为 0 时使用确定性调度: 所有 hart 在一个线程中轮流执行 quantum 条指令 轮转顺序由 seed 决定
+    // 设备线程投递的工作 (外部输入) 只在每一轮开始时送达
+    uint64_t quantum;
+    uint64_t seed;
+
+    // 不为 0 时使用线程池调度: workers 个线程各自维护就绪队列 空闲时从其它线程的队列中偷取
+    // hart 每次执行 slice 条指令后放回队列  执行 wfi 且没有可响应的中断时挂起 不占用任何线程
+    int workers;
+    uint64_t slice;
+    struct _riscv_pool_t* pool;
+
+    // 不打印 found ebreak! 这类运行提示  批量模式的标准输出只留给结果
+    int quiet;
+
+    // 不为 NULL 时记录边覆盖 格式与 AFL 的共享内存位图相同 大小为 RISCV_COV_MAP_SIZE
+    uint8_t* cov_map;
+
+    // time 的周期数: 各 hart 由自己的指令数推算 机器取所有 hart 读到过的最大值
+    // 任何 hart 读到的 time 都不会小于其它 hart 之前读到的值  任务迁移到落后的 hart 上时间也不会倒退
+    volatile uint64_t time_cycles;
+
+    // 启动 hart 停止后置位 其它 hart 在下一个块边界退出
+    volatile uint32_t halt;
+    volatile uint32_t running;              // 仍在运行的从线程数量
+}riscv_machine_t;
 
 typedef struct _riscv_t
 {
     riscv_word_t regs[RISCV_REG_NUM];       // 寄存器数组
     riscv_word_t pc;
+    int priv;                               // 当前特权级
 
-    // 挂载 Flash 外设  其实就是添加该外设对应的结构体
-    // 仍然需要对应的函数进行初始化
-    mem_t* riscv_flash;
+    riscv_machine_t* machine;               // 所属的机器 共享存储器和外设
+
+    // F-Extension 浮点寄存器 按 64 位存储 单精度数按 NaN-boxing 规则放在低 32 位
+    uint64_t fregs[RISCV_REG_NUM];
+    // 宿主机 FPU 在执行过程中累积的异常标志不会逐条收集 只在读 fcsr 或退出执行时合并到这里
+    riscv_word_t fflags;
+    riscv_word_t frm;
+
+    // V-Extension 向量寄存器 寄存器组在内存中连续 运算核心可以一次处理整个组
+    uint8_t vregs[RISCV_REG_NUM][RISCV_VLENB];
+    riscv_word_t vl;
+    riscv_word_t vtype;
+    const rvv_kernels_t* rvv;               // 运行时按宿主机指令集选出的运算核心
 
     // 对应 CPU 中 IR: Instruction Register
     instr_t instr;
+    riscv_word_t instr_size;                // 当前指令的原始长度 handler 用它推进 pc
+
+    // 预译码块缓存
+    riscv_block_t* block_cache;
 
-    // 外部设备链表
-    riscv_device_t* device_list;
+    // 缓存整体作废时加一  预译码线程按它判断结果是否过期
+    volatile uint32_t block_gen;
+    struct _riscv_prefetch_t* prefetch;     // 不为 NULL 时有预译码线程沿静态控制流提前译码
 
-    // 添加读写设备缓存
+    // 添加读写设备缓存 每个 hart 各自一份
     riscv_device_t* dev_read_buffer;
     riscv_device_t* dev_write_buffer;
 
     // 定义 CSR 寄存器
     riscv_csr_t riscv_csr_regs;
 
+    // 地址转换状态 在特权级/satp/mstatus 变化时由 riscv_mmu_update 重新计算
+    // data_mmu: 数据访问是否需要转换  fetch_ctx: 取指不需要转换时为 0 否则区分不同的 satp 和特权级
+    int data_mmu;
+    riscv_word_t fetch_ctx;
+    riscv_tlb_entry_t itlb[RISCV_TLB_SIZE];
+    riscv_tlb_entry_t dtlb[RISCV_TLB_SIZE];
+
+    // 退休指令数只在每个块执行完时累加 块内的位置由 exec_block 和 pc 推算
+    uint64_t instret;
+    riscv_block_t* exec_block;
+    // 不为 NULL 时记录这个 hart 的每一次存储器写入
+    riscv_write_log_t* write_log;
+    // 上一个块入口的散列值右移一位 与当前块的散列值异或得到边在位图中的位置
+    riscv_word_t cov_prev;
+    // 上一个块没有以控制转移结束时 顺序执行的下一条指令地址  从这里进入的块不是新的边
+    riscv_word_t cov_next;
+    // 周期模型: 每条指令固定计 cpi 个周期  time 每 RISCV_CYCLES_PER_TICK 个周期加一
+    uint32_t cpi;
+
+    // 同步异常: handler 发现异常时只记录原因 不修改 rd 和 pc  由执行循环在该指令之后进入 trap
+    int trap_pending;
+    riscv_word_t trap_cause;
+    riscv_word_t trap_tval;
+
+    // 中断只在块边界检查: mip/mie/mstatus 变化时置位 执行循环看到后再判断能否响应
+    // 设备可能在其它线程中置位 读写都使用原子操作
+    volatile uint32_t irq_pending;
+    volatile uint32_t irq_lines;            // 外部中断线 任意一条有效时 MEIP 置位
+
+    // 设备线程投递的工作 每一位对应一个登记的设备  投递时同时置位 irq_pending 在块边界和中断一起处理
+    // 对应的回调总是在执行该 hart 的线程中调用 设备可以用 SPSC 队列批量取出事件 不需要加锁
+    volatile uint32_t work_pending;
+    volatile uint32_t work_latched;         // 确定性调度时投递的工作先锁存在这里 每一轮开始时才转入 work_pending
+    int work_count;
+    riscv_device_t* work_dev[RISCV_WORK_MAX];
+    void (*work_fn[RISCV_WORK_MAX])(riscv_device_t* dev);
+
+    // 虚拟时间定时器: 本 hart 的 time 到达 timer_time 时在块边界调用一次 timer_fn  触发前就已取消 回调中可以再次设置
+    // timer_instret 为换算后的退休指令数 执行循环只比较它  没有设置时为 UINT64_MAX
+    uint64_t timer_instret;
+    uint64_t timer_time;
+    riscv_device_t* timer_dev;
+    void (*timer_fn)(riscv_device_t* dev);
+
+    // 线程池调度: wfi 请求挂起时置位 wfi  挂起后 parked 为 1 由中断唤醒   worker 为最后所在的队列
+    int wfi;
+    volatile uint32_t parked;
+    int worker;
+
+    // LR/SC 保留状态: 记录 LR 读到的地址和值  SC 用比较交换确认该值没有被修改
+    int reserve_valid;
+    riscv_word_t reserve_addr;
+    riscv_word_t reserve_value;
+
     // 定义使用的 gdb 对象
     gdb_server_t* gdb_server;
     
@@ -49,17 +395,57 @@ void riscv_csr_init(riscv_t* riscv);
 riscv_word_t riscv_read_csr(riscv_t* riscv, riscv_word_t addr);
 void riscv_write_csr(riscv_t* riscv, riscv_word_t addr, riscv_word_t val);
 
-/* 空间分配并且初始化 */
+// 检查 CSR 是否存在以及是否允许写入 不合法时返回 -1
+int riscv_csr_check(riscv_t* riscv, riscv_word_t addr, int write);
+
+// 精确的退休指令数 包括当前块中已经执行的部分
+uint64_t riscv_get_instret(riscv_t* riscv);
+
+// 修改每条指令的周期数 mcycle 和 time 从当前值继续计数 不会跳变
+void riscv_set_cpi(riscv_t* riscv, uint32_t cpi);
+
+// 把宿主机浮点环境中累积的异常标志合并到 fflags
+riscv_word_t riscv_fpu_flags(riscv_t* riscv);
+
+// 地址转换相关
+void riscv_mmu_update(riscv_t* riscv);
+
+// 成功时返回 0 并给出对应的 TLB 项  失败时返回异常编号 不会触发异常
+int riscv_mmu_translate(riscv_t* riscv, riscv_word_t vaddr, int access, riscv_tlb_entry_t** entry);
+
+// sfence.vma: all 为 1 时清空全部 否则只清除 vaddr 所在的页   同时作废相关的预译码块
+void riscv_tlb_flush(riscv_t* riscv, riscv_word_t vaddr, int all);
+
+// 经过地址转换的访问 缺页时触发异常并返回 -1
+int riscv_vmem_read(riscv_t* riscv, riscv_word_t vaddr, uint8_t* val, int width);
+int riscv_vmem_write(riscv_t* riscv, riscv_word_t vaddr, uint8_t* val, int width);
+uint8_t* riscv_vmem_ptr(riscv_t* riscv, riscv_word_t vaddr, riscv_word_t size, riscv_word_t attr);
+
+/* 空间分配并且初始化 创建只有一个 hart 的机器 返回该 hart */
 riscv_t* riscv_create(void);
 
+// 给机器增加一个共享存储器和外设的 hart  mhartid 按添加顺序编号  超过 RISCV_MAX_HARTS 时返回 NULL
+riscv_t* riscv_hart_add(riscv_machine_t* machine);
+
+// 释放整个机器和它的所有 hart  外设由创建者负责释放 必须在机器停止运行之后调用
+void riscv_destroy(riscv_t* riscv);
+
+// 按照 layout 的存储器布局创建只有一个 hart 的独立机器  只复制 Flash/RAM 这类存储器 不复制内容和寄存器类外设
+// 供测试和批量运行使用 用 riscv_clone_destroy() 连同存储器一起释放  之后加入的其它外设由调用者释放
+riscv_t* riscv_clone(riscv_t* layout);
+void riscv_clone_destroy(riscv_t* riscv);
+
 /* 创建 Flash 外设对应的结构体 */
 
 // Q: 为什么单独为 Flash 写一个函数
 // A: 因为后续要根据参数动态分配空间
 void riscv_flash_set(riscv_t* riscv, mem_t* flash);     // 注意没有返回值并且需要声明该 flash 需要挂载到哪个模拟器对象上
 
-// 向该 flash->mem 空间中写入 image.bin 文件
-void riscv_load_bin(riscv_t* riscv, const char* file_name);
+// 向该 flash->mem 空间中写入 image.bin 文件  失败时打印错误并返回 -1
+int riscv_load_bin(riscv_t* riscv, const char* file_name);
+
+// 同上 但失败时返回 -1 (文件不存在或者比 Flash 大)  成功时返回镜像的字节数
+int riscv_load_image(riscv_t* riscv, const char* file_name);
 
 
 /* 定义针对 Reg 的读写操作 注意读写操作一定要写在 riscv_t 结构体的声明后面 否则编译器无法识别 */
@@ -74,19 +460,84 @@ inline riscv_word_t riscv_read_reg(riscv_t* riscv, riscv_word_t reg) {
 // 注意因为 RISCV 的 ISA 在 reg(0) 写入是没有意义的 所以进行一个判断
 #define riscv_write_reg(riscv, reg, val) if ((reg != 0) && (reg < 32)) {riscv->regs[reg] = val;}
 
+// 指令执行中发生同步异常 调用后 handler 应当立即返回
+static inline void riscv_raise_exception(riscv_t* riscv, riscv_word_t cause, riscv_word_t tval) {
+    riscv->trap_pending = 1;
+    riscv->trap_cause = cause;
+    riscv->trap_tval = tval;
+}
+
+// 访存失败: 地址转换已经报告了缺页时保留缺页 否则按访问错误处理
+static inline void riscv_mem_fault(riscv_t* riscv, riscv_word_t cause, riscv_word_t tval) {
+    if (!riscv->trap_pending) {
+        riscv_raise_exception(riscv, cause, tval);
+    }
+}
+
+// 登记设备工作 返回以后投递时使用的编号  超过 RISCV_WORK_MAX 时返回 -1   在运行之前调用
+int riscv_work_register(riscv_t* riscv, riscv_device_t* dev, void (*fn)(riscv_device_t* dev));
+
+// 投递工作: hart 在下一个块边界调用登记的回调  可以在设备线程中调用 不会阻塞
+void riscv_work_post(riscv_t* riscv, int work);
+
+// 设置虚拟时间定时器: 本 hart 的 time 达到 time 之后的第一个块边界调用 fn  只能在执行该 hart 的线程中或运行之前调用
+// 每个 hart 只有一个定时器 再次设置会替换之前的设置
+void riscv_timer_set(riscv_t* riscv, riscv_device_t* dev, void (*fn)(riscv_device_t* dev), uint64_t time);
+
+// 按当前的指令数和 CPI 重新换算定时器的到期位置  复位和修改 CPI 后调用
+void riscv_timer_update(riscv_t* riscv);
+
+// 设置/清除 mip 中的挂起位  可以在设备线程中调用
+void riscv_mip_update(riscv_t* riscv, riscv_word_t mask, int level);
+
+// 外部中断线 line 为 0-31  多个设备共享 MEIP 由 guest 查询各设备的状态寄存器确认来源
+// 设备创建时绑定的是启动 hart 外部中断只送到这个 hart
+void riscv_irq_set(riscv_t* riscv, int line, int level);
+
 // 在写入 image.bin 文件后对芯片进行重置
 void riscv_reset(riscv_t* riscv);
 
+// 指令存储内容发生变化后 清空预译码缓存
+void riscv_block_flush(riscv_t* riscv);
+
+// 只作废以 pc 开始的缓存块
+void riscv_block_drop(riscv_t* riscv, riscv_word_t pc);
+
+// 为 hart 启动预译码线程: 从最近未命中的 pc 出发沿静态控制流提前译码后续的块  失败时返回 -1
+// 只处理没有开启地址转换时的取指 页表遍历有副作用 只能在执行线程中进行
+int riscv_prefetch_start(riscv_t* riscv);
+
 // 模拟器核心执行流程
 void riscv_continue(riscv_t* riscv, int step);
 
-// 对外部设备读写
+// 最多执行 budget 条指令 (进入 trap 也算一条) 配额用完返回 0  遇到 ebreak 或无法继续执行时返回 -1
+// 线程池调度时 wfi 请求挂起返回 1
+#define RISCV_BUDGET_FOREVER    UINT64_MAX
+int riscv_run_budget(riscv_t* riscv, uint64_t budget);
+
+// 对外部设备读写  地址是当前 hart 看到的地址 开启分页时先经过地址转换
 int riscv_mem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width);
 int riscv_mem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width);
 
-// 增加对不同存储设备的添加支持
-void riscv_device_add(riscv_t* riscv, riscv_device_t* dev);
+// 获取一段模拟器地址对应的本机指针 区间必须完整落在同一个存储器中 否则返回 NULL
+uint8_t* riscv_mem_ptr(riscv_t* riscv, riscv_word_t start_addr, riscv_word_t size, riscv_word_t attr);
+
+// 把一次写入加入 write_log  riscv_mem_write 自动记录 直接写本机指针的指令 (原子指令 向量存储) 自己调用
+void riscv_write_log_add(riscv_t* riscv, riscv_word_t addr, const uint8_t* val, int width);
+
+// 按物理地址访问 供页表遍历和 DMA 类设备使用
+int riscv_pmem_read(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width);
+int riscv_pmem_write(riscv_t* riscv, riscv_word_t start_addr, uint8_t* val, int width);
+uint8_t* riscv_pmem_ptr(riscv_t* riscv, riscv_word_t start_addr, riscv_word_t size, riscv_word_t attr);
+
+// 增加对不同存储设备的添加支持     地址区间与已有设备重叠时拒绝注册并返回 -1
+int riscv_device_add(riscv_t* riscv, riscv_device_t* dev);
+
+// 根据地址找到对应设备 没有找到返回 NULL
+riscv_device_t* device_find(riscv_t* riscv, riscv_word_t addr);
 
+// 复位所有 hart 并运行  多个 hart 时其余 hart 各自在新线程中执行 当前 hart 停止后整个机器停止
+// 设置了 quantum 时改为在当前线程中确定性地轮转执行  设置了 workers 时由线程池调度
 void riscv_run(riscv_t* riscv);
 
 #endif /* RISCV_H */
\ No newline at end of file
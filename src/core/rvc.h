@@ -0,0 +1,268 @@
+#ifndef RVC_H
+#define RVC_H
+
+#include "instr.h"
+
+// RV32C/RV64C: 16 位压缩指令在预译码阶段一次性展开为等价的 32 位指令
+// 展开之后执行阶段与普通指令完全相同 只有 pc 的步进长度不同
+// RV64 上 c.flw/c.fsw/c.flwsp/c.fswsp 的编码改为 c.ld/c.sd/c.ldsp/c.sdsp  c.jal 改为 c.addiw
+
+#define RVC_OP_Q0       0b00
+#define RVC_OP_Q1       0b01
+#define RVC_OP_Q2       0b10
+
+// 低两位为 11 的是 32 位指令 其余都是 16 位压缩指令
+#define rvc_is_compressed(half)     (((half) & 0b11) != 0b11)
+
+// 取出压缩指令中 [hi:lo] 的位段
+#define rvc_bits(c, hi, lo)         (((c) >> (lo)) & ((1u << ((hi) - (lo) + 1)) - 1))
+
+// 压缩指令中的 rd' / rs1' / rs2' 只有 3 位 对应 x8 - x15
+#define rvc_reg(c, lo)              (rvc_bits(c, (lo) + 2, lo) + 8)
+
+// 对 bits 位宽的立即数做符号扩展
+static inline int32_t rvc_sext(riscv_word_t imm, int bits) {
+    riscv_word_t sign = 1u << (bits - 1);
+    return (int32_t)((imm ^ sign) - sign);
+}
+
+/* 按照基本指令格式组装 32 位指令 */
+
+static inline riscv_word_t rvc_enc_i(riscv_word_t opcode, riscv_word_t rd, riscv_word_t funct3, riscv_word_t rs1, int32_t imm) {
+    return ((riscv_word_t)(imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static inline riscv_word_t rvc_enc_s(riscv_word_t opcode, riscv_word_t funct3, riscv_word_t rs1, riscv_word_t rs2, int32_t imm) {
+    return ((riscv_word_t)((imm >> 5) & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((riscv_word_t)(imm & 0x1F) << 7) | opcode;
+}
+
+static inline riscv_word_t rvc_enc_r(riscv_word_t opcode, riscv_word_t rd, riscv_word_t funct3, riscv_word_t rs1, riscv_word_t rs2, riscv_word_t funct7) {
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static inline riscv_word_t rvc_enc_b(riscv_word_t funct3, riscv_word_t rs1, riscv_word_t rs2, int32_t imm) {
+    riscv_word_t u = (riscv_word_t)imm;
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12)
+         | (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7) | OP_BEQ;
+}
+
+static inline riscv_word_t rvc_enc_j(riscv_word_t rd, int32_t imm) {
+    riscv_word_t u = (riscv_word_t)imm;
+    return (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3FF) << 21) | (((u >> 11) & 1) << 20) | (((u >> 12) & 0xFF) << 12)
+         | (rd << 7) | OP_JAL;
+}
+
+// 压缩指令中浮点访存对应的 32 位 opcode
+#define RVC_OP_LOAD_FP      0b0000111
+#define RVC_OP_STORE_FP     0b0100111
+
+// 展开一条 16 位压缩指令 非法编码返回 0 (全零在 32 位下同样是非法指令)
+static inline riscv_word_t rvc_expand(riscv_word_t c) {
+    riscv_word_t funct3 = rvc_bits(c, 15, 13);
+
+    switch (c & 0b11) {
+    case RVC_OP_Q0: {
+        riscv_word_t rd = rvc_reg(c, 2);
+        riscv_word_t rs1 = rvc_reg(c, 7);
+
+        // c.lw / c.sw: uimm[5:3] = c[12:10], uimm[2] = c[6], uimm[6] = c[5]
+        int32_t word_off = (rvc_bits(c, 12, 10) << 3) | (rvc_bits(c, 6, 6) << 2) | (rvc_bits(c, 5, 5) << 6);
+        // c.fld / c.fsd: uimm[5:3] = c[12:10], uimm[7:6] = c[6:5]
+        int32_t dword_off = (rvc_bits(c, 12, 10) << 3) | (rvc_bits(c, 6, 5) << 6);
+
+        switch (funct3) {
+        case 0b000: {
+            // c.addi4spn: nzuimm[5:4|9:6|2|3] = c[12:5]
+            int32_t imm = (rvc_bits(c, 12, 11) << 4) | (rvc_bits(c, 10, 7) << 6) | (rvc_bits(c, 6, 6) << 2) | (rvc_bits(c, 5, 5) << 3);
+            if (imm == 0) {
+                return 0;
+            }
+            return rvc_enc_i(OP_ADDI, rd, FUNC3_ADDI, 2, imm);
+        }
+        case 0b001:     // c.fld
+            return rvc_enc_i(RVC_OP_LOAD_FP, rd, 0b011, rs1, dword_off);
+        case 0b010:     // c.lw
+            return rvc_enc_i(OP_LW, rd, FUNC3_LW, rs1, word_off);
+#if RISCV_XLEN == 64
+        case 0b011:     // c.ld
+            return rvc_enc_i(OP_LD, rd, FUNC3_LD, rs1, dword_off);
+#else
+        case 0b011:     // c.flw
+            return rvc_enc_i(RVC_OP_LOAD_FP, rd, 0b010, rs1, word_off);
+#endif
+        case 0b101:     // c.fsd
+            return rvc_enc_s(RVC_OP_STORE_FP, 0b011, rs1, rd, dword_off);
+        case 0b110:     // c.sw
+            return rvc_enc_s(OP_SW, FUNC3_SW, rs1, rd, word_off);
+#if RISCV_XLEN == 64
+        case 0b111:     // c.sd
+            return rvc_enc_s(OP_SD, FUNC3_SD, rs1, rd, dword_off);
+#else
+        case 0b111:     // c.fsw
+            return rvc_enc_s(RVC_OP_STORE_FP, 0b010, rs1, rd, word_off);
+#endif
+        default:
+            return 0;
+        }
+    }
+
+    case RVC_OP_Q1: {
+        riscv_word_t rd = rvc_bits(c, 11, 7);
+        // c.addi / c.li / c.andi 等使用的 6 位立即数: imm[5] = c[12], imm[4:0] = c[6:2]
+        int32_t imm6 = rvc_sext((rvc_bits(c, 12, 12) << 5) | rvc_bits(c, 6, 2), 6);
+        // c.j / c.jal: offset[11|4|9:8|10|6|7|3:1|5] = c[12:2]
+        int32_t j_off = rvc_sext((rvc_bits(c, 12, 12) << 11) | (rvc_bits(c, 11, 11) << 4) | (rvc_bits(c, 10, 9) << 8)
+                               | (rvc_bits(c, 8, 8) << 10) | (rvc_bits(c, 7, 7) << 6) | (rvc_bits(c, 6, 6) << 7)
+                               | (rvc_bits(c, 5, 3) << 1) | (rvc_bits(c, 2, 2) << 5), 12);
+        // c.beqz / c.bnez: offset[8|4:3] = c[12:10], offset[7:6|2:1|5] = c[6:2]
+        int32_t b_off = rvc_sext((rvc_bits(c, 12, 12) << 8) | (rvc_bits(c, 11, 10) << 3) | (rvc_bits(c, 6, 5) << 6)
+                               | (rvc_bits(c, 4, 3) << 1) | (rvc_bits(c, 2, 2) << 5), 9);
+
+        switch (funct3) {
+        case 0b000:     // c.addi (rd == 0 时为 c.nop)
+            return rvc_enc_i(OP_ADDI, rd, FUNC3_ADDI, rd, imm6);
+#if RISCV_XLEN == 64
+        case 0b001:     // c.addiw  rd 不能为 0
+            return (rd == 0) ? 0 : rvc_enc_i(OP_IMM_32, rd, FUNC3_ADDI, rd, imm6);
+#else
+        case 0b001:     // c.jal (RV32)
+            return rvc_enc_j(1, j_off);
+#endif
+        case 0b010:     // c.li
+            return rvc_enc_i(OP_ADDI, rd, FUNC3_ADDI, 0, imm6);
+        case 0b011: {
+            if (rd == 2) {
+                // c.addi16sp: nzimm[9] = c[12], nzimm[4|6|8:7|5] = c[6:2]
+                int32_t imm = rvc_sext((rvc_bits(c, 12, 12) << 9) | (rvc_bits(c, 6, 6) << 4) | (rvc_bits(c, 5, 5) << 6)
+                                     | (rvc_bits(c, 4, 3) << 7) | (rvc_bits(c, 2, 2) << 5), 10);
+                if (imm == 0) {
+                    return 0;
+                }
+                return rvc_enc_i(OP_ADDI, 2, FUNC3_ADDI, 2, imm);
+            }
+            // c.lui: nzimm[17] = c[12], nzimm[16:12] = c[6:2]
+            if (imm6 == 0) {
+                return 0;
+            }
+            return ((uint32_t)imm6 << 12) | (rd << 7) | OP_LUI;
+        }
+        case 0b100: {
+            riscv_word_t rd_p = rvc_reg(c, 7);
+            riscv_word_t rs2_p = rvc_reg(c, 2);
+            riscv_word_t shamt = rvc_bits(c, 6, 2);
+            // RV32 要求 shamt[5] 为 0  RV64 上 c[12] 是 shamt[5]
+            int shamt_bad = (RISCV_XLEN == 32) && rvc_bits(c, 12, 12);
+            shamt |= (RISCV_XLEN == 64) ? (rvc_bits(c, 12, 12) << 5) : 0;
+
+            switch (rvc_bits(c, 11, 10)) {
+            case 0b00:  // c.srli
+                return shamt_bad ? 0 : rvc_enc_i(OP_SRLI, rd_p, FUNC3_SR, rd_p, shamt);
+            case 0b01:  // c.srai
+                return shamt_bad ? 0 : rvc_enc_i(OP_SRAI, rd_p, FUNC3_SR, rd_p, shamt | (FUNC7_SRA << 5));
+            case 0b10:  // c.andi
+                return rvc_enc_i(OP_ANDI, rd_p, FUNC3_ANDI, rd_p, imm6);
+            default:
+                if (rvc_bits(c, 12, 12)) {
+#if RISCV_XLEN == 64
+                    switch (rvc_bits(c, 6, 5)) {
+                    case 0b00:  // c.subw
+                        return rvc_enc_r(OP_32, rd_p, FUNC3_ADD, rd_p, rs2_p, FUNC7_SUB);
+                    case 0b01:  // c.addw
+                        return rvc_enc_r(OP_32, rd_p, FUNC3_ADD, rd_p, rs2_p, FUNC7_ADD);
+                    default:
+                        return 0;
+                    }
+#else
+                    return 0;   // c.subw / c.addw 只存在于 RV64
+#endif
+                }
+                switch (rvc_bits(c, 6, 5)) {
+                case 0b00:
+                    return rvc_enc_r(OP_SUB, rd_p, FUNC3_SUB, rd_p, rs2_p, FUNC7_SUB);
+                case 0b01:
+                    return rvc_enc_r(OP_XOR, rd_p, FUNC3_XOR, rd_p, rs2_p, FUNC7_ADD);
+                case 0b10:
+                    return rvc_enc_r(OP_OR, rd_p, FUNC3_OR, rd_p, rs2_p, FUNC7_ADD);
+                default:
+                    return rvc_enc_r(OP_AND, rd_p, FUNC3_AND, rd_p, rs2_p, FUNC7_ADD);
+                }
+            }
+        }
+        case 0b101:     // c.j
+            return rvc_enc_j(0, j_off);
+        case 0b110:     // c.beqz
+            return rvc_enc_b(FUNC3_BEQ, rvc_reg(c, 7), 0, b_off);
+        default:        // c.bnez
+            return rvc_enc_b(FUNC3_BNE, rvc_reg(c, 7), 0, b_off);
+        }
+    }
+
+    case RVC_OP_Q2: {
+        riscv_word_t rd = rvc_bits(c, 11, 7);
+        riscv_word_t rs2 = rvc_bits(c, 6, 2);
+
+        // c.lwsp: uimm[5] = c[12], uimm[4:2|7:6] = c[6:2]
+        int32_t lwsp_off = (rvc_bits(c, 12, 12) << 5) | (rvc_bits(c, 6, 4) << 2) | (rvc_bits(c, 3, 2) << 6);
+        // c.fldsp: uimm[5] = c[12], uimm[4:3|8:6] = c[6:2]
+        int32_t ldsp_off = (rvc_bits(c, 12, 12) << 5) | (rvc_bits(c, 6, 5) << 3) | (rvc_bits(c, 4, 2) << 6);
+        // c.swsp: uimm[5:2|7:6] = c[12:7]
+        int32_t swsp_off = (rvc_bits(c, 12, 9) << 2) | (rvc_bits(c, 8, 7) << 6);
+        // c.fsdsp: uimm[5:3|8:6] = c[12:7]
+        int32_t sdsp_off = (rvc_bits(c, 12, 10) << 3) | (rvc_bits(c, 9, 7) << 6);
+
+        switch (funct3) {
+        case 0b000:     // c.slli   RV64 上 c[12] 是 shamt[5]
+            if (RISCV_XLEN == 32) {
+                return rvc_bits(c, 12, 12) ? 0 : rvc_enc_i(OP_SLLI, rd, FUNC3_SLLI, rd, rs2);
+            }
+            return rvc_enc_i(OP_SLLI, rd, FUNC3_SLLI, rd, rs2 | (rvc_bits(c, 12, 12) << 5));
+        case 0b001:     // c.fldsp
+            return rvc_enc_i(RVC_OP_LOAD_FP, rd, 0b011, 2, ldsp_off);
+        case 0b010:     // c.lwsp
+            return (rd == 0) ? 0 : rvc_enc_i(OP_LW, rd, FUNC3_LW, 2, lwsp_off);
+#if RISCV_XLEN == 64
+        case 0b011:     // c.ldsp
+            return (rd == 0) ? 0 : rvc_enc_i(OP_LD, rd, FUNC3_LD, 2, ldsp_off);
+#else
+        case 0b011:     // c.flwsp
+            return rvc_enc_i(RVC_OP_LOAD_FP, rd, 0b010, 2, lwsp_off);
+#endif
+        case 0b100: {
+            if (rvc_bits(c, 12, 12) == 0) {
+                if (rs2 == 0) {
+                    // c.jr
+                    return (rd == 0) ? 0 : rvc_enc_i(OP_JALR, 0, 0, rd, 0);
+                }
+                // c.mv
+                return rvc_enc_r(OP_ADD, rd, FUNC3_ADD, 0, rs2, FUNC7_ADD);
+            }
+            if ((rd == 0) && (rs2 == 0)) {
+                return EBREAK;  // c.ebreak
+            }
+            if (rs2 == 0) {
+                // c.jalr
+                return rvc_enc_i(OP_JALR, 1, 0, rd, 0);
+            }
+            // c.add
+            return rvc_enc_r(OP_ADD, rd, FUNC3_ADD, rd, rs2, FUNC7_ADD);
+        }
+        case 0b101:     // c.fsdsp
+            return rvc_enc_s(RVC_OP_STORE_FP, 0b011, 2, rs2, sdsp_off);
+        case 0b110:     // c.swsp
+            return rvc_enc_s(OP_SW, FUNC3_SW, 2, rs2, swsp_off);
+#if RISCV_XLEN == 64
+        default:        // c.sdsp
+            return rvc_enc_s(OP_SD, FUNC3_SD, 2, rs2, sdsp_off);
+#else
+        default:        // c.fswsp
+            return rvc_enc_s(RVC_OP_STORE_FP, 0b010, 2, rs2, swsp_off);
+#endif
+        }
+    }
+
+    default:
+        return 0;
+    }
+}
+
+#endif /* RVC_H */
@@ -0,0 +1,383 @@
+#include "rvv.h"
+#include "plat/plat.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RVV_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RVV_TARGET_SSE2
+#define RVV_TARGET_AVX2
+#else
+#include <cpuid.h>
+// 不要求整个工程用 -mavx2 编译 只对单个函数打开指令集
+#define RVV_TARGET_SSE2 __attribute__((target("sse2")))
+#define RVV_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// 标量实现 同时用于处理 SIMD 实现剩余的尾部元素
+#define RVV_SCALAR_BINOP(name, type, op)                                                    \
+static void name(uint8_t* vd, const uint8_t* vs2, const uint8_t* vs1, int n) {              \
+    type* d = (type*)vd;                                                                    \
+    const type* a = (const type*)vs2;                                                       \
+    const type* b = (const type*)vs1;                                                       \
+    for (int i = 0; i < n; i++) {                                                           \
+        d[i] = (type)(a[i] op b[i]);                                                        \
+    }                                                                                       \
+}
+
+#define RVV_SCALAR_REDOP(name, type, op)                                                    \
+static riscv_word_t name(const uint8_t* vs2, riscv_word_t init, int n) {                    \
+    type acc = (type)init;                                                                  \
+    const type* a = (const type*)vs2;                                                       \
+    for (int i = 0; i < n; i++) {                                                           \
+        acc = (type)(acc op a[i]);                                                          \
+    }                                                                                       \
+    return acc;                                                                             \
+}
+
+RVV_SCALAR_BINOP(scalar_add8, uint8_t, +)
+RVV_SCALAR_BINOP(scalar_add16, uint16_t, +)
+RVV_SCALAR_BINOP(scalar_add32, uint32_t, +)
+RVV_SCALAR_BINOP(scalar_sub8, uint8_t, -)
+RVV_SCALAR_BINOP(scalar_sub16, uint16_t, -)
+RVV_SCALAR_BINOP(scalar_sub32, uint32_t, -)
+RVV_SCALAR_BINOP(scalar_mul8, uint8_t, *)
+RVV_SCALAR_BINOP(scalar_mul16, uint16_t, *)
+RVV_SCALAR_BINOP(scalar_mul32, uint32_t, *)
+RVV_SCALAR_BINOP(scalar_and8, uint8_t, &)
+RVV_SCALAR_BINOP(scalar_and16, uint16_t, &)
+RVV_SCALAR_BINOP(scalar_and32, uint32_t, &)
+RVV_SCALAR_BINOP(scalar_or8, uint8_t, |)
+RVV_SCALAR_BINOP(scalar_or16, uint16_t, |)
+RVV_SCALAR_BINOP(scalar_or32, uint32_t, |)
+RVV_SCALAR_BINOP(scalar_xor8, uint8_t, ^)
+RVV_SCALAR_BINOP(scalar_xor16, uint16_t, ^)
+RVV_SCALAR_BINOP(scalar_xor32, uint32_t, ^)
+
+RVV_SCALAR_REDOP(scalar_redsum8, uint8_t, +)
+RVV_SCALAR_REDOP(scalar_redsum16, uint16_t, +)
+RVV_SCALAR_REDOP(scalar_redsum32, uint32_t, +)
+RVV_SCALAR_REDOP(scalar_redand8, uint8_t, &)
+RVV_SCALAR_REDOP(scalar_redand16, uint16_t, &)
+RVV_SCALAR_REDOP(scalar_redand32, uint32_t, &)
+RVV_SCALAR_REDOP(scalar_redor8, uint8_t, |)
+RVV_SCALAR_REDOP(scalar_redor16, uint16_t, |)
+RVV_SCALAR_REDOP(scalar_redor32, uint32_t, |)
+RVV_SCALAR_REDOP(scalar_redxor8, uint8_t, ^)
+RVV_SCALAR_REDOP(scalar_redxor16, uint16_t, ^)
+RVV_SCALAR_REDOP(scalar_redxor32, uint32_t, ^)
+
+static void rvv_fill_scalar(rvv_kernels_t* k) {
+    k->name = "scalar";
+
+    k->binop[RVV_OP_ADD][0] = scalar_add8;
+    k->binop[RVV_OP_ADD][1] = scalar_add16;
+    k->binop[RVV_OP_ADD][2] = scalar_add32;
+    k->binop[RVV_OP_SUB][0] = scalar_sub8;
+    k->binop[RVV_OP_SUB][1] = scalar_sub16;
+    k->binop[RVV_OP_SUB][2] = scalar_sub32;
+    k->binop[RVV_OP_MUL][0] = scalar_mul8;
+    k->binop[RVV_OP_MUL][1] = scalar_mul16;
+    k->binop[RVV_OP_MUL][2] = scalar_mul32;
+    k->binop[RVV_OP_AND][0] = scalar_and8;
+    k->binop[RVV_OP_AND][1] = scalar_and16;
+    k->binop[RVV_OP_AND][2] = scalar_and32;
+    k->binop[RVV_OP_OR][0] = scalar_or8;
+    k->binop[RVV_OP_OR][1] = scalar_or16;
+    k->binop[RVV_OP_OR][2] = scalar_or32;
+    k->binop[RVV_OP_XOR][0] = scalar_xor8;
+    k->binop[RVV_OP_XOR][1] = scalar_xor16;
+    k->binop[RVV_OP_XOR][2] = scalar_xor32;
+
+    k->redop[RVV_OP_ADD][0] = scalar_redsum8;
+    k->redop[RVV_OP_ADD][1] = scalar_redsum16;
+    k->redop[RVV_OP_ADD][2] = scalar_redsum32;
+    k->redop[RVV_OP_AND][0] = scalar_redand8;
+    k->redop[RVV_OP_AND][1] = scalar_redand16;
+    k->redop[RVV_OP_AND][2] = scalar_redand32;
+    k->redop[RVV_OP_OR][0] = scalar_redor8;
+    k->redop[RVV_OP_OR][1] = scalar_redor16;
+    k->redop[RVV_OP_OR][2] = scalar_redor32;
+    k->redop[RVV_OP_XOR][0] = scalar_redxor8;
+    k->redop[RVV_OP_XOR][1] = scalar_redxor16;
+    k->redop[RVV_OP_XOR][2] = scalar_redxor32;
+}
+
+#ifdef RVV_X86
+
+// 整块部分用 SIMD 处理 不足一个向量宽度的尾部交给标量实现
+#define RVV_SSE2_BINOP(name, intrin, tail, size)                                            \
+static RVV_TARGET_SSE2 void name(uint8_t* vd, const uint8_t* vs2, const uint8_t* vs1, int n) { \
+    int bytes = n * size;                                                                   \
+    int i = 0;                                                                              \
+    for (; i + 16 <= bytes; i += 16) {                                                      \
+        __m128i a = _mm_loadu_si128((const __m128i*)(vs2 + i));                             \
+        __m128i b = _mm_loadu_si128((const __m128i*)(vs1 + i));                             \
+        _mm_storeu_si128((__m128i*)(vd + i), intrin(a, b));                                 \
+    }                                                                                       \
+    tail(vd + i, vs2 + i, vs1 + i, (bytes - i) / size);                                     \
+}
+
+// 运算满足交换律和结合律: 先按 lane 累积 再把各个 lane 与尾部交给标量实现合并
+#define RVV_SSE2_REDOP(name, intrin, tail, size)                                            \
+static RVV_TARGET_SSE2 riscv_word_t name(const uint8_t* vs2, riscv_word_t init, int n) {    \
+    int bytes = n * size;                                                                   \
+    int i = 0;                                                                              \
+    if (bytes >= 16) {                                                                      \
+        __m128i acc = _mm_loadu_si128((const __m128i*)vs2);                                 \
+        for (i = 16; i + 16 <= bytes; i += 16) {                                            \
+            acc = intrin(acc, _mm_loadu_si128((const __m128i*)(vs2 + i)));                  \
+        }                                                                                   \
+        uint8_t lanes[16];                                                                  \
+        _mm_storeu_si128((__m128i*)lanes, acc);                                             \
+        init = tail(lanes, init, 16 / size);                                                \
+    }                                                                                       \
+    return tail(vs2 + i, init, (bytes - i) / size);                                         \
+}
+
+#define RVV_AVX2_BINOP(name, intrin, tail, size)                                            \
+static RVV_TARGET_AVX2 void name(uint8_t* vd, const uint8_t* vs2, const uint8_t* vs1, int n) { \
+    int bytes = n * size;                                                                   \
+    int i = 0;                                                                              \
+    for (; i + 32 <= bytes; i += 32) {                                                      \
+        __m256i a = _mm256_loadu_si256((const __m256i*)(vs2 + i));                          \
+        __m256i b = _mm256_loadu_si256((const __m256i*)(vs1 + i));                          \
+        _mm256_storeu_si256((__m256i*)(vd + i), intrin(a, b));                              \
+    }                                                                                       \
+    tail(vd + i, vs2 + i, vs1 + i, (bytes - i) / size);                                     \
+}
+
+#define RVV_AVX2_REDOP(name, intrin, tail, size)                                            \
+static RVV_TARGET_AVX2 riscv_word_t name(const uint8_t* vs2, riscv_word_t init, int n) {    \
+    int bytes = n * size;                                                                   \
+    int i = 0;                                                                              \
+    if (bytes >= 32) {                                                                      \
+        __m256i acc = _mm256_loadu_si256((const __m256i*)vs2);                              \
+        for (i = 32; i + 32 <= bytes; i += 32) {                                            \
+            acc = intrin(acc, _mm256_loadu_si256((const __m256i*)(vs2 + i)));               \
+        }                                                                                   \
+        uint8_t lanes[32];                                                                  \
+        _mm256_storeu_si256((__m256i*)lanes, acc);                                          \
+        init = tail(lanes, init, 32 / size);                                                \
+    }                                                                                       \
+    return tail(vs2 + i, init, (bytes - i) / size);                                         \
+}
+
+// SSE2 没有 8 位和 32 位的低位乘法 这两项保留标量实现
+RVV_SSE2_BINOP(sse2_add8, _mm_add_epi8, scalar_add8, 1)
+RVV_SSE2_BINOP(sse2_add16, _mm_add_epi16, scalar_add16, 2)
+RVV_SSE2_BINOP(sse2_add32, _mm_add_epi32, scalar_add32, 4)
+RVV_SSE2_BINOP(sse2_sub8, _mm_sub_epi8, scalar_sub8, 1)
+RVV_SSE2_BINOP(sse2_sub16, _mm_sub_epi16, scalar_sub16, 2)
+RVV_SSE2_BINOP(sse2_sub32, _mm_sub_epi32, scalar_sub32, 4)
+RVV_SSE2_BINOP(sse2_mul16, _mm_mullo_epi16, scalar_mul16, 2)
+RVV_SSE2_BINOP(sse2_and8, _mm_and_si128, scalar_and8, 1)
+RVV_SSE2_BINOP(sse2_and16, _mm_and_si128, scalar_and16, 2)
+RVV_SSE2_BINOP(sse2_and32, _mm_and_si128, scalar_and32, 4)
+RVV_SSE2_BINOP(sse2_or8, _mm_or_si128, scalar_or8, 1)
+RVV_SSE2_BINOP(sse2_or16, _mm_or_si128, scalar_or16, 2)
+RVV_SSE2_BINOP(sse2_or32, _mm_or_si128, scalar_or32, 4)
+RVV_SSE2_BINOP(sse2_xor8, _mm_xor_si128, scalar_xor8, 1)
+RVV_SSE2_BINOP(sse2_xor16, _mm_xor_si128, scalar_xor16, 2)
+RVV_SSE2_BINOP(sse2_xor32, _mm_xor_si128, scalar_xor32, 4)
+
+RVV_SSE2_REDOP(sse2_redsum8, _mm_add_epi8, scalar_redsum8, 1)
+RVV_SSE2_REDOP(sse2_redsum16, _mm_add_epi16, scalar_redsum16, 2)
+RVV_SSE2_REDOP(sse2_redsum32, _mm_add_epi32, scalar_redsum32, 4)
+RVV_SSE2_REDOP(sse2_redand8, _mm_and_si128, scalar_redand8, 1)
+RVV_SSE2_REDOP(sse2_redand16, _mm_and_si128, scalar_redand16, 2)
+RVV_SSE2_REDOP(sse2_redand32, _mm_and_si128, scalar_redand32, 4)
+RVV_SSE2_REDOP(sse2_redor8, _mm_or_si128, scalar_redor8, 1)
+RVV_SSE2_REDOP(sse2_redor16, _mm_or_si128, scalar_redor16, 2)
+RVV_SSE2_REDOP(sse2_redor32, _mm_or_si128, scalar_redor32, 4)
+RVV_SSE2_REDOP(sse2_redxor8, _mm_xor_si128, scalar_redxor8, 1)
+RVV_SSE2_REDOP(sse2_redxor16, _mm_xor_si128, scalar_redxor16, 2)
+RVV_SSE2_REDOP(sse2_redxor32, _mm_xor_si128, scalar_redxor32, 4)
+
+// AVX2 同样没有 8 位乘法
+RVV_AVX2_BINOP(avx2_add8, _mm256_add_epi8, scalar_add8, 1)
+RVV_AVX2_BINOP(avx2_add16, _mm256_add_epi16, scalar_add16, 2)
+RVV_AVX2_BINOP(avx2_add32, _mm256_add_epi32, scalar_add32, 4)
+RVV_AVX2_BINOP(avx2_sub8, _mm256_sub_epi8, scalar_sub8, 1)
+RVV_AVX2_BINOP(avx2_sub16, _mm256_sub_epi16, scalar_sub16, 2)
+RVV_AVX2_BINOP(avx2_sub32, _mm256_sub_epi32, scalar_sub32, 4)
+RVV_AVX2_BINOP(avx2_mul16, _mm256_mullo_epi16, scalar_mul16, 2)
+RVV_AVX2_BINOP(avx2_mul32, _mm256_mullo_epi32, scalar_mul32, 4)
+RVV_AVX2_BINOP(avx2_and8, _mm256_and_si256, scalar_and8, 1)
+RVV_AVX2_BINOP(avx2_and16, _mm256_and_si256, scalar_and16, 2)
+RVV_AVX2_BINOP(avx2_and32, _mm256_and_si256, scalar_and32, 4)
+RVV_AVX2_BINOP(avx2_or8, _mm256_or_si256, scalar_or8, 1)
+RVV_AVX2_BINOP(avx2_or16, _mm256_or_si256, scalar_or16, 2)
+RVV_AVX2_BINOP(avx2_or32, _mm256_or_si256, scalar_or32, 4)
+RVV_AVX2_BINOP(avx2_xor8, _mm256_xor_si256, scalar_xor8, 1)
+RVV_AVX2_BINOP(avx2_xor16, _mm256_xor_si256, scalar_xor16, 2)
+RVV_AVX2_BINOP(avx2_xor32, _mm256_xor_si256, scalar_xor32, 4)
+
+RVV_AVX2_REDOP(avx2_redsum8, _mm256_add_epi8, scalar_redsum8, 1)
+RVV_AVX2_REDOP(avx2_redsum16, _mm256_add_epi16, scalar_redsum16, 2)
+RVV_AVX2_REDOP(avx2_redsum32, _mm256_add_epi32, scalar_redsum32, 4)
+RVV_AVX2_REDOP(avx2_redand8, _mm256_and_si256, scalar_redand8, 1)
+RVV_AVX2_REDOP(avx2_redand16, _mm256_and_si256, scalar_redand16, 2)
+RVV_AVX2_REDOP(avx2_redand32, _mm256_and_si256, scalar_redand32, 4)
+RVV_AVX2_REDOP(avx2_redor8, _mm256_or_si256, scalar_redor8, 1)
+RVV_AVX2_REDOP(avx2_redor16, _mm256_or_si256, scalar_redor16, 2)
+RVV_AVX2_REDOP(avx2_redor32, _mm256_or_si256, scalar_redor32, 4)
+RVV_AVX2_REDOP(avx2_redxor8, _mm256_xor_si256, scalar_redxor8, 1)
+RVV_AVX2_REDOP(avx2_redxor16, _mm256_xor_si256, scalar_redxor16, 2)
+RVV_AVX2_REDOP(avx2_redxor32, _mm256_xor_si256, scalar_redxor32, 4)
+
+static void rvv_fill_sse2(rvv_kernels_t* k) {
+    k->name = "sse2";
+
+    k->binop[RVV_OP_ADD][0] = sse2_add8;
+    k->binop[RVV_OP_ADD][1] = sse2_add16;
+    k->binop[RVV_OP_ADD][2] = sse2_add32;
+    k->binop[RVV_OP_SUB][0] = sse2_sub8;
+    k->binop[RVV_OP_SUB][1] = sse2_sub16;
+    k->binop[RVV_OP_SUB][2] = sse2_sub32;
+    k->binop[RVV_OP_MUL][1] = sse2_mul16;
+
+    k->binop[RVV_OP_AND][0] = sse2_and8;
+    k->binop[RVV_OP_AND][1] = sse2_and16;
+    k->binop[RVV_OP_AND][2] = sse2_and32;
+    k->binop[RVV_OP_OR][0] = sse2_or8;
+    k->binop[RVV_OP_OR][1] = sse2_or16;
+    k->binop[RVV_OP_OR][2] = sse2_or32;
+    k->binop[RVV_OP_XOR][0] = sse2_xor8;
+    k->binop[RVV_OP_XOR][1] = sse2_xor16;
+    k->binop[RVV_OP_XOR][2] = sse2_xor32;
+
+    k->redop[RVV_OP_ADD][0] = sse2_redsum8;
+    k->redop[RVV_OP_ADD][1] = sse2_redsum16;
+    k->redop[RVV_OP_ADD][2] = sse2_redsum32;
+    k->redop[RVV_OP_AND][0] = sse2_redand8;
+    k->redop[RVV_OP_AND][1] = sse2_redand16;
+    k->redop[RVV_OP_AND][2] = sse2_redand32;
+    k->redop[RVV_OP_OR][0] = sse2_redor8;
+    k->redop[RVV_OP_OR][1] = sse2_redor16;
+    k->redop[RVV_OP_OR][2] = sse2_redor32;
+    k->redop[RVV_OP_XOR][0] = sse2_redxor8;
+    k->redop[RVV_OP_XOR][1] = sse2_redxor16;
+    k->redop[RVV_OP_XOR][2] = sse2_redxor32;
+}
+
+static void rvv_fill_avx2(rvv_kernels_t* k) {
+    k->name = "avx2";
+
+    k->binop[RVV_OP_ADD][0] = avx2_add8;
+    k->binop[RVV_OP_ADD][1] = avx2_add16;
+    k->binop[RVV_OP_ADD][2] = avx2_add32;
+    k->binop[RVV_OP_SUB][0] = avx2_sub8;
+    k->binop[RVV_OP_SUB][1] = avx2_sub16;
+    k->binop[RVV_OP_SUB][2] = avx2_sub32;
+    k->binop[RVV_OP_MUL][1] = avx2_mul16;
+    k->binop[RVV_OP_MUL][2] = avx2_mul32;
+
+    k->binop[RVV_OP_AND][0] = avx2_and8;
+    k->binop[RVV_OP_AND][1] = avx2_and16;
+    k->binop[RVV_OP_AND][2] = avx2_and32;
+    k->binop[RVV_OP_OR][0] = avx2_or8;
+    k->binop[RVV_OP_OR][1] = avx2_or16;
+    k->binop[RVV_OP_OR][2] = avx2_or32;
+    k->binop[RVV_OP_XOR][0] = avx2_xor8;
+    k->binop[RVV_OP_XOR][1] = avx2_xor16;
+    k->binop[RVV_OP_XOR][2] = avx2_xor32;
+
+    k->redop[RVV_OP_ADD][0] = avx2_redsum8;
+    k->redop[RVV_OP_ADD][1] = avx2_redsum16;
+    k->redop[RVV_OP_ADD][2] = avx2_redsum32;
+    k->redop[RVV_OP_AND][0] = avx2_redand8;
+    k->redop[RVV_OP_AND][1] = avx2_redand16;
+    k->redop[RVV_OP_AND][2] = avx2_redand32;
+    k->redop[RVV_OP_OR][0] = avx2_redor8;
+    k->redop[RVV_OP_OR][1] = avx2_redor16;
+    k->redop[RVV_OP_OR][2] = avx2_redor32;
+    k->redop[RVV_OP_XOR][0] = avx2_redxor8;
+    k->redop[RVV_OP_XOR][1] = avx2_redxor16;
+    k->redop[RVV_OP_XOR][2] = avx2_redxor32;
+}
+
+static void rvv_cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static int rvv_has_sse2(void) {
+    uint32_t regs[4];
+    rvv_cpuid(1, 0, regs);
+    return (regs[3] >> 26) & 1;
+}
+
+// 除了 CPUID 的 AVX2 位 还要确认操作系统会保存 YMM 寄存器
+static int rvv_has_avx2(void) {
+    uint32_t regs[4];
+    rvv_cpuid(0, 0, regs);
+    if (regs[0] < 7) {
+        return 0;
+    }
+
+    rvv_cpuid(1, 0, regs);
+    int osxsave = (regs[2] >> 27) & 1;
+    int avx = (regs[2] >> 28) & 1;
+    if (!osxsave || !avx) {
+        return 0;
+    }
+
+#ifdef _MSC_VER
+    uint64_t xcr0 = _xgetbv(0);
+#else
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    uint64_t xcr0 = ((uint64_t)xcr0_hi << 32) | xcr0_lo;
+#endif
+    if ((xcr0 & 0x6) != 0x6) {
+        return 0;
+    }
+
+    rvv_cpuid(7, 0, regs);
+    return (regs[1] >> 5) & 1;
+}
+
+#endif /* RVV_X86 */
+
+// 只选择一次: 0 未开始 1 正在选择 2 已完成
+// 多个 hart 或测试线程可能同时创建实例 由抢到状态的线程填写 其它线程等它完成后再使用
+const rvv_kernels_t* rvv_kernels(void) {
+    static rvv_kernels_t kernels;
+    static volatile uint32_t state = 0;
+    if (atomic_load_u32(&state) == 2) {
+        return &kernels;
+    }
+    if (!atomic_cas_u32(&state, 0, 1)) {
+        // 填表只需要几次 CPUID 直接等待
+        while (atomic_load_u32(&state) != 2) {
+        }
+        return &kernels;
+    }
+
+    // 先填满标量实现 再用宿主机支持的 SIMD 实现覆盖
+    rvv_fill_scalar(&kernels);
+
+#ifdef RVV_X86
+    const char* limit = getenv("RISCV_SIM_SIMD");
+    int allow_sse2 = (limit == NULL) || strcmp(limit, "scalar");
+    int allow_avx2 = allow_sse2 && ((limit == NULL) || strcmp(limit, "sse2"));
+
+    if (allow_sse2 && rvv_has_sse2()) {
+        rvv_fill_sse2(&kernels);
+        if (allow_avx2 && rvv_has_avx2()) {
+            rvv_fill_avx2(&kernels);
+        }
+    }
+#endif
+
+    atomic_store_u32(&state, 2);
+    return &kernels;
+}
@@ -0,0 +1,46 @@
+#ifndef RVV_H
+#define RVV_H
+
+#include "types.h"
+
+// V-Extension 子集: vsetvli/vsetivli/vsetvl  单位步长 load/store  整数加减乘与逻辑运算  归约  vmv
+// 只支持不带掩码的形式  尾部元素保持不变(tail undisturbed)
+// 运算核心直接作用在向量寄存器组上 按 CPUID 在运行时选择 AVX2/SSE2/标量实现
+
+#define RISCV_VLEN          256
+#define RISCV_VLENB         (RISCV_VLEN / 8)
+#define RISCV_ELEN          32
+
+#define RVV_VILL            ((riscv_word_t)1 << (RISCV_XLEN - 1))     // vtype 不合法时只置最高位
+#define RVV_LMUL_MAX        8
+
+// 运算核心按元素宽度区分 下标 0/1/2 对应 SEW = 8/16/32
+#define RVV_SEW_NUM         3
+
+typedef enum _rvv_op_t {
+    RVV_OP_ADD,
+    RVV_OP_SUB,
+    RVV_OP_MUL,
+    RVV_OP_AND,
+    RVV_OP_OR,
+    RVV_OP_XOR,
+    RVV_OP_NUM,
+}rvv_op_t;
+
+// vd[i] = vs2[i] op vs1[i]  共 n 个元素
+typedef void (*rvv_binop_t)(uint8_t* vd, const uint8_t* vs2, const uint8_t* vs1, int n);
+
+// 返回 init op vs2[0] op ... op vs2[n-1]  结果按元素宽度截断
+typedef riscv_word_t (*rvv_redop_t)(const uint8_t* vs2, riscv_word_t init, int n);
+
+typedef struct _rvv_kernels_t {
+    const char* name;
+    rvv_binop_t binop[RVV_OP_NUM][RVV_SEW_NUM];
+    rvv_redop_t redop[RVV_OP_NUM][RVV_SEW_NUM];     // 没有 vredsub/vredmul  对应项为 NULL
+}rvv_kernels_t;
+
+// 第一次调用时检测宿主机支持的指令集 之后返回同一张表  可以在多个线程中同时调用
+// 环境变量 RISCV_SIM_SIMD=scalar/sse2 可以限制使用的最高指令集 便于对比各实现的结果
+const rvv_kernels_t* rvv_kernels(void);
+
+#endif /* RVV_H */
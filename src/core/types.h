@@ -2,10 +2,31 @@
 #define TYPES_H
 
 #include<stdint.h>
+#include<inttypes.h>
 
-// 方便后续调用 如果想修改到 64 位系统也只需要修改 types.h 文件 
+// 寄存器宽度在编译时选择 同一份源码分别编译出 rv32 和 rv64 两个模拟器
+// 构建系统通过 -DRISCV_XLEN=64 选择 64 位 默认 32 位  handler 中不再判断 XLEN
+#ifndef RISCV_XLEN
+#define RISCV_XLEN 32
+#endif
+
+#if RISCV_XLEN == 64
+typedef uint64_t riscv_word_t;
+typedef int64_t riscv_sword_t;             // 有符号运算 (比较/算术右移/除法) 使用
+#define PRIxWORD    PRIx64
+#define PRIuWORD    PRIu64
+#elif RISCV_XLEN == 32
 typedef uint32_t riscv_word_t;
+typedef int32_t riscv_sword_t;
+#define PRIxWORD    PRIx32
+#define PRIuWORD    PRIu32
+#else
+#error "RISCV_XLEN must be 32 or 64"
+#endif
+
+// 移位量只取低 log2(XLEN) 位
+#define RISCV_SHAMT_MASK    (RISCV_XLEN - 1)
 
-// #define riscv_word_t uint32_t    
+// #define riscv_word_t uint32_t
 
-#endif /* TYPES_H */
\ No newline at end of file
+#endif /* TYPES_H */
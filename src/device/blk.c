@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "blk.h"
+#include "core/riscv.h"
+
+#define BLK_CHUNK_SIZE          4           // 缓冲区不是普通存储器时 每次设备访问的字节数
+
+// 执行一次扇区传输  read 为 1 表示从镜像读到 guest 内存
+static riscv_word_t blk_transfer(blk_t* blk, int read) {
+    // 先按扇区数检查范围 乘法之后的字节数不会超过镜像大小
+    if ((blk->sector > blk->capacity) || (blk->count > blk->capacity - blk->sector)) {
+        fprintf(stderr, "blk: sector %" PRIuWORD " + %" PRIuWORD " out of range\n", blk->sector, blk->count);
+        return BLK_STATUS_ERROR;
+    }
+
+    uint64_t offset = (uint64_t)blk->sector * BLK_SECTOR_SIZE;
+    uint64_t bytes = (uint64_t)blk->count * BLK_SECTOR_SIZE;
+    riscv_word_t size = (riscv_word_t)bytes;
+    if ((bytes != size) || (size > (riscv_word_t)-1 - blk->buffer)) {
+        fprintf(stderr, "blk: buffer 0x%" PRIxWORD " + %llu bytes out of range\n", blk->buffer, (unsigned long long)bytes);
+        return BLK_STATUS_ERROR;
+    }
+    uint8_t* disk = blk->image.addr + offset;
+
+    // 缓冲区是物理地址  从镜像读出时 guest 缓冲区需要可写
+    uint8_t* guest = riscv_pmem_ptr(blk->riscv, blk->buffer, size, read ? RISCV_MEM_ATTR_WRITABLE : RISCV_MEM_ATTR_READABLE);
+    if (guest) {
+        if (read) {
+            memcpy(guest, disk, size);
+        } else {
+            memcpy(disk, guest, size);
+        }
+    }
+    else {
+        // 缓冲区不是普通存储器 (例如显存) 退化为按 4 字节的设备读写 寄存器类外设只接受这样的宽度
+        // 缓冲区不能落在自己的寄存器上 否则写命令寄存器会在传输中途再次触发传输
+        riscv_device_t* dev = &blk->riscv_dev;
+        if ((blk->buffer < dev->addr_end) && (blk->buffer + size > dev->addr_start)) {
+            return BLK_STATUS_ERROR;
+        }
+        for (riscv_word_t done = 0; done < size; done += BLK_CHUNK_SIZE) {
+            int rc = read ? riscv_pmem_write(blk->riscv, blk->buffer + done, disk + done, BLK_CHUNK_SIZE)
+                          : riscv_pmem_read(blk->riscv, blk->buffer + done, disk + done, BLK_CHUNK_SIZE);
+            if (rc < 0) {
+                return BLK_STATUS_ERROR;
+            }
+        }
+    }
+
+    if (!read && !blk->write_back) {
+        if (file_map_sync(&blk->image, (size_t)offset, size) < 0) {
+            return BLK_STATUS_ERROR;
+        }
+    }
+    return BLK_STATUS_OK;
+}
+
+// 中断为电平触发: 使能并且完成位没有清除时保持有效
+static void blk_update_irq(blk_t* blk) {
+    int level = (blk->irq_ctrl & BLK_IRQ_EN) && (blk->irq_ctrl & BLK_IRQ_DONE);
+    riscv_irq_set(blk->riscv, blk->irq, level);
+}
+
+static void blk_command(blk_t* blk, riscv_word_t cmd) {
+    switch (cmd) {
+    case BLK_CMD_READ:
+        blk->status = blk_transfer(blk, 1);
+        break;
+    case BLK_CMD_WRITE:
+        blk->status = blk_transfer(blk, 0);
+        break;
+    case BLK_CMD_FLUSH:
+        blk->status = (file_map_sync(&blk->image, 0, blk->image.size) < 0) ? BLK_STATUS_ERROR : BLK_STATUS_OK;
+        break;
+    default:
+        blk->status = BLK_STATUS_ERROR;
+        break;
+    }
+
+    // 传输是同步完成的 写命令寄存器之后立即挂起完成中断
+    blk->irq_ctrl |= BLK_IRQ_DONE;
+    blk_update_irq(blk);
+}
+
+static int blk_read(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    blk_t* blk = (blk_t*)dev;
+    riscv_word_t reg_val = 0;
+    if (width > (int)sizeof(reg_val)) {
+        return -1;
+    }
+
+    mutex_lock(&blk->lock);
+    switch (addr - dev->addr_start) {
+    case BLK_REG_SECTOR:
+        reg_val = blk->sector;
+        break;
+    case BLK_REG_BUFFER:
+        reg_val = blk->buffer;
+        break;
+    case BLK_REG_COUNT:
+        reg_val = blk->count;
+        break;
+    case BLK_REG_STATUS:
+        reg_val = blk->status;
+        break;
+    case BLK_REG_CAPACITY:
+        reg_val = blk->capacity;
+        break;
+    case BLK_REG_IRQ:
+        reg_val = blk->irq_ctrl;
+        break;
+    default:
+        break;
+    }
+    mutex_unlock(&blk->lock);
+
+    memcpy(val, &reg_val, width);
+    return 0;
+}
+
+static int blk_write(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    blk_t* blk = (blk_t*)dev;
+    riscv_word_t reg_val = 0;
+    if (width > (int)sizeof(reg_val)) {
+        return -1;
+    }
+    memcpy(&reg_val, val, width);
+
+    mutex_lock(&blk->lock);
+    switch (addr - dev->addr_start) {
+    case BLK_REG_SECTOR:
+        blk->sector = reg_val;
+        break;
+    case BLK_REG_BUFFER:
+        blk->buffer = reg_val;
+        break;
+    case BLK_REG_COUNT:
+        blk->count = reg_val;
+        break;
+    case BLK_REG_CMD:
+        blk_command(blk, reg_val);
+        break;
+    case BLK_REG_IRQ:
+        blk->irq_ctrl = (blk->irq_ctrl & ~(BLK_IRQ_EN | (reg_val & BLK_IRQ_DONE))) | (reg_val & BLK_IRQ_EN);
+        blk_update_irq(blk);
+        break;
+    default:
+        break;
+    }
+    mutex_unlock(&blk->lock);
+    return 0;
+}
+
+blk_t* blk_create(struct _riscv_t* riscv, const char* name, riscv_word_t start, int irq, const char* image_path, int write_back) {
+    blk_t* blk = (blk_t*)calloc(1, sizeof(blk_t));
+    if (blk == NULL) {
+        fprintf(stderr, "blk alloc failed\n");
+        return NULL;
+    }
+
+    if (file_map_open(&blk->image, image_path) < 0) {
+        fprintf(stderr, "unable to map disk image %s\n", image_path);
+        free(blk);
+        return NULL;
+    }
+
+    blk->riscv = riscv;
+    blk->irq = irq;
+    blk->capacity = (riscv_word_t)(blk->image.size / BLK_SECTOR_SIZE);
+    blk->write_back = write_back;
+
+    mutex_init(&blk->lock);
+
+    riscv_device_t* dev = (riscv_device_t*)blk;
+    device_init(dev, name, 0, start, BLK_REG_SIZE);
+    dev->read = blk_read;
+    dev->write = blk_write;
+    return blk;
+}
+
+void blk_destroy(blk_t* blk) {
+    file_map_close(&blk->image);
+    free(blk);
+}
@@ -0,0 +1,60 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include "device.h"
+#include "plat/plat.h"
+
+// 块存储设备: 磁盘镜像通过 mmap 映射到本机地址空间
+// guest 通过寄存器给出扇区号/缓冲区地址/扇区数 然后写命令寄存器触发传输
+// 传输直接在 guest 内存和映射页之间 memcpy 不经过中间缓冲区
+
+#define BLK_SECTOR_SIZE         512
+
+#define BLK_REG_SECTOR          0x00        // 起始扇区号
+#define BLK_REG_BUFFER          0x04        // guest 缓冲区地址
+#define BLK_REG_COUNT           0x08        // 扇区数
+#define BLK_REG_CMD             0x0C        // 只写: 写入命令触发传输
+#define BLK_REG_STATUS          0x10        // 只读: 上一条命令的执行结果
+#define BLK_REG_CAPACITY        0x14        // 只读: 镜像总扇区数
+#define BLK_REG_IRQ             0x18        // 完成中断的使能和挂起位
+#define BLK_REG_SIZE            0x20
+
+#define BLK_CMD_READ            1           // 镜像 -> guest 内存
+#define BLK_CMD_WRITE           2           // guest 内存 -> 镜像
+#define BLK_CMD_FLUSH           3           // 把延迟的写入同步到磁盘
+
+#define BLK_IRQ_EN              (1 << 0)    // 命令完成后请求中断
+#define BLK_IRQ_DONE            (1 << 1)    // 命令已完成 写 1 清除并撤销中断
+
+#define BLK_STATUS_OK           0
+#define BLK_STATUS_ERROR        1
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+typedef struct _blk_t {
+    riscv_device_t riscv_dev;
+
+    struct _riscv_t* riscv;         // 用于把 guest 地址解析为本机指针
+    int irq;                        // 外部中断线编号
+
+    file_map_t image;
+    riscv_word_t capacity;          // 扇区数
+    int write_back;                 // 1: 写入只修改映射页 直到 guest 发出 flush 才 msync
+
+    // 保护下面的寄存器  命令执行期间其它 hart 对本设备的访问要等传输结束
+    mutex_t lock;
+
+    riscv_word_t sector;
+    riscv_word_t buffer;
+    riscv_word_t count;
+    riscv_word_t status;
+    riscv_word_t irq_ctrl;
+}blk_t;
+
+blk_t* blk_create(struct _riscv_t* riscv, const char* name, riscv_word_t start, int irq, const char* image_path, int write_back);
+
+// 解除镜像映射并释放设备  延迟的写入不会同步  之后不能再运行挂载了它的机器
+void blk_destroy(blk_t* blk);
+
+#endif /* BLK_H */
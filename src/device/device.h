@@ -1,24 +1,30 @@
-#ifndef DEVICCE_H
+#ifndef DEVICE_H
 #define DEVICE_H
 #include "core/types.h"
 
 // device.h: 声明一个统一的外设数据结构 + 初始化方式(所以并不包含对空间的分配, 具体的空间应该由具体的外设决定)
             // 否则初始化函数会命名为 create()
 
+// 设备类型  存储器 (mem_t) 没有设备状态 可以按布局复制出独立的实例
+#define RISCV_DEVICE_REG    0       // 寄存器类外设
+#define RISCV_DEVICE_MEM    1       // mem_create() 创建的存储器
+
 typedef struct _riscv_device_t
 {
     const char* name;   // 可以常量的用 const 修饰
+    int type;           // RISCV_DEVICE_REG / RISCV_DEVICE_MEM
     riscv_word_t attr;
     riscv_word_t addr_start;
     riscv_word_t addr_end;
 
-    // 通过一个 next 指针构成设备链表
-    struct _riscv_device_t* next;
-
     // 该设备对应的读写函数指针     回调使用
     int (*read) (struct _riscv_device_t * dev, riscv_word_t addr, uint8_t * val, int width);
     int (*write) (struct _riscv_device_t * dev,  riscv_word_t addr, uint8_t * val, int width);
 
+    // 可选: 返回 [addr, addr + size) 对应的本机指针 供 DMA 类设备直接 memcpy
+    // 不支持直接访问的外设 (寄存器类) 保持为 NULL
+    uint8_t* (*host_ptr) (struct _riscv_device_t * dev, riscv_word_t addr, riscv_word_t size, riscv_word_t attr);
+
 } riscv_device_t;
 
 // 在 C 语言中没有高级语言之类的构造函数 所以要主动传结构体(类)指针进去
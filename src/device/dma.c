@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "dma.h"
+#include "core/riscv.h"
+
+// 在一个源设备和一个目的设备之间搬运 size 字节
+static int dma_copy_chunk(riscv_device_t* src_dev, riscv_word_t src, riscv_device_t* dst_dev, riscv_word_t dst, riscv_word_t size) {
+    uint8_t* src_ptr = src_dev->host_ptr ? src_dev->host_ptr(src_dev, src, size, RISCV_MEM_ATTR_READABLE) : NULL;
+    uint8_t* dst_ptr = dst_dev->host_ptr ? dst_dev->host_ptr(dst_dev, dst, size, RISCV_MEM_ATTR_WRITABLE) : NULL;
+
+    if (src_ptr && dst_ptr) {
+        // 源和目的可能重叠 使用 memmove
+        memmove(dst_ptr, src_ptr, size);
+        return 0;
+    }
+
+    // 至少一端是寄存器类外设: 它们只接受不超过 4 字节的访问 按这个宽度分段搬运
+    // 同一个设备内目的在源之后时从尾部开始 与 memmove 的语义一致
+    int backward = (src_dev == dst_dev) && (dst > src);
+    uint8_t bounce[DMA_DEVICE_ACCESS];
+    for (riscv_word_t done = 0; done < size; ) {
+        int piece = (size - done < DMA_DEVICE_ACCESS) ? (int)(size - done) : DMA_DEVICE_ACCESS;
+        riscv_word_t pos = backward ? size - done - piece : done;
+        uint8_t* from = src_ptr ? src_ptr + pos : bounce;
+        uint8_t* to = dst_ptr ? dst_ptr + pos : bounce;
+        if ((!src_ptr && (src_dev->read(src_dev, src + pos, to, piece) < 0))
+            || (!dst_ptr && (dst_dev->write(dst_dev, dst + pos, from, piece) < 0))) {
+            return -1;
+        }
+        done += piece;
+    }
+    return 0;
+}
+
+static riscv_word_t dma_transfer(dma_t* dma) {
+    riscv_word_t src = dma->src;
+    riscv_word_t dst = dma->dst;
+    riscv_word_t len = dma->len;
+
+    // 目的区间与源区间重叠并且位于其后时 按 memmove 的语义从尾部向前分段搬运
+    int backward = (dst > src) && (dst - src < len);
+
+    // 区间可能跨越多个设备 每次只处理同时落在一个源设备和一个目的设备中的部分
+    while (len > 0) {
+        riscv_word_t src_pos = backward ? src + len - 1 : src;
+        riscv_word_t dst_pos = backward ? dst + len - 1 : dst;
+
+        riscv_device_t* src_dev = device_find(dma->riscv, src_pos);
+        riscv_device_t* dst_dev = device_find(dma->riscv, dst_pos);
+        if ((src_dev == NULL) || (dst_dev == NULL)) {
+            fprintf(stderr, "dma: invalid address %" PRIxWORD " -> %" PRIxWORD "\n", src_pos, dst_pos);
+            return DMA_STATUS_ERROR;
+        }
+
+        // 访问自己的寄存器会在传输中途修改参数或者再次启动传输
+        if ((src_dev == &dma->riscv_dev) || (dst_dev == &dma->riscv_dev)) {
+            fprintf(stderr, "dma: transfer touches the dma registers\n");
+            return DMA_STATUS_ERROR;
+        }
+
+        riscv_word_t chunk = len;
+        if (backward) {
+            if (chunk > src_pos - src_dev->addr_start + 1) {
+                chunk = src_pos - src_dev->addr_start + 1;
+            }
+            if (chunk > dst_pos - dst_dev->addr_start + 1) {
+                chunk = dst_pos - dst_dev->addr_start + 1;
+            }
+            src_pos = src + len - chunk;
+            dst_pos = dst + len - chunk;
+        }
+        else {
+            if (chunk > src_dev->addr_end - src) {
+                chunk = src_dev->addr_end - src;
+            }
+            if (chunk > dst_dev->addr_end - dst) {
+                chunk = dst_dev->addr_end - dst;
+            }
+            src += chunk;
+            dst += chunk;
+        }
+
+        if (dma_copy_chunk(src_dev, src_pos, dst_dev, dst_pos, chunk) < 0) {
+            return DMA_STATUS_ERROR;
+        }
+        len -= chunk;
+    }
+    return DMA_STATUS_DONE;
+}
+
+// 中断为电平触发: 使能并且有未清除的状态位时保持有效
+static void dma_update_irq(dma_t* dma) {
+    int level = (dma->ctrl & DMA_CTRL_IRQ_EN) && (dma->status & (DMA_STATUS_DONE | DMA_STATUS_ERROR));
+    riscv_irq_set(dma->riscv, dma->irq, level);
+}
+
+static int dma_read(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    dma_t* dma = (dma_t*)dev;
+    riscv_word_t reg_val = 0;
+    if (width > (int)sizeof(reg_val)) {
+        return -1;
+    }
+
+    mutex_lock(&dma->lock);
+    switch (addr - dev->addr_start) {
+    case DMA_REG_SRC:
+        reg_val = dma->src;
+        break;
+    case DMA_REG_DST:
+        reg_val = dma->dst;
+        break;
+    case DMA_REG_LEN:
+        reg_val = dma->len;
+        break;
+    case DMA_REG_CTRL:
+        reg_val = dma->ctrl;
+        break;
+    case DMA_REG_STATUS:
+        reg_val = dma->status;
+        break;
+    default:
+        break;
+    }
+    mutex_unlock(&dma->lock);
+
+    memcpy(val, &reg_val, width);
+    return 0;
+}
+
+static int dma_write(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    dma_t* dma = (dma_t*)dev;
+    riscv_word_t reg_val = 0;
+    if (width > (int)sizeof(reg_val)) {
+        return -1;
+    }
+    memcpy(&reg_val, val, width);
+
+    mutex_lock(&dma->lock);
+    switch (addr - dev->addr_start) {
+    case DMA_REG_SRC:
+        dma->src = reg_val;
+        break;
+    case DMA_REG_DST:
+        dma->dst = reg_val;
+        break;
+    case DMA_REG_LEN:
+        dma->len = reg_val;
+        break;
+    case DMA_REG_CTRL:
+        dma->ctrl = reg_val & ~DMA_CTRL_START;
+        if (reg_val & DMA_CTRL_START) {
+            // 传输同步完成 guest 下一次读取状态寄存器时一定能看到结果
+            dma->status = dma_transfer(dma);
+        }
+        dma_update_irq(dma);
+        break;
+    case DMA_REG_STATUS:
+        dma->status &= ~reg_val;
+        dma_update_irq(dma);
+        break;
+    default:
+        break;
+    }
+    mutex_unlock(&dma->lock);
+    return 0;
+}
+
+dma_t* dma_create(struct _riscv_t* riscv, const char* name, riscv_word_t start, int irq) {
+    dma_t* dma = (dma_t*)calloc(1, sizeof(dma_t));
+    if (dma == NULL) {
+        fprintf(stderr, "dma alloc failed\n");
+        return NULL;
+    }
+
+    dma->riscv = riscv;
+    dma->irq = irq;
+
+    mutex_init(&dma->lock);
+
+    riscv_device_t* dev = (riscv_device_t*)dma;
+    device_init(dev, name, 0, start, DMA_REG_SIZE);
+    dev->read = dma_read;
+    dev->write = dma_write;
+    return dma;
+}
@@ -0,0 +1,47 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include "device.h"
+#include "plat/plat.h"
+
+// DMA 控制器: guest 设置源地址/目的地址/长度后写控制寄存器启动
+// 模拟器按设备边界切分区间 能直接访问的存储器之间用一次 memmove 完成搬运
+
+#define DMA_REG_SRC             0x00        // 源地址
+#define DMA_REG_DST             0x04        // 目的地址
+#define DMA_REG_LEN             0x08        // 传输字节数
+#define DMA_REG_CTRL            0x0C        // 写入 DMA_CTRL_START 启动传输
+#define DMA_REG_STATUS          0x10        // 传输状态 写 1 清除对应位
+#define DMA_REG_SIZE            0x20
+
+#define DMA_CTRL_START          (1 << 0)
+#define DMA_CTRL_IRQ_EN         (1 << 1)    // 完成后请求中断 状态位全部清除后撤销
+
+#define DMA_STATUS_DONE         (1 << 0)
+#define DMA_STATUS_ERROR        (1 << 1)
+
+// 寄存器类外设 (没有 host_ptr) 每次访问的字节数
+#define DMA_DEVICE_ACCESS       4
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+typedef struct _dma_t {
+    riscv_device_t riscv_dev;
+
+    struct _riscv_t* riscv;
+    int irq;                        // 外部中断线编号
+
+    // 多个 hart 线程可能同时访问寄存器 读写寄存器和整个传输都在锁内完成
+    mutex_t lock;
+
+    riscv_word_t src;
+    riscv_word_t dst;
+    riscv_word_t len;
+    riscv_word_t ctrl;
+    riscv_word_t status;
+}dma_t;
+
+dma_t* dma_create(struct _riscv_t* riscv, const char* name, riscv_word_t start, int irq);
+
+#endif /* DMA_H */
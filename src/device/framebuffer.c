@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+#include "framebuffer.h"
+#include "plat/plat.h"
+#include "core/riscv.h"
+
+// 标记 [first_row, last_row] 为脏行   在 CPU 线程中调用
+static void fb_mark_dirty(framebuffer_t* fb, int first_row, int last_row) {
+    for (int row = first_row; row <= last_row; row++) {
+        atomic_or_u32(&fb->dirty_rows[row >> 5], 1u << (row & 31));
+    }
+}
+
+// 控制寄存器读取  抓帧状态由编码线程更新 需要加锁读取
+static riscv_word_t fb_reg_read(framebuffer_t* fb, riscv_word_t reg) {
+    riscv_word_t val = 0;
+
+    mutex_lock(&fb->capture_lock);
+    switch (reg) {
+    case FB_REG_WIDTH:
+        val = fb->width;
+        break;
+    case FB_REG_HEIGHT:
+        val = fb->height;
+        break;
+    case FB_REG_FRAMES:
+        val = fb->frames_encoded;
+        break;
+    case FB_REG_HASH_LO:
+        val = (riscv_word_t)fb->frame_hash;
+        break;
+    case FB_REG_HASH_HI:
+        val = (riscv_word_t)(fb->frame_hash >> 32);
+        break;
+    default:
+        break;
+    }
+    mutex_unlock(&fb->capture_lock);
+    return val;
+}
+
+// 有事件并且允许中断时保持中断线有效  持有 key_lock 时调用
+static void fb_key_update_irq(framebuffer_t* fb) {
+    riscv_irq_set(fb->riscv, fb->irq, (fb->key_ctrl & FB_KEY_IRQ_EN) && fb->key_count);
+}
+
+// 登记的设备工作: 把渲染线程送来的事件批量移到 guest 可见的缓冲中  只在登记的 hart 中调用
+static void fb_key_drain(riscv_device_t* dev) {
+    framebuffer_t* fb = (framebuffer_t*)dev;
+    uint32_t events[FB_KEY_FIFO_SIZE];
+
+    mutex_lock(&fb->key_lock);
+    uint32_t count = spsc_ring_pop(&fb->key_ring, events, FB_KEY_FIFO_SIZE - fb->key_count);
+    for (uint32_t i = 0; i < count; i++) {
+        fb->key_fifo[(fb->key_head + fb->key_count++) % FB_KEY_FIFO_SIZE] = events[i];
+    }
+    fb_key_update_irq(fb);
+    mutex_unlock(&fb->key_lock);
+}
+
+// 按键寄存器可能由任意 hart 访问 不经过 capture_lock
+static riscv_word_t fb_key_read(framebuffer_t* fb, riscv_word_t reg) {
+    riscv_word_t val = 0;
+
+    mutex_lock(&fb->key_lock);
+    switch (reg) {
+    case FB_REG_KEY:
+        if (fb->key_count == 0) {
+            break;
+        }
+        val = fb->key_fifo[fb->key_head];
+        fb->key_head = (fb->key_head + 1) % FB_KEY_FIFO_SIZE;
+
+        // 缓冲满的时候留在队列中的事件现在可以取出  交给登记的 hart 取 读寄存器的 hart 不一定是它
+        if (fb->key_count-- == FB_KEY_FIFO_SIZE) {
+            riscv_work_post(fb->riscv, fb->key_work);
+        }
+        fb_key_update_irq(fb);
+        break;
+    case FB_REG_KEY_COUNT:
+        val = fb->key_count;
+        break;
+    default:
+        val = fb->key_ctrl;
+        break;
+    }
+    mutex_unlock(&fb->key_lock);
+    return val;
+}
+
+static int fb_is_key_reg(framebuffer_t* fb, riscv_word_t reg) {
+    return fb->riscv && (reg >= FB_REG_KEY) && (reg <= FB_REG_KEY_CTRL);
+}
+
+// 访问最多 4 字节 不能超出设备窗口  像素区只接受完整落在像素缓冲内的访问
+// 返回 1 表示访问落在像素区末尾与控制寄存器之间的对齐空隙 读为 0 写入忽略
+static int fb_check_access(framebuffer_t* fb, riscv_word_t offset, int width) {
+    riscv_device_t* dev = &fb->riscv_dev;
+    if ((width <= 0) || (width > 4) || (offset + width > dev->addr_end - dev->addr_start)) {
+        return -1;
+    }
+    if (offset >= fb->ctrl_offset) {
+        return 0;
+    }
+
+    riscv_word_t size = (riscv_word_t)fb->pitch * fb->height;
+    if (offset >= size) {
+        return 1;
+    }
+    return (offset + width > size) ? -1 : 0;
+}
+
+static int fb_read(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    framebuffer_t* fb = (framebuffer_t*)dev;
+    riscv_word_t offset = addr - dev->addr_start;
+
+    int rc = fb_check_access(fb, offset, width);
+    if (rc != 0) {
+        if (rc > 0) {
+            memset(val, 0, width);
+        }
+        return (rc > 0) ? 0 : -1;
+    }
+
+    if (offset >= fb->ctrl_offset) {
+        riscv_word_t reg = offset - fb->ctrl_offset;
+        uint32_t reg_val = (uint32_t)(fb_is_key_reg(fb, reg) ? fb_key_read(fb, reg) : fb_reg_read(fb, reg));
+        memcpy(val, &reg_val, width);
+        return 0;
+    }
+
+    if (width == 4) {
+        *(uint32_t*)val = *(uint32_t*)(fb->pixels + offset);
+    } else {
+        memcpy(val, fb->pixels + offset, width);
+    }
+    return 0;
+}
+
+static int fb_write(struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* val, int width) {
+    framebuffer_t* fb = (framebuffer_t*)dev;
+    riscv_word_t offset = addr - dev->addr_start;
+
+    int rc = fb_check_access(fb, offset, width);
+    if (rc != 0) {
+        return (rc > 0) ? 0 : -1;
+    }
+
+    if (offset >= fb->ctrl_offset) {
+        riscv_word_t reg = offset - fb->ctrl_offset;
+        uint32_t reg_val = 0;
+        memcpy(&reg_val, val, width);
+        if (reg == FB_REG_CAPTURE) {
+            framebuffer_capture(fb);
+        }
+        else if (fb->riscv && (reg == FB_REG_KEY_CTRL)) {
+            mutex_lock(&fb->key_lock);
+            fb->key_ctrl = reg_val & FB_KEY_IRQ_EN;
+            fb_key_update_irq(fb);
+            mutex_unlock(&fb->key_lock);
+        }
+        return 0;
+    }
+
+    if (width == 4) {
+        *(uint32_t*)(fb->pixels + offset) = *(uint32_t*)val;
+    } else {
+        memcpy(fb->pixels + offset, val, width);
+    }
+
+    // 先写像素再置脏位 保证渲染线程清零脏位之后的写入一定会在下一帧被看到
+    fb_mark_dirty(fb, offset / fb->pitch, (offset + width - 1) / fb->pitch);
+    return 0;
+}
+
+framebuffer_t* framebuffer_create(const char* name, riscv_word_t start, int width, int height) {
+    if ((width <= 0) || (height <= 0)) {
+        fprintf(stderr, "invalid framebuffer size %dx%d\n", width, height);
+        return NULL;
+    }
+
+    framebuffer_t* fb = (framebuffer_t*)calloc(1, sizeof(framebuffer_t));
+    if (fb == NULL) {
+        fprintf(stderr, "framebuffer alloc failed\n");
+        return NULL;
+    }
+
+    fb->width = width;
+    fb->height = height;
+    fb->pitch = width * FB_BYTES_PER_PIXEL;
+    fb->pixels = (uint8_t*)calloc(height, fb->pitch);
+    fb->dirty_words = (height + 31) / 32;
+    fb->dirty_rows = (volatile uint32_t*)calloc(fb->dirty_words, sizeof(uint32_t));
+    if ((fb->pixels == NULL) || (fb->dirty_rows == NULL)) {
+        fprintf(stderr, "No enough space for framebuffer\n");
+        free(fb->pixels);
+        free((void*)fb->dirty_rows);
+        free(fb);
+        return NULL;
+    }
+
+    mutex_init(&fb->capture_lock);
+    cond_init(&fb->capture_cond);
+
+    fb->ctrl_offset = (fb->pitch * height + FB_CTRL_ALIGN - 1) & ~(FB_CTRL_ALIGN - 1);
+
+    riscv_device_t* dev = (riscv_device_t*)fb;
+    device_init(dev, name, 0, start, fb->ctrl_offset + FB_CTRL_SIZE);
+    dev->read = fb_read;
+    dev->write = fb_write;
+    return fb;
+}
+
+// 把脏行按连续区间上传到纹理 只拷贝发生变化的部分
+static int fb_upload_dirty(framebuffer_t* fb, SDL_Texture* texture) {
+    int uploaded = 0;
+    int span_start = -1;
+
+    for (int word = 0; word < fb->dirty_words; word++) {
+        uint32_t bits = atomic_xchg_u32(&fb->dirty_rows[word], 0);
+
+        for (int bit = 0; bit < 32; bit++) {
+            int row = word * 32 + bit;
+            int is_dirty = (bits >> bit) & 1;
+
+            if (is_dirty && (span_start < 0)) {
+                span_start = row;
+            }
+
+            // 遇到干净行或者到达最后一行时 提交之前累积的连续脏行
+            if ((span_start >= 0) && (!is_dirty || (row == fb->height - 1))) {
+                int span_end = is_dirty ? row + 1 : row;
+                SDL_Rect rect = {0, span_start, fb->width, span_end - span_start};
+                SDL_UpdateTexture(texture, &rect, fb->pixels + span_start * fb->pitch, fb->pitch);
+                uploaded += rect.h;
+                span_start = -1;
+            }
+
+            if (row == fb->height - 1) {
+                break;
+            }
+        }
+    }
+    return uploaded;
+}
+
+static void fb_render_entry(void* param) {
+    framebuffer_t* fb = (framebuffer_t*)param;
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        exit(-1);
+    }
+
+    SDL_Window* window = SDL_CreateWindow(fb->riscv_dev.name, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, fb->width, fb->height, SDL_WINDOW_SHOWN);
+    if (window == NULL) {
+        fprintf(stderr, "SDL_CreateWindow Error: %s\n", SDL_GetError());
+        SDL_Quit();
+        exit(-1);
+    }
+
+    // 依靠 PRESENTVSYNC 让渲染循环按照屏幕刷新率运行
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == NULL) {
+        fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        exit(-1);
+    }
+
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, fb->width, fb->height);
+    if (texture == NULL) {
+        fprintf(stderr, "SDL_CreateTexture Error: %s\n", SDL_GetError());
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        exit(-1);
+    }
+
+    // 首帧整体上传一次
+    SDL_UpdateTexture(texture, NULL, fb->pixels, fb->pitch);
+
+    SDL_Event event;
+    int quit = 0;
+    while (!quit) {
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                quit = 1;
+            }
+            else if (fb->riscv && ((event.type == SDL_KEYDOWN) || (event.type == SDL_KEYUP)) && !event.key.repeat) {
+                uint32_t key = FB_KEY_VALID | (event.type == SDL_KEYDOWN ? FB_KEY_PRESSED : 0) | (event.key.keysym.scancode & 0xFFFF);
+                if (spsc_ring_push(&fb->key_ring, &key) == 0) {
+                    riscv_work_post(fb->riscv, fb->key_work);
+                }
+            }
+        }
+
+        fb_upload_dirty(fb, texture);
+
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+    // 关闭窗口即结束模拟器
+    exit(0);
+}
+
+int framebuffer_input(framebuffer_t* fb, struct _riscv_t* riscv, int irq) {
+    if (spsc_ring_init(&fb->key_ring, sizeof(uint32_t), FB_KEY_RING_SIZE) < 0) {
+        return -1;
+    }
+
+    fb->key_work = riscv_work_register(riscv, &fb->riscv_dev, fb_key_drain);
+    if (fb->key_work < 0) {
+        return -1;
+    }
+    mutex_init(&fb->key_lock);
+    fb->irq = irq;
+    fb->riscv = riscv;
+    return 0;
+}
+
+void framebuffer_show(framebuffer_t* fb) {
+    thread_create(fb_render_entry, fb);
+}
+
+/* 抓帧: 由 CPU 线程或者定时线程抓取快照 编码线程负责计算 hash 和写文件 */
+
+// FNV-1a 64 位 hash
+static uint64_t fb_hash(uint64_t hash, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define FB_HASH_INIT            0xcbf29ce484222325ULL
+
+// 以 PPM(P6) 格式写出一帧  ARGB8888 在小端机器上的字节序为 B G R A
+static void fb_write_ppm(framebuffer_t* fb, fb_frame_t* frame) {
+    char file_name[1024];
+    snprintf(file_name, sizeof(file_name), "%s/frame_%05d.ppm", fb->capture_dir, frame->index);
+
+    FILE* file = fopen(file_name, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "unable to write %s\n", file_name);
+        return;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", fb->width, fb->height);
+
+    uint8_t* row_buffer = (uint8_t*)malloc(fb->width * 3);
+    for (int y = 0; y < fb->height; y++) {
+        const uint8_t* src = frame->pixels + y * fb->pitch;
+        for (int x = 0; x < fb->width; x++) {
+            row_buffer[x * 3 + 0] = src[x * 4 + 2];
+            row_buffer[x * 3 + 1] = src[x * 4 + 1];
+            row_buffer[x * 3 + 2] = src[x * 4 + 0];
+        }
+        fwrite(row_buffer, 1, fb->width * 3, file);
+    }
+    free(row_buffer);
+    fclose(file);
+}
+
+static void fb_encode_entry(void* param) {
+    framebuffer_t* fb = (framebuffer_t*)param;
+
+    while (1) {
+        mutex_lock(&fb->capture_lock);
+        while (fb->queue_count == 0) {
+            cond_wait(&fb->capture_cond, &fb->capture_lock);
+        }
+        fb_frame_t frame = fb->capture_queue[fb->queue_head];
+        fb->queue_head = (fb->queue_head + 1) % FB_CAPTURE_QUEUE_SIZE;
+        fb->queue_count--;
+        cond_broadcast(&fb->capture_cond);
+        mutex_unlock(&fb->capture_lock);
+
+        uint64_t hash = fb_hash(FB_HASH_INIT, frame.pixels, fb->pitch * fb->height);
+        if (fb->capture_dir) {
+            fb_write_ppm(fb, &frame);
+        }
+        free(frame.pixels);
+
+        fprintf(stdout, "frame %05d hash %016llx\n", frame.index, (unsigned long long)hash);
+
+        mutex_lock(&fb->capture_lock);
+        fb->frame_hash = hash;
+        fb->rolling_hash = fb_hash(fb->rolling_hash, (const uint8_t*)&hash, sizeof(hash));
+        fb->frames_encoded++;
+        cond_broadcast(&fb->capture_cond);
+        mutex_unlock(&fb->capture_lock);
+    }
+}
+
+// 虚拟时间定时器回调 在 capture_hart 的线程中执行  下一个抓帧点按固定间隔累加 不受块边界的误差影响
+static void fb_capture_timer(riscv_device_t* dev) {
+    framebuffer_t* fb = (framebuffer_t*)dev;
+    framebuffer_capture(fb);
+    fb->capture_next += fb->capture_ticks;
+    riscv_timer_set(fb->capture_hart, dev, fb_capture_timer, fb->capture_next);
+}
+
+void framebuffer_capture(framebuffer_t* fb) {
+    if (!fb->capture_enabled) {
+        return;
+    }
+
+    // 快照在加锁之前完成 编码线程只处理快照 不会和 CPU 的写入产生竞争
+    uint8_t* snapshot = (uint8_t*)malloc(fb->pitch * fb->height);
+    if (snapshot == NULL) {
+        fprintf(stderr, "No enough space for frame capture\n");
+        return;
+    }
+    memcpy(snapshot, fb->pixels, fb->pitch * fb->height);
+
+    mutex_lock(&fb->capture_lock);
+    while (fb->queue_count == FB_CAPTURE_QUEUE_SIZE) {
+        cond_wait(&fb->capture_cond, &fb->capture_lock);
+    }
+    int tail = (fb->queue_head + fb->queue_count) % FB_CAPTURE_QUEUE_SIZE;
+    fb->capture_queue[tail].index = fb->frames_captured++;
+    fb->capture_queue[tail].pixels = snapshot;
+    fb->queue_count++;
+    cond_broadcast(&fb->capture_cond);
+    mutex_unlock(&fb->capture_lock);
+}
+
+void framebuffer_capture_flush(framebuffer_t* fb) {
+    if (!fb->capture_enabled) {
+        return;
+    }
+
+    mutex_lock(&fb->capture_lock);
+    while (fb->frames_encoded < fb->frames_captured) {
+        cond_wait(&fb->capture_cond, &fb->capture_lock);
+    }
+    fprintf(stdout, "%d frames rolling hash %016llx\n", fb->frames_encoded, (unsigned long long)fb->rolling_hash);
+    mutex_unlock(&fb->capture_lock);
+}
+
+void framebuffer_capture_start(framebuffer_t* fb, struct _riscv_t* riscv, const char* dir, int capture_ms) {
+    fb->capture_dir = dir;
+    fb->rolling_hash = FB_HASH_INIT;
+    fb->capture_enabled = 1;
+
+    thread_create(fb_encode_entry, fb);
+    if (capture_ms > 0) {
+        fb->capture_hart = riscv;
+        fb->capture_ticks = (uint64_t)capture_ms * RISCV_TIME_FREQ / 1000;
+        fb->capture_next = fb->capture_ticks;
+        riscv_timer_set(riscv, &fb->riscv_dev, fb_capture_timer, fb->capture_next);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "device.h"
+#include "plat/plat.h"
+
+// 显存设备: guest 按 ARGB8888 的格式直接写像素 每个像素 4B
+// CPU 线程只负责写显存并标记脏行 所有 SDL 调用都放在独立的渲染线程中
+
+#define FB_BYTES_PER_PIXEL      4
+
+// 控制寄存器窗口紧跟在像素区之后 起始偏移为像素区大小按 4KB 向上对齐
+#define FB_CTRL_ALIGN           0x1000
+#define FB_CTRL_SIZE            0x100
+
+#define FB_REG_WIDTH            0x00        // 只读: 宽度
+#define FB_REG_HEIGHT           0x04        // 只读: 高度
+#define FB_REG_CAPTURE          0x08        // 只写: 写入任意值抓取当前帧
+#define FB_REG_FRAMES           0x0C        // 只读: 已经完成编码的帧数
+#define FB_REG_HASH_LO          0x10        // 只读: 最近一帧的 hash 低 32 位
+#define FB_REG_HASH_HI          0x14        // 只读: 最近一帧的 hash 高 32 位
+#define FB_REG_KEY              0x18        // 只读: 取出最早的按键事件 没有事件时为 0
+#define FB_REG_KEY_COUNT        0x1C        // 只读: 可以读取的按键事件数量
+#define FB_REG_KEY_CTRL         0x20        // 读写: FB_KEY_IRQ_EN 有按键事件时请求中断
+
+// 按键事件: 低 16 位为 SDL scancode
+#define FB_KEY_PRESSED          (1u << 16)  // 按下为 1 松开为 0
+#define FB_KEY_VALID            (1u << 31)
+
+#define FB_KEY_IRQ_EN           (1 << 0)
+
+#define FB_KEY_RING_SIZE        256         // 渲染线程到 CPU 线程的事件队列 满了丢弃新的事件
+#define FB_KEY_FIFO_SIZE        64          // guest 可见的事件缓冲
+
+// 编码队列长度 队列满的时候抓帧方等待 不会丢帧
+#define FB_CAPTURE_QUEUE_SIZE   8
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+typedef struct _fb_frame_t {
+    int index;
+    uint8_t* pixels;
+}fb_frame_t;
+
+typedef struct _framebuffer_t {
+    riscv_device_t riscv_dev;       // 放在首位 可以直接强制转换为 riscv_device_t*
+
+    int width;
+    int height;
+    int pitch;                      // 每一行的字节数
+    riscv_word_t ctrl_offset;       // 控制寄存器窗口的偏移
+
+    uint8_t* pixels;                // 显存空间
+
+    // 脏行位图 每一位对应一行像素  CPU 线程置位 渲染线程取走并清零
+    volatile uint32_t* dirty_rows;
+    int dirty_words;
+
+    // 抓帧相关 只有调用 framebuffer_capture_start() 之后才会启用
+    int capture_enabled;
+    const char* capture_dir;        // 为 NULL 时只计算 hash 不写文件
+    // 周期抓帧按虚拟时间进行: capture_hart 的 time 每经过 capture_ticks 在块边界抓取一帧  0 表示只响应 guest 请求
+    // 快照在 CPU 线程中完成 与 guest 写显存不会交错 同一镜像每次运行抓到的帧都相同
+    struct _riscv_t* capture_hart;
+    uint64_t capture_ticks;
+    uint64_t capture_next;
+
+    mutex_t capture_lock;
+    cond_t capture_cond;
+    fb_frame_t capture_queue[FB_CAPTURE_QUEUE_SIZE];
+    int queue_head;
+    int queue_count;
+    int frames_captured;
+    int frames_encoded;
+
+    uint64_t frame_hash;            // 最近一帧的 hash
+    uint64_t rolling_hash;          // 所有已编码帧按顺序串联后的 hash
+
+    // 键盘输入 只有调用 framebuffer_input() 之后才会启用
+    // 渲染线程把事件放进 key_ring 并投递工作  登记的 hart (riscv) 在块边界批量取出到 key_fifo 后更新中断线
+    // key_ring 只由登记的 hart 取出 保持单生产者单消费者  多核时任意 hart 都可以访问按键寄存器 key_fifo 和 key_ctrl 由 key_lock 保护
+    struct _riscv_t* riscv;
+    int irq;
+    int key_work;
+    spsc_ring_t key_ring;
+    mutex_t key_lock;
+    uint32_t key_fifo[FB_KEY_FIFO_SIZE];
+    int key_head;
+    int key_count;
+    riscv_word_t key_ctrl;
+}framebuffer_t;
+
+framebuffer_t* framebuffer_create(const char* name, riscv_word_t start, int width, int height);
+
+// 把窗口中的按键事件交给 riscv 读取  有事件并且 guest 允许时请求 irq 号外部中断   失败时返回 -1
+int framebuffer_input(framebuffer_t* fb, struct _riscv_t* riscv, int irq);
+
+// 创建窗口并启动渲染线程
+void framebuffer_show(framebuffer_t* fb);
+
+// 启动抓帧编码线程 不依赖 SDL 可以在没有显示器的环境下单独使用
+// capture_ms 不为 0 时 riscv 的虚拟时间每经过 capture_ms 毫秒抓取一帧  在 riscv 运行之前调用
+void framebuffer_capture_start(framebuffer_t* fb, struct _riscv_t* riscv, const char* dir, int capture_ms);
+
+// 抓取当前帧并交给编码线程
+void framebuffer_capture(framebuffer_t* fb);
+
+// 等待所有已抓取的帧编码完成
+void framebuffer_capture_flush(framebuffer_t* fb);
+
+#endif /* FRAMEBUFFER_H */
@@ -11,7 +11,7 @@ static int mem_read (struct _riscv_device_t* dev, riscv_word_t addr, uint8_t* va
     // 检查读写权限
     if ((dev->attr & RISCV_MEM_ATTR_READABLE) == 0) {
         // 没有读取权限
-        fprintf(stderr, "memory read failed at %x\n", addr);
+        fprintf(stderr, "memory read failed at %" PRIxWORD "\n", addr);
         return -1;
     }
     
@@ -47,8 +47,12 @@ static int mem_write (struct _riscv_device_t * dev,  riscv_word_t addr, uint8_t
 
     mem_t * mem = (mem_t *)dev;
     riscv_word_t offset = addr - dev->addr_start;
+    mem->dirty[offset >> MEM_PAGE_SHIFT] = 1;
+    if ((size > 1) && (((offset & (MEM_PAGE_SIZE - 1)) + size) > MEM_PAGE_SIZE)) {
+        mem->dirty[(offset + size - 1) >> MEM_PAGE_SHIFT] = 1;
+    }
     if (size == 4) {
-        *(riscv_word_t *)(mem->mem + offset) = *(riscv_word_t *)val;
+        *(uint32_t *)(mem->mem + offset) = *(uint32_t *)val;
     } else if (size == 2) {
         *(uint16_t *)(mem->mem + offset) = *(uint16_t *)val;
     } else if (size == 1) {
@@ -60,6 +64,54 @@ static int mem_write (struct _riscv_device_t * dev,  riscv_word_t addr, uint8_t
     return 0;
 }
 
+// 供 DMA 使用 要求整个区间都落在该存储器中并且具有对应的读写权限
+static uint8_t* mem_host_ptr (struct _riscv_device_t * dev, riscv_word_t addr, riscv_word_t size, riscv_word_t attr) {
+    if ((dev->attr & attr) != attr) {
+        return NULL;
+    }
+    if (addr < dev->addr_start || size > dev->addr_end - addr) {
+        return NULL;
+    }
+    if (attr & RISCV_MEM_ATTR_WRITABLE) {
+        mem_mark_dirty((mem_t *)dev, addr - dev->addr_start, size);
+    }
+    return ((mem_t *)dev)->mem + (addr - dev->addr_start);
+}
+
+void mem_mark_dirty(mem_t* mem, riscv_word_t offset, riscv_word_t size) {
+    if (size == 0) {
+        return;
+    }
+    riscv_word_t last = (offset + size - 1) >> MEM_PAGE_SHIFT;
+    for (riscv_word_t page = offset >> MEM_PAGE_SHIFT; page <= last; page++) {
+        mem->dirty[page] = 1;
+    }
+}
+
+int mem_clear(mem_t* mem) {
+    riscv_device_t* dev = &mem->riscv_dev;
+    riscv_word_t size = dev->addr_end - dev->addr_start;
+    riscv_word_t pages = (size + MEM_PAGE_SIZE - 1) >> MEM_PAGE_SHIFT;
+    int count = 0;
+
+    // 连续的脏页合并成一次 memset
+    for (riscv_word_t page = 0; page < pages; ) {
+        if (!mem->dirty[page]) {
+            page++;
+            continue;
+        }
+        riscv_word_t first = page;
+        while ((page < pages) && mem->dirty[page]) {
+            mem->dirty[page++] = 0;
+        }
+        riscv_word_t start = first << MEM_PAGE_SHIFT;
+        riscv_word_t end = (page == pages) ? size : (page << MEM_PAGE_SHIFT);
+        memset(mem->mem + start, 0, end - start);
+        count += (int)(page - first);
+    }
+    return count;
+}
+
 mem_t* mem_create(const char* name, riscv_word_t attr, riscv_word_t start, riscv_word_t size) {
     // 1.分配 device 空间并且初始化     2.分配对应的内存空间
     mem_t* myFlash = (mem_t*)calloc(1, sizeof(mem_t));
@@ -70,12 +122,15 @@ mem_t* mem_create(const char* name, riscv_word_t attr, riscv_word_t start, riscv
         return NULL;
     }
 
-    // 分配真正的 Flash 空间
-    myFlash->mem = malloc(size);    // 返回 void* 表示未确定类型的指针 如果分配成功返回对应空间的首地址
+    // 分配真正的 Flash 空间  calloc 保证初始为 0 mem_clear() 只需要处理写过的页
+    myFlash->mem = calloc(1, size);    // 返回 void* 表示未确定类型的指针 如果分配成功返回对应空间的首地址
+    myFlash->dirty = calloc(1, ((size_t)size + MEM_PAGE_SIZE - 1) >> MEM_PAGE_SHIFT);
 
     // 同理判断
-    if (myFlash->mem == NULL) {
+    if ((myFlash->mem == NULL) || (myFlash->dirty == NULL)) {
         fprintf(stderr, "No enough space to malloc");
+        free(myFlash->mem);
+        free(myFlash->dirty);
         free(myFlash);
         return NULL;   // 没有足够的空间可以分配 直接退出
     }
@@ -87,8 +142,16 @@ mem_t* mem_create(const char* name, riscv_word_t attr, riscv_word_t start, riscv
     device_init(dev, name, attr, start, size);
 
     // 初始化 dev 对应的读写操作
+    dev->type = RISCV_DEVICE_MEM;
     dev->read = mem_read;
     dev->write = mem_write;
+    dev->host_ptr = mem_host_ptr;
     return myFlash;
 }
 
+void mem_destroy(mem_t* mem) {
+    free(mem->mem);
+    free(mem->dirty);
+    free(mem);
+}
+
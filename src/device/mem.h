@@ -9,10 +9,18 @@
 #define RISCV_MEM_ATTR_READABLE     (1 << 0)
 #define RISCV_MEM_ATTR_WRITABLE     (1 << 1)
 
+// 记录写入的粒度 与 guest 的页大小相同
+#define MEM_PAGE_SHIFT              12
+#define MEM_PAGE_SIZE               (1 << MEM_PAGE_SHIFT)
+
 typedef struct _mem_t{
     riscv_device_t riscv_dev;    // 待分配的外设数据结构空间
 
-    uint8_t* mem;                // 指向 Flash 空间的指针
+    uint8_t* mem;                // 指向 Flash 空间的指针  创建时全部为 0
+
+    // 每页一个字节: 写入或者交出可写的本机指针时置 1  多个 hart 同时写同一个字节也只会写入 1
+    // TLB 填写时总会取可写指针 开启分页后读过的页也会被记录 只会多清零 不会漏掉
+    uint8_t* dirty;
 }mem_t;
 
 // 因为在 mem_t 结构体中传递的并不是 riscv_device_t 指针 所以这里应该传递所有参数
@@ -21,4 +29,13 @@ typedef struct _mem_t{
 // 对比 device_init() 这里需要返回一个指针
 mem_t* mem_create(const char* name, riscv_word_t attr, riscv_word_t start, riscv_word_t size);
 
+// 记录 [offset, offset + size) 已经被修改  绕过 write/host_ptr 直接写 mem 时调用 (例如装载镜像)
+void mem_mark_dirty(mem_t* mem, riscv_word_t offset, riscv_word_t size);
+
+// 把修改过的页清零 恢复到刚创建时的状态  开销与修改过的页数成正比  返回清零的页数
+int mem_clear(mem_t* mem);
+
+// 释放 mem_create() 分配的结构体和存储空间
+void mem_destroy(mem_t* mem);
+
 #endif /* MEMORY_H */
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "fuzz.h"
+#include "core/riscv.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/shm.h>
+#endif
+
+// 一次输入的执行结果
+enum {
+    FUZZ_RESULT_OK = 0,
+    FUZZ_RESULT_CRASH,
+    FUZZ_RESULT_TIMEOUT,
+};
+
+static const char* fuzz_result_name[] = { "ok", "crash", "timeout" };
+
+// 读取整个输入 超过容量的部分丢弃  返回读到的长度 失败时返回 -1
+static long fuzz_read_input(const char* input, uint8_t* buf, riscv_word_t capacity) {
+    FILE* file = strcmp(input, "-") ? fopen(input, "rb") : stdin;
+    if (file == NULL) {
+        return -1;
+    }
+
+    size_t len = 0;
+    size_t n;
+    while ((len < capacity) && ((n = fread(buf + len, 1, capacity - len, file)) > 0)) {
+        len += n;
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return (long)len;
+}
+
+// 在快照点的状态上执行一个输入
+static int fuzz_exec(riscv_t* riscv, const char* input, uint64_t timeout) {
+    riscv_word_t addr = riscv_read_reg(riscv, FUZZ_REG_ADDR);
+    riscv_word_t capacity = riscv_read_reg(riscv, FUZZ_REG_SIZE);
+
+    // fuzz_run 在快照点已经检查过缓冲区
+    uint8_t* buf = capacity ? riscv_mem_ptr(riscv, addr, capacity, RISCV_MEM_ATTR_WRITABLE) : NULL;
+    long len = buf ? fuzz_read_input(input, buf, capacity) : 0;
+    if (len < 0) {
+        fprintf(stderr, "can't read fuzz input %s\n", input);
+        exit(-1);
+    }
+    riscv->regs[FUZZ_REG_SIZE] = (riscv_word_t)len;
+    riscv->cov_prev = 0;
+    riscv->cov_next = RISCV_COV_NO_NEXT;
+
+    int rc = riscv_run_budget(riscv, timeout ? timeout : UINT64_MAX);
+    if (rc == 0) {
+        return FUZZ_RESULT_TIMEOUT;
+    }
+    if ((riscv->instr.raw == EBREAK) && (riscv_read_reg(riscv, FUZZ_REG_RESULT) == 0)) {
+        return FUZZ_RESULT_OK;
+    }
+    return FUZZ_RESULT_CRASH;
+}
+
+#ifndef _WIN32
+static void fuzz_child(riscv_t* riscv, const char* input, uint64_t timeout) {
+    close(FUZZ_FORKSRV_FD);
+    close(FUZZ_FORKSRV_FD + 1);
+
+    switch (fuzz_exec(riscv, input, timeout)) {
+    case FUZZ_RESULT_OK:
+        _exit(0);
+    case FUZZ_RESULT_TIMEOUT:
+        _exit(FUZZ_EXIT_TIMEOUT);
+    default:
+        // AFL++ 只把信号终止当作崩溃
+        abort();
+    }
+}
+
+// fork server 主循环: 每读到一个 4 字节的请求 fork 一个子进程 先回复进程号 结束后回复 waitpid 的状态
+static int fuzz_serve(riscv_t* riscv, const char* input, uint64_t timeout) {
+    // AFL++ 在每次执行前清空位图  子进程直接写入共享内存
+    char* shm_id = getenv("__AFL_SHM_ID");
+    if (shm_id) {
+        void* map = shmat(atoi(shm_id), NULL, 0);
+        if (map == (void*)-1) {
+            fprintf(stderr, "fuzz: can't attach coverage map %s\n", shm_id);
+            return -1;
+        }
+        riscv->machine->cov_map = (uint8_t*)map;
+    }
+
+    uint32_t msg = 0;
+    if (write(FUZZ_FORKSRV_FD + 1, &msg, 4) != 4) {
+        return -1;
+    }
+
+    while (read(FUZZ_FORKSRV_FD, &msg, 4) == 4) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            _exit(1);
+        }
+        if (pid == 0) {
+            fuzz_child(riscv, input, timeout);
+        }
+
+        int status;
+        if ((write(FUZZ_FORKSRV_FD + 1, &pid, 4) != 4) || (waitpid(pid, &status, 0) < 0)) {
+            _exit(1);
+        }
+        if (write(FUZZ_FORKSRV_FD + 1, &status, 4) != 4) {
+            _exit(1);
+        }
+    }
+    return 0;
+}
+#endif
+
+int fuzz_run(riscv_t* riscv, const char* image, const char* input, uint64_t timeout) {
+    riscv->machine->quiet = 1;
+    riscv_reset(riscv);
+    if (riscv_load_image(riscv, image) < 0) {
+        fprintf(stderr, "can't load fuzz image %s\n", image);
+        return -1;
+    }
+
+    // 启动到快照点  其它 hart 和设备线程不会复制到子进程中 只执行当前 hart
+    if ((riscv_run_budget(riscv, FUZZ_BOOT_BUDGET) == 0) || (riscv->instr.raw != EBREAK)) {
+        fprintf(stderr, "fuzz: %s stopped at 0x%" PRIxWORD " before reaching the snapshot ebreak\n", image, riscv->pc);
+        return -1;
+    }
+    riscv->pc += riscv->instr_size;
+
+    // 缓冲区必须位于一块可写的存储器内  否则每个输入都会被当作空输入 测试毫无意义
+    riscv_word_t addr = riscv_read_reg(riscv, FUZZ_REG_ADDR);
+    riscv_word_t capacity = riscv_read_reg(riscv, FUZZ_REG_SIZE);
+    if (capacity && (riscv_mem_ptr(riscv, addr, capacity, RISCV_MEM_ATTR_WRITABLE) == NULL)) {
+        fprintf(stderr, "fuzz: input buffer 0x%" PRIxWORD " size 0x%" PRIxWORD " is not in writable memory\n", addr, capacity);
+        return -1;
+    }
+
+#ifndef _WIN32
+    // 状态管道存在说明由 AFL++ 启动
+    if (fcntl(FUZZ_FORKSRV_FD + 1, F_GETFD) >= 0) {
+        return fuzz_serve(riscv, input, timeout);
+    }
+#endif
+
+    riscv->machine->cov_map = (uint8_t*)calloc(1, RISCV_COV_MAP_SIZE);
+    int result = fuzz_exec(riscv, input, timeout);
+
+    int edges = 0;
+    for (int i = 0; i < RISCV_COV_MAP_SIZE; i++) {
+        edges += (riscv->machine->cov_map[i] != 0);
+    }
+    free(riscv->machine->cov_map);
+    riscv->machine->cov_map = NULL;
+
+    fprintf(stderr, "fuzz: %s, pc=0x%" PRIxWORD " a0=0x%" PRIxWORD " instret=%llu edges=%d\n", fuzz_result_name[result],
+        riscv->pc, riscv_read_reg(riscv, FUZZ_REG_RESULT), (unsigned long long)riscv_get_instret(riscv), edges);
+    return (result == FUZZ_RESULT_TIMEOUT) ? FUZZ_EXIT_TIMEOUT : result;
+}
@@ -0,0 +1,31 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include "plat/plat.h"
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+/* 快照模糊测试: 固件启动完成后执行 ebreak 作为快照点  此时 a0 为输入缓冲区地址 a1 为缓冲区容量
+ * 之后每个输入都在 fork 出的子进程中从快照点继续执行  输入复制到 a0 指向的缓冲区 a1 改为实际长度 跳过 ebreak 继续
+ * 子进程中存储器是写时复制的 不需要重新启动固件
+ * 固件处理完输入后再执行一次 ebreak: a0 为 0 表示正常  不为 0 (例如异常处理程序中设置) 或者无法继续执行时按崩溃报告 */
+#define FUZZ_REG_ADDR           10                      // a0
+#define FUZZ_REG_SIZE           11                      // a1
+#define FUZZ_REG_RESULT         10                      // 结束时的 a0
+
+#define FUZZ_BOOT_BUDGET        1000000000ull           // 到达快照点之前最多执行的指令数
+
+// 与 AFL++ 的约定: 控制管道为 198 状态管道为 199
+#define FUZZ_FORKSRV_FD         198
+
+// 子进程用完 -fuzz-timeout 指定的指令数时的退出码  AFL++ 按墙上时间另外判断超时
+#define FUZZ_EXIT_TIMEOUT       2
+
+// 从镜像启动到快照点 然后按 AFL++ 的 fork server 协议处理输入  input 为 "-" 时从标准输入读取
+// 环境变量 __AFL_SHM_ID 给出的共享内存作为边覆盖位图 快照点之后的执行都记录覆盖
+// 没有在 AFL++ 之下运行时 (状态管道不存在) 只处理一次输入 并在标准错误输出结果和覆盖的边数  用于复现崩溃
+// timeout 为每个输入最多执行的指令数 0 表示不限制   返回值作为进程的退出码
+int fuzz_run(struct _riscv_t* riscv, const char* image, const char* input, uint64_t timeout);
+
+#endif /* FUZZ_H */
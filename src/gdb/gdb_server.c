@@ -314,8 +314,8 @@ static int gdb_read_regs(gdb_server_t* gdb_server) {
 
     char* reg_buffer = gdb_server->gdb_send_buffer;
     for (int i = 0; i < RISCV_REG_NUM; i ++) {
-        // 按顺序读取寄存器的值并且每次写入 4B
-        reg_buffer = write_mem_from_reg(reg_buffer, riscv_read_reg(gdb_server->riscv, i), 4);
+        // 按顺序读取寄存器的值并且每次写入 XLEN / 8 字节
+        reg_buffer = write_mem_from_reg(reg_buffer, riscv_read_reg(gdb_server->riscv, i), sizeof(riscv_word_t));
         // 更新目前记录数据的指针指向
     }
 
@@ -326,7 +326,7 @@ static int gdb_read_regs(gdb_server_t* gdb_server) {
     return gdb_write_packet(gdb_server, gdb_server->gdb_send_buffer);
 }
 
-static int gdb_read_specified_reg(riscv_t* riscv, int reg_num) {
+static riscv_word_t gdb_read_specified_reg(riscv_t* riscv, int reg_num) {
     return riscv_read_reg(riscv, reg_num);
 }
 
@@ -401,7 +401,7 @@ static int gdb_handle_command_p(gdb_server_t* gdb_server, char* packet_data) {
     }
 
     // 写入指定内存地址
-    char* mem_buffer = write_mem_from_reg(gdb_server->gdb_send_buffer, reg_data, 4);
+    char* mem_buffer = write_mem_from_reg(gdb_server->gdb_send_buffer, reg_data, sizeof(riscv_word_t));
     *mem_buffer++ = '\0';
 
     // 发送数据包
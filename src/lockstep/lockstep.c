@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "lockstep.h"
+#include "core/riscv.h"
+
+#define LOCKSTEP_MAGIC      0x534c5652      // "RVLS"
+
+// 轨迹文件头  记录按宿主机字节序直接写入 只在同一类宿主机之间交换
+typedef struct _lockstep_header_t {
+    uint32_t magic;
+    uint32_t xlen;
+    uint64_t interval;
+}lockstep_header_t;
+
+// 一个区间结束时的状态
+typedef struct _lockstep_state_t {
+    uint64_t step;                  // 已经执行的步数  停止后不再增加
+    uint64_t instret;
+    uint64_t write_hash;
+    uint64_t write_count;
+    uint32_t stopped;               // 执行已经停止 (ebreak 或无法继续) 这是最后一条记录
+    uint32_t reserved;
+    riscv_word_t pc;
+    riscv_word_t regs[RISCV_REG_NUM];
+}lockstep_state_t;
+
+typedef struct _lockstep_engine_t {
+    const char* name;
+    riscv_t* riscv;
+    int reference;                  // 逐条执行 每条指令执行完就作废它所在的缓存块 下一条重新译码
+    uint64_t step;
+    int stopped;
+    riscv_write_log_t log;
+}lockstep_engine_t;
+
+static int lockstep_engine_init(lockstep_engine_t* engine, riscv_t* layout, const char* image, const char* name, int reference) {
+    memset(engine, 0, sizeof(lockstep_engine_t));
+    engine->name = name;
+    engine->reference = reference;
+    engine->riscv = riscv_clone(layout);
+    engine->riscv->machine->quiet = 1;
+    engine->riscv->write_log = &engine->log;
+
+    riscv_reset(engine->riscv);
+    if (riscv_load_image(engine->riscv, image) < 0) {
+        fprintf(stderr, "can't load lockstep image %s\n", image);
+        riscv_clone_destroy(engine->riscv);
+        return -1;
+    }
+    return 0;
+}
+
+static void lockstep_engine_free(lockstep_engine_t* engine) {
+    riscv_clone_destroy(engine->riscv);
+}
+
+// 前进 steps 步  已经停止或者在这期间停止时返回 -1
+static int lockstep_advance(lockstep_engine_t* engine, uint64_t steps) {
+    riscv_t* riscv = engine->riscv;
+    if (engine->stopped) {
+        return -1;
+    }
+
+    if (!engine->reference) {
+        if (riscv_run_budget(riscv, steps) != 0) {
+            engine->stopped = 1;
+            return -1;
+        }
+        engine->step += steps;
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < steps; i++) {
+        riscv_word_t pc = riscv->pc;
+        int rc = riscv_run_budget(riscv, 1);
+        riscv_block_drop(riscv, pc);
+        if (rc != 0) {
+            engine->stopped = 1;
+            return -1;
+        }
+        engine->step++;
+    }
+    return 0;
+}
+
+static void lockstep_capture(lockstep_engine_t* engine, lockstep_state_t* state) {
+    memset(state, 0, sizeof(lockstep_state_t));
+    state->step = engine->step;
+    state->instret = riscv_get_instret(engine->riscv);
+    state->write_hash = engine->log.hash;
+    state->write_count = engine->log.count;
+    state->stopped = engine->stopped;
+    state->pc = engine->riscv->pc;
+    memcpy(state->regs, engine->riscv->regs, sizeof(state->regs));
+}
+
+// 步数不参与比较: 块缓存引擎在区间中间停止时不知道用了多少步
+static int lockstep_same(lockstep_state_t* a, lockstep_state_t* b) {
+    return (a->instret == b->instret) && (a->write_hash == b->write_hash) && (a->write_count == b->write_count)
+        && (a->stopped == b->stopped) && (a->pc == b->pc) && (memcmp(a->regs, b->regs, sizeof(a->regs)) == 0);
+}
+
+// 只列出不同的项
+static void lockstep_report(const char* name_a, lockstep_state_t* a, const char* name_b, lockstep_state_t* b) {
+    printf("  %-12s %-20s %-20s\n", "", name_a, name_b);
+    if (a->pc != b->pc) {
+        printf("  %-12s 0x%-18" PRIxWORD " 0x%-18" PRIxWORD "\n", "pc", a->pc, b->pc);
+    }
+    for (int i = 0; i < RISCV_REG_NUM; i++) {
+        if (a->regs[i] != b->regs[i]) {
+            char name[8];
+            snprintf(name, sizeof(name), "x%d", i);
+            printf("  %-12s 0x%-18" PRIxWORD " 0x%-18" PRIxWORD "\n", name, a->regs[i], b->regs[i]);
+        }
+    }
+    if (a->instret != b->instret) {
+        printf("  %-12s %-20llu %-20llu\n", "instret", (unsigned long long)a->instret, (unsigned long long)b->instret);
+    }
+    if ((a->write_count != b->write_count) || (a->write_hash != b->write_hash)) {
+        printf("  %-12s %-20llu %-20llu\n", "writes", (unsigned long long)a->write_count, (unsigned long long)b->write_count);
+        printf("  %-12s %016llx     %016llx\n", "write hash", (unsigned long long)a->write_hash, (unsigned long long)b->write_hash);
+    }
+    if (a->stopped != b->stopped) {
+        printf("  %-12s %-20s %-20s\n", "stopped", a->stopped ? "yes" : "no", b->stopped ? "yes" : "no");
+    }
+}
+
+// 最近的存储器写入  从旧到新
+static void lockstep_report_writes(lockstep_engine_t* engine) {
+    riscv_write_log_t* log = &engine->log;
+    uint64_t first = (log->count > RISCV_WRITE_LOG_SIZE) ? log->count - RISCV_WRITE_LOG_SIZE : 0;
+    printf("  last writes of %s:\n", engine->name);
+    for (uint64_t i = first; i < log->count; i++) {
+        riscv_write_entry_t* entry = &log->entries[i & (RISCV_WRITE_LOG_SIZE - 1)];
+        printf("    #%llu [0x%" PRIxWORD "] <- 0x%llx (%d bytes)\n", (unsigned long long)i, entry->addr,
+            (unsigned long long)entry->value, entry->width);
+    }
+}
+
+// 区间 [start, start + steps) 中出现了不同: 从头执行到 start 然后逐条对比
+// start 之前两个引擎的结果相同 所以都用块缓存引擎快速前进 到达后参考引擎清空缓存 切换为逐条译码
+static int lockstep_locate(riscv_t* layout, const char* image, uint64_t start, uint64_t steps) {
+    lockstep_engine_t fast, ref;
+    if (lockstep_engine_init(&fast, layout, image, "block", 0) < 0) {
+        return -1;
+    }
+    if (lockstep_engine_init(&ref, layout, image, "reference", 0) < 0) {
+        lockstep_engine_free(&fast);
+        return -1;
+    }
+    lockstep_advance(&fast, start);
+    lockstep_advance(&ref, start);
+    ref.reference = 1;
+    riscv_block_flush(ref.riscv);
+
+    int found = 0;
+    for (uint64_t i = 0; (i < steps) && !fast.stopped && !ref.stopped; i++) {
+        riscv_word_t pc = fast.riscv->pc;
+        lockstep_advance(&fast, 1);
+        lockstep_advance(&ref, 1);
+
+        lockstep_state_t a, b;
+        lockstep_capture(&fast, &a);
+        lockstep_capture(&ref, &b);
+        if (!lockstep_same(&a, &b)) {
+            printf("lockstep: first divergence at step %llu, pc 0x%" PRIxWORD ", instruction 0x%08x\n",
+                (unsigned long long)(start + i), pc, (unsigned int)fast.riscv->instr.raw);
+            lockstep_report(fast.name, &a, ref.name, &b);
+            lockstep_report_writes(&fast);
+            lockstep_report_writes(&ref);
+            found = 1;
+            break;
+        }
+    }
+
+    // 逐条执行时结果相同: 问题只在一次执行整个块时出现
+    if (!found) {
+        printf("lockstep: no single-instruction divergence in steps %llu..%llu, the difference needs whole-block execution\n",
+            (unsigned long long)start, (unsigned long long)(start + steps));
+    }
+
+    lockstep_engine_free(&fast);
+    lockstep_engine_free(&ref);
+    return 0;
+}
+
+int lockstep_run(riscv_t* layout, const char* image, uint64_t interval, uint64_t limit) {
+    lockstep_engine_t fast, ref;
+    if (lockstep_engine_init(&fast, layout, image, "block", 0) < 0) {
+        return -1;
+    }
+    if (lockstep_engine_init(&ref, layout, image, "reference", 1) < 0) {
+        lockstep_engine_free(&fast);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t start = 0;
+    lockstep_state_t a, b;
+    memset(&a, 0, sizeof(a));
+    while (start < limit) {
+        uint64_t steps = (limit - start < interval) ? limit - start : interval;
+        lockstep_advance(&fast, steps);
+        lockstep_advance(&ref, steps);
+
+        lockstep_capture(&fast, &a);
+        lockstep_capture(&ref, &b);
+        if (!lockstep_same(&a, &b)) {
+            printf("lockstep: diverged between step %llu and %llu\n", (unsigned long long)start, (unsigned long long)(start + steps));
+            lockstep_report(fast.name, &a, ref.name, &b);
+            rc = 1;
+            break;
+        }
+        if (fast.stopped) {
+            break;
+        }
+        start += steps;
+    }
+
+    if (rc == 0) {
+        printf("lockstep: %s matched, %llu instructions retired, %llu writes\n", image,
+            (unsigned long long)a.instret, (unsigned long long)a.write_count);
+    }
+    lockstep_engine_free(&fast);
+    lockstep_engine_free(&ref);
+
+    if (rc) {
+        lockstep_locate(layout, image, start, (limit - start < interval) ? limit - start : interval);
+    }
+    return rc;
+}
+
+int lockstep_record(riscv_t* layout, const char* image, const char* trace, uint64_t interval, uint64_t limit) {
+    FILE* file = fopen(trace, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "can't create lockstep trace %s\n", trace);
+        return -1;
+    }
+
+    lockstep_engine_t fast;
+    if (lockstep_engine_init(&fast, layout, image, "block", 0) < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    lockstep_header_t header = { LOCKSTEP_MAGIC, RISCV_XLEN, interval };
+    fwrite(&header, sizeof(header), 1, file);
+
+    uint64_t records = 0;
+    lockstep_state_t state;
+    memset(&state, 0, sizeof(state));
+    while (fast.step < limit) {
+        uint64_t steps = (limit - fast.step < interval) ? limit - fast.step : interval;
+        lockstep_advance(&fast, steps);
+        lockstep_capture(&fast, &state);
+        fwrite(&state, sizeof(state), 1, file);
+        records++;
+        if (fast.stopped) {
+            break;
+        }
+    }
+
+    int rc = ferror(file) ? -1 : 0;
+    fclose(file);
+    printf("lockstep: recorded %llu states of %s, %llu instructions retired\n", (unsigned long long)records, image,
+        (unsigned long long)state.instret);
+    lockstep_engine_free(&fast);
+    return rc;
+}
+
+int lockstep_check(riscv_t* layout, const char* image, const char* trace) {
+    FILE* file = fopen(trace, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "can't open lockstep trace %s\n", trace);
+        return -1;
+    }
+
+    lockstep_header_t header;
+    if ((fread(&header, sizeof(header), 1, file) != 1) || (header.magic != LOCKSTEP_MAGIC) || (header.xlen != RISCV_XLEN) || !header.interval) {
+        fprintf(stderr, "%s is not a lockstep trace for rv%d\n", trace, RISCV_XLEN);
+        fclose(file);
+        return -1;
+    }
+
+    lockstep_engine_t fast;
+    if (lockstep_engine_init(&fast, layout, image, "block", 0) < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    int rc = 0;
+    lockstep_state_t expect, actual;
+    memset(&actual, 0, sizeof(actual));
+    while (fread(&expect, sizeof(expect), 1, file) == 1) {
+        // 没有停止的记录步数必须递增  否则轨迹与镜像不对应或者已经损坏 不能用来计算区间的长度
+        uint64_t start = fast.step;
+        if (!expect.stopped && (expect.step <= start)) {
+            lockstep_capture(&fast, &actual);
+            printf("lockstep: diverged from %s at step %llu, the trace expects step %llu\n", trace, (unsigned long long)start,
+                (unsigned long long)expect.step);
+            lockstep_report("trace", &expect, fast.name, &actual);
+            rc = 1;
+            break;
+        }
+
+        // 停止的记录不知道区间的长度 按完整的区间执行
+        uint64_t steps = expect.stopped ? header.interval : expect.step - start;
+        lockstep_advance(&fast, steps);
+        lockstep_capture(&fast, &actual);
+        if (!lockstep_same(&expect, &actual)) {
+            printf("lockstep: diverged from %s between step %llu and %llu\n", trace, (unsigned long long)start,
+                (unsigned long long)(start + steps));
+            lockstep_report("trace", &expect, fast.name, &actual);
+            lockstep_report_writes(&fast);
+            printf("  record again with a smaller -lockstep-interval to narrow it down\n");
+            rc = 1;
+            break;
+        }
+    }
+
+    if (rc == 0) {
+        printf("lockstep: %s matched %s, %llu instructions retired\n", image, trace, (unsigned long long)actual.instret);
+    }
+    fclose(file);
+    lockstep_engine_free(&fast);
+    return rc;
+}
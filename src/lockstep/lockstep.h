@@ -0,0 +1,26 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "plat/plat.h"
+
+// 避免头文件嵌套 使用前向定义
+struct _riscv_t;
+
+/* 锁步对比: 同一个镜像由块缓存执行引擎和参考引擎 (逐条执行 每条指令重新译码) 分别执行 或者与记录的黄金轨迹对比
+ * 每执行 interval 步对比一次 pc 寄存器和存储器写入记录的散列  步数与 riscv_run_budget 的配额相同 进入 trap 也算一步
+ * 两个引擎出现不同时 从头重新执行到出错区间的起点 再逐条对比 报告第一条结果不同的指令
+ * 黄金轨迹只保存每个区间结束时的状态 出现不同时报告区间 可以用更小的 interval 重新记录和对比来缩小范围 */
+#define LOCKSTEP_DEFAULT_INTERVAL   100000
+#define LOCKSTEP_DEFAULT_LIMIT      10000000000ull  // 最多执行的步数
+
+// 对比块缓存引擎与参考引擎  两个引擎各自使用按 layout 布局分配的实例
+// 结果相同返回 0  出现不同返回 1  镜像无法加载返回 -1
+int lockstep_run(struct _riscv_t* layout, const char* image, uint64_t interval, uint64_t limit);
+
+// 用块缓存引擎执行镜像 把每个区间结束时的状态写入轨迹文件  成功返回 0
+int lockstep_record(struct _riscv_t* layout, const char* image, const char* trace, uint64_t interval, uint64_t limit);
+
+// 用块缓存引擎执行镜像 与轨迹文件逐个区间对比  区间大小使用记录时的值  返回值与 lockstep_run 相同
+int lockstep_check(struct _riscv_t* layout, const char* image, const char* trace);
+
+#endif /* LOCKSTEP_H */
@@ -11,6 +11,12 @@
 // 会反复的出现 LNK2019 的报错  删掉 build-folder 重新构建
 #include "core/instr_implements.h"
 #include "test/instr_test.h"
+#include "device/framebuffer.h"
+#include "device/blk.h"
+#include "device/dma.h"
+#include "batch/batch.h"
+#include "fuzz/fuzz.h"
+#include "lockstep/lockstep.h"
 
 // 定义命令行参数的语法
 // riscv-sim -p 1234 -ram 0:xxx -flash 0:xxx
@@ -18,11 +24,35 @@ static void print_help_info(const char* file_name) {
     fprintf(stderr,
         "usage: %s [options] <elf file>\n"
         "-help              | print help info\n"
+        "-image file        | load a raw binary image at the start of Flash and run it\n"
         "-test              | instructions unit tests\n"
+        "-jobs n            | with -test or -batch, run on n threads (default: host cores)\n"
+        "-junit file        | with -test, also write a JUnit XML report to file\n"
+        "-batch manifest    | run every image listed in manifest, print one JSON line per job and exit\n"
+        "-fuzz image        | boot image to its first ebreak, then run inputs from there as an AFL++ fork server\n"
+        "-fuzz-input file   | with -fuzz, the input file AFL++ writes (@@), or '-' for stdin (default)\n"
+        "-fuzz-timeout n    | with -fuzz, stop each input after n instructions (default: no limit)\n"
+        "-lockstep image    | run image on the block engine and a decode-every-instruction reference, report the first divergence\n"
+        "-lockstep-record f | with -lockstep, write the block engine's states to golden trace f instead\n"
+        "-lockstep-golden f | with -lockstep, compare the block engine against golden trace f instead\n"
+        "-lockstep-interval n | compare states every n instructions (default 100000)\n"
+        "-lockstep-limit n  | stop lockstep runs after n instructions (default 10000000000)\n"
         "-debug port        | run step by step and it is optional to define your debug info port\n"
         "-ram start:size    | set start addres of RAM and size\n"
         "-flash start:size  | set start address of Flash and size\n"
         "-info              | print debug info on terminal\n"
+        "-display w:h       | attach a w x h ARGB8888 framebuffer and open a window\n"
+        "-headless dir      | no window, write captured frames to dir as PPM ('-' for hash only)\n"
+        "-capture-ms n      | with -headless, also capture a frame every n ms of guest time\n"
+        "-disk image        | attach image as an mmap'd block device\n"
+        "-disk-wb           | defer disk writes to disk until the guest flushes\n"
+        "-cpi n             | count n cycles per retired instruction in mcycle/time (default 1)\n"
+        "-smp n             | run n harts, each on its own host thread (default 1)\n"
+        "-quantum n         | deterministic mode: round-robin harts on one thread, n instructions each\n"
+        "-seed n            | with -quantum, shuffle the hart order every round from seed n\n"
+        "-workers n         | schedule harts on a pool of n work-stealing threads, parking harts in wfi\n"
+        "-slice n           | with -workers, run each hart n instructions per turn (default 10000)\n"
+        "-prefetch          | give every hart a thread that predecodes blocks ahead of the pc\n"
         ,file_name
     );
 }
@@ -40,6 +70,15 @@ static void arg_check(char* args) {
 #define RISCV_RAM_START                 0x20000000              // 根据测试工程决定在这个位置
 #define RISCV_RAM_SIZE                  (16 * 1024 * 1024)
 
+#define RISCV_FB_START                  0x40000000              // 显存映射地址
+#define RISCV_BLK_START                 0x30000000              // 块设备寄存器地址
+#define RISCV_DMA_START                 0x30001000              // DMA 控制器寄存器地址
+
+// 外部中断线编号 共享 MEIP
+#define RISCV_BLK_IRQ                   0
+#define RISCV_DMA_IRQ                   1
+#define RISCV_FB_IRQ                    2
+
 int main(int argc, char** argv) {
     plat_init();
 
@@ -56,9 +95,28 @@ int main(int argc, char** argv) {
     int ram_define_flag = 0;
     int flash_define_flag = 0;
     int run_test_flag = 0;
+    int test_jobs = 0;                  // 0 表示按宿主机处理器数量
+    const char* junit_path = NULL;
+    const char* batch_manifest = NULL;
+    const char* fuzz_image = NULL;
+    const char* fuzz_input = "-";
+    uint64_t fuzz_timeout = 0;
+    const char* lockstep_image = NULL;
+    const char* lockstep_record_path = NULL;
+    const char* lockstep_golden_path = NULL;
+    uint64_t lockstep_interval = LOCKSTEP_DEFAULT_INTERVAL;
+    uint64_t lockstep_limit = LOCKSTEP_DEFAULT_LIMIT;
     int default_debug_port = 1234;
     int debug_mode = 0;                 // 默认不开启
     int print_debug_info = 0;
+    framebuffer_t* myDisplay = NULL;
+    const char* headless_dir = NULL;
+    int capture_ms = 0;
+    const char* disk_image = NULL;
+    int disk_write_back = 0;
+    int hart_count = 1;
+    int prefetch = 0;
+    const char* run_image = NULL;
 
     while(arg_index < argc) {
         char* currArg = argv[arg_index++];
@@ -86,7 +144,9 @@ int main(int argc, char** argv) {
             mem_t* myRAM = mem_create("ram", RISCV_MEM_ATTR_READABLE | RISCV_MEM_ATTR_WRITABLE, ram_start_addr, ram_size);
             // 不要求外部设备类型一定是 Memory 所以是通过 device_t 结构体去控制  要进行强制类型转换
             // (riscv_device_t* myRAM)  也可以  只是挂了一个控制体上去  省区了 uint8_t* 的指针
-            riscv_device_add(myRiscv, &myRAM->riscv_dev);
+            if (riscv_device_add(myRiscv, &myRAM->riscv_dev) < 0) {
+                exit(-1);
+            }
 
             // 更新自定义标志
             ram_define_flag = 1;
@@ -103,7 +163,9 @@ int main(int argc, char** argv) {
             uint32_t flash_size = strtoul(flash_define, NULL, 16);
 
             mem_t* myMemory = mem_create("flash", RISCV_MEM_ATTR_READABLE, flash_start_addr, flash_size);
-            riscv_device_add(myRiscv, (riscv_device_t*) myMemory);
+            if (riscv_device_add(myRiscv, (riscv_device_t*) myMemory) < 0) {
+                exit(-1);
+            }
             riscv_flash_set(myRiscv, myMemory);
 
             flash_define_flag = 1;
@@ -119,6 +181,67 @@ int main(int argc, char** argv) {
             run_test_flag = 1;
         }
 
+        if (strcmp(currArg, "-jobs") == 0) {
+            char* jobs_args = argv[arg_index++];
+            arg_check(jobs_args);
+            test_jobs = strtoul(jobs_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-junit") == 0) {
+            char* junit_args = argv[arg_index++];
+            arg_check(junit_args);
+            junit_path = junit_args;
+        }
+
+        if (strcmp(currArg, "-batch") == 0) {
+            char* batch_args = argv[arg_index++];
+            arg_check(batch_args);
+            batch_manifest = batch_args;
+        }
+
+        if (strcmp(currArg, "-fuzz") == 0) {
+            fuzz_image = argv[arg_index++];
+            arg_check((char*)fuzz_image);
+        }
+
+        if (strcmp(currArg, "-fuzz-input") == 0) {
+            fuzz_input = argv[arg_index++];
+            arg_check((char*)fuzz_input);
+        }
+
+        if (strcmp(currArg, "-fuzz-timeout") == 0) {
+            char* fuzz_timeout_args = argv[arg_index++];
+            arg_check(fuzz_timeout_args);
+            fuzz_timeout = strtoull(fuzz_timeout_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-lockstep") == 0) {
+            lockstep_image = argv[arg_index++];
+            arg_check((char*)lockstep_image);
+        }
+
+        if (strcmp(currArg, "-lockstep-record") == 0) {
+            lockstep_record_path = argv[arg_index++];
+            arg_check((char*)lockstep_record_path);
+        }
+
+        if (strcmp(currArg, "-lockstep-golden") == 0) {
+            lockstep_golden_path = argv[arg_index++];
+            arg_check((char*)lockstep_golden_path);
+        }
+
+        if (strcmp(currArg, "-lockstep-interval") == 0) {
+            char* interval_args = argv[arg_index++];
+            arg_check(interval_args);
+            lockstep_interval = strtoull(interval_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-lockstep-limit") == 0) {
+            char* limit_args = argv[arg_index++];
+            arg_check(limit_args);
+            lockstep_limit = strtoull(limit_args, NULL, 10);
+        }
+
         if (strcmp(currArg, "-debug") == 0) {
             // 只有要求以 debug 方式编译的时候才保存 gdb 信息 提高效率
             // 用户自定义端口只有处于 debug 状态的时候才有意义  所以把 port 定义在里面
@@ -133,12 +256,113 @@ int main(int argc, char** argv) {
         if (strcmp(currArg, "-info") == 0) {
             print_debug_info = 1;
         }
+
+        if (strcmp(currArg, "-display") == 0) {
+            // 显示分辨率以十进制表示 例如 -display 640:480
+            char* display_args = argv[arg_index++];
+            arg_check(display_args);
+
+            char* display_define = strtok(display_args, ":");
+            int display_width = strtoul(display_define, NULL, 10);
+            display_define = strtok(NULL, ":");
+            arg_check(display_define);
+            int display_height = strtoul(display_define, NULL, 10);
+
+            myDisplay = framebuffer_create("display", RISCV_FB_START, display_width, display_height);
+            if ((myDisplay == NULL) || (riscv_device_add(myRiscv, &myDisplay->riscv_dev) < 0) || (framebuffer_input(myDisplay, myRiscv, RISCV_FB_IRQ) < 0)) {
+                exit(-1);
+            }
+        }
+
+        if (strcmp(currArg, "-headless") == 0) {
+            headless_dir = argv[arg_index++];
+            arg_check((char*)headless_dir);
+        }
+
+        if (strcmp(currArg, "-disk") == 0) {
+            disk_image = argv[arg_index++];
+            arg_check((char*)disk_image);
+        }
+
+        if (strcmp(currArg, "-disk-wb") == 0) {
+            disk_write_back = 1;
+        }
+
+        if (strcmp(currArg, "-capture-ms") == 0) {
+            char* capture_args = argv[arg_index++];
+            arg_check(capture_args);
+            capture_ms = strtoul(capture_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-cpi") == 0) {
+            char* cpi_args = argv[arg_index++];
+            arg_check(cpi_args);
+            riscv_set_cpi(myRiscv, strtoul(cpi_args, NULL, 10));
+        }
+
+        if (strcmp(currArg, "-smp") == 0) {
+            char* smp_args = argv[arg_index++];
+            arg_check(smp_args);
+            hart_count = strtoul(smp_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-quantum") == 0) {
+            char* quantum_args = argv[arg_index++];
+            arg_check(quantum_args);
+            myRiscv->machine->quantum = strtoull(quantum_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-seed") == 0) {
+            char* seed_args = argv[arg_index++];
+            arg_check(seed_args);
+            myRiscv->machine->seed = strtoull(seed_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-workers") == 0) {
+            char* workers_args = argv[arg_index++];
+            arg_check(workers_args);
+            myRiscv->machine->workers = strtoul(workers_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-slice") == 0) {
+            char* slice_args = argv[arg_index++];
+            arg_check(slice_args);
+            myRiscv->machine->slice = strtoull(slice_args, NULL, 10);
+        }
+
+        if (strcmp(currArg, "-prefetch") == 0) {
+            prefetch = 1;
+        }
+
+        if (strcmp(currArg, "-image") == 0) {
+            run_image = argv[arg_index++];
+            arg_check((char*)run_image);
+        }
+    }
+
+    // 其余 hart 共享同一套存储器和外设  CPI 与启动 hart 相同
+    for (int i = 1; i < hart_count; i++) {
+        riscv_t* hart = riscv_hart_add(myRiscv->machine);
+        if (hart == NULL) {
+            fprintf(stderr, "-smp supports at most %d harts\n", RISCV_MAX_HARTS);
+            exit(-1);
+        }
+        riscv_set_cpi(hart, myRiscv->cpi);
+    }
+
+    // 预译码线程在 hart 第一次取指未命中之前一直空闲
+    for (int i = 0; prefetch && (i < myRiscv->machine->hart_count); i++) {
+        if (riscv_prefetch_start(myRiscv->machine->harts[i]) < 0) {
+            exit(-1);
+        }
     }
 
     // 判断一下是否使用默认 RAM 参数
     if (ram_define_flag == 0) {
         mem_t* myRAM = mem_create("ram", RISCV_MEM_ATTR_READABLE | RISCV_MEM_ATTR_WRITABLE, RISCV_RAM_START, RISCV_RAM_SIZE);
-        riscv_device_add(myRiscv, &myRAM->riscv_dev);
+        if (riscv_device_add(myRiscv, &myRAM->riscv_dev) < 0) {
+            exit(-1);
+        }
     }
 
     // 创建 Flash 空间
@@ -146,18 +370,51 @@ int main(int argc, char** argv) {
         mem_t* myMemory = mem_create("flash", RISCV_MEM_ATTR_READABLE, RISCV_FLASH_START, RISCV_FLASH_SIZE);
 
         // 挂载到模拟器中
-        riscv_device_add(myRiscv, (riscv_device_t*) myMemory);
+        if (riscv_device_add(myRiscv, (riscv_device_t*) myMemory) < 0) {
+            exit(-1);
+        }
         riscv_flash_set(myRiscv, myMemory);
     }
 
-    // 读取 image.bin 文件到 Flash 空间
-    // flash_load_bin(myRiscv, "./unit/ebreak/obj/image.bin");
-    // riscv_reset(myRiscv);
-    // fprintf(stdout, "myRiscv has reset with pc = %d", myRiscv->pc);
+    // 读取镜像文件到 Flash 空间  所有 hart 都从 Flash 起始地址开始执行 复位在 riscv_run 中完成
+    if (run_image && (riscv_load_bin(myRiscv, run_image) < 0)) {
+        exit(-1);
+    }
 
     // 代码框架实际给了完整的测试用例 可以不用自己手动写
     if (run_test_flag) {
-        instr_test(myRiscv);    // 会自己去调用 test_riscv_instr()
+        // 每个测试使用和 myRiscv 相同布局的独立实例 并行执行  有失败时直接退出
+        if (instr_test(myRiscv, test_jobs, junit_path)) {
+            exit(-1);
+        }
+    }
+
+    // 批量模式: 每个线程按照 myRiscv 的存储器布局预先分配一个实例 执行完清单中的所有镜像后退出
+    if (batch_manifest) {
+        exit(batch_run(myRiscv, batch_manifest, test_jobs) ? -1 : 0);
+    }
+
+    // 模糊测试模式: 在 fork 出的子进程中从快照点执行每个输入  不启动调试器 DMA 以外的后台线程
+    if (fuzz_image) {
+        exit(fuzz_run(myRiscv, fuzz_image, fuzz_input, fuzz_timeout));
+    }
+
+    // 锁步对比: 与批量模式一样按 myRiscv 的存储器布局分配独立的实例  结果相同时退出码为 0
+    if (lockstep_image) {
+        int rc;
+        if (lockstep_interval == 0) {
+            lockstep_interval = LOCKSTEP_DEFAULT_INTERVAL;
+        }
+        if (lockstep_record_path) {
+            rc = lockstep_record(myRiscv, lockstep_image, lockstep_record_path, lockstep_interval, lockstep_limit);
+        }
+        else if (lockstep_golden_path) {
+            rc = lockstep_check(myRiscv, lockstep_image, lockstep_golden_path);
+        }
+        else {
+            rc = lockstep_run(myRiscv, lockstep_image, lockstep_interval, lockstep_limit);
+        }
+        exit(rc ? -1 : 0);
     }
 
     // 根据模式定义判断是否以 debug 模式启动
@@ -169,7 +426,41 @@ int main(int argc, char** argv) {
         myRiscv->gdb_server = gdb_server;
     }
 
+    // DMA 控制器默认挂载
+    dma_t* myDma = dma_create(myRiscv, "dma", RISCV_DMA_START, RISCV_DMA_IRQ);
+    if (riscv_device_add(myRiscv, &myDma->riscv_dev) < 0) {
+        exit(-1);
+    }
+
+    // 块设备在参数解析完成之后创建 这样 -disk-wb 与 -disk 的先后顺序无关
+    if (disk_image) {
+        blk_t* myDisk = blk_create(myRiscv, "disk", RISCV_BLK_START, RISCV_BLK_IRQ, disk_image, disk_write_back);
+        if (myDisk == NULL) {
+            exit(-1);
+        }
+        if (riscv_device_add(myRiscv, &myDisk->riscv_dev) < 0) {
+            exit(-1);
+        }
+    }
+
+    if (headless_dir && (myDisplay == NULL)) {
+        fprintf(stderr, "-headless requires -display w:h\n");
+        exit(-1);
+    }
+
+    // 渲染线程只在所有参数解析完成后启动  无头模式不初始化 SDL 只启动抓帧线程
+    if (headless_dir) {
+        framebuffer_capture_start(myDisplay, myRiscv, strcmp(headless_dir, "-") == 0 ? NULL : headless_dir, capture_ms);
+    }
+    else if (myDisplay) {
+        framebuffer_show(myDisplay);
+    }
+
     riscv_run(myRiscv);
 
+    if (headless_dir) {
+        framebuffer_capture_flush(myDisplay);
+    }
+
     return 0;
 }
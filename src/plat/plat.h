@@ -1,6 +1,8 @@
 ﻿#ifndef PLAT_H
 #define PLAT_H
 
+#include <stdint.h>
+
 #ifdef _WIN32
 
 #include <Windows.h>
@@ -42,6 +44,175 @@ static void thread_msleep(int ms) {
 	Sleep(ms);
 }
 
+// 单调时钟 单位毫秒	只用于统计耗时
+static inline uint64_t plat_time_ms(void) {
+	return (uint64_t)GetTickCount64();
+}
+
+// 单调时钟 单位微秒	统计单个短任务的耗时
+static inline uint64_t plat_time_us(void) {
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000 + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+// 宿主机的逻辑处理器数量	决定并行任务使用多少个线程
+static inline int plat_cpu_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+// 线程私有的全局变量
+#define THREAD_LOCAL	__declspec(thread)
+
+// 要求编译器一定内联 常量参数可以在每个调用处展开成不同的版本
+#define FORCE_INLINE	__forceinline
+
+// 多线程共享数据的原子操作	设备线程与 CPU 线程之间使用
+static inline uint32_t atomic_xchg_u32(volatile uint32_t* ptr, uint32_t val) {
+	return (uint32_t)InterlockedExchange((volatile LONG*)ptr, (LONG)val);
+}
+
+static inline uint32_t atomic_or_u32(volatile uint32_t* ptr, uint32_t val) {
+	return (uint32_t)InterlockedOr((volatile LONG*)ptr, (LONG)val);
+}
+
+static inline uint32_t atomic_and_u32(volatile uint32_t* ptr, uint32_t val) {
+	return (uint32_t)InterlockedAnd((volatile LONG*)ptr, (LONG)val);
+}
+
+static inline uint32_t atomic_xor_u32(volatile uint32_t* ptr, uint32_t val) {
+	return (uint32_t)InterlockedXor((volatile LONG*)ptr, (LONG)val);
+}
+
+static inline uint32_t atomic_add_u32(volatile uint32_t* ptr, uint32_t val) {
+	return (uint32_t)InterlockedExchangeAdd((volatile LONG*)ptr, (LONG)val);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t* ptr) {
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)ptr, 0, 0);
+}
+
+static inline void atomic_store_u32(volatile uint32_t* ptr, uint32_t val) {
+	InterlockedExchange((volatile LONG*)ptr, (LONG)val);
+}
+
+// *ptr 等于 expected 时写入 desired 并返回 1 否则返回 0
+static inline int atomic_cas_u32(volatile uint32_t* ptr, uint32_t expected, uint32_t desired) {
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)ptr, (LONG)desired, (LONG)expected) == expected;
+}
+
+// 64 位版本 供 RV64 的 .d 原子指令使用
+static inline uint64_t atomic_xchg_u64(volatile uint64_t* ptr, uint64_t val) {
+	return (uint64_t)InterlockedExchange64((volatile LONG64*)ptr, (LONG64)val);
+}
+
+static inline uint64_t atomic_or_u64(volatile uint64_t* ptr, uint64_t val) {
+	return (uint64_t)InterlockedOr64((volatile LONG64*)ptr, (LONG64)val);
+}
+
+static inline uint64_t atomic_and_u64(volatile uint64_t* ptr, uint64_t val) {
+	return (uint64_t)InterlockedAnd64((volatile LONG64*)ptr, (LONG64)val);
+}
+
+static inline uint64_t atomic_xor_u64(volatile uint64_t* ptr, uint64_t val) {
+	return (uint64_t)InterlockedXor64((volatile LONG64*)ptr, (LONG64)val);
+}
+
+static inline uint64_t atomic_add_u64(volatile uint64_t* ptr, uint64_t val) {
+	return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)ptr, (LONG64)val);
+}
+
+static inline uint64_t atomic_load_u64(volatile uint64_t* ptr) {
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)ptr, 0, 0);
+}
+
+static inline int atomic_cas_u64(volatile uint64_t* ptr, uint64_t expected, uint64_t desired) {
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)ptr, (LONG64)desired, (LONG64)expected) == expected;
+}
+
+// 完整的内存屏障	fence 指令使用
+static inline void atomic_fence(void) {
+	MemoryBarrier();
+}
+
+// 互斥锁与条件变量	用于设备线程之间的任务队列
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+
+static inline void mutex_init(mutex_t* mutex) {
+	InitializeCriticalSection(mutex);
+}
+
+static inline void mutex_lock(mutex_t* mutex) {
+	EnterCriticalSection(mutex);
+}
+
+static inline void mutex_unlock(mutex_t* mutex) {
+	LeaveCriticalSection(mutex);
+}
+
+static inline void cond_init(cond_t* cond) {
+	InitializeConditionVariable(cond);
+}
+
+static inline void cond_wait(cond_t* cond, mutex_t* mutex) {
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static inline void cond_broadcast(cond_t* cond) {
+	WakeAllConditionVariable(cond);
+}
+
+// 文件映射	把磁盘镜像直接映射到进程地址空间 读写即访问对应的页
+typedef struct _file_map_t {
+	uint8_t* addr;
+	size_t size;
+	HANDLE file;
+	HANDLE mapping;
+}file_map_t;
+
+static int file_map_open(file_map_t* map, const char* path) {
+	map->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE) {
+		return -1;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(map->file, &size);
+	map->size = (size_t)size.QuadPart;
+
+	map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (map->mapping == NULL) {
+		CloseHandle(map->file);
+		return -1;
+	}
+
+	map->addr = (uint8_t*)MapViewOfFile(map->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (map->addr == NULL) {
+		CloseHandle(map->mapping);
+		CloseHandle(map->file);
+		return -1;
+	}
+	return 0;
+}
+
+// 把 [offset, offset + size) 范围内的脏页写回磁盘
+static int file_map_sync(file_map_t* map, size_t offset, size_t size) {
+	if (!FlushViewOfFile(map->addr + offset, size)) {
+		return -1;
+	}
+	return FlushFileBuffers(map->file) ? 0 : -1;
+}
+
+static void file_map_close(file_map_t* map) {
+	UnmapViewOfFile(map->addr);
+	CloseHandle(map->mapping);
+	CloseHandle(map->file);
+}
+
 // 使用 Winsock 之前的固定流程
 static void plat_init(void) {
 	// WORD: 16 位无符号整数类型
@@ -71,6 +242,9 @@ static void plat_init(void) {
 #include <assert.h>
 #include <pthread.h>
 #include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #define SOCKET_ERROR 	-1
 #define INVALID_SOCKET	-1
@@ -104,8 +278,218 @@ static void thread_msleep(int ms) {
 	usleep(ms * 1000);
 }
 
+static inline uint64_t plat_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t plat_time_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static inline int plat_cpu_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (int)count : 1;
+}
+
+#define THREAD_LOCAL	__thread
+
+#define FORCE_INLINE	inline __attribute__((always_inline))
+
+// 返回修改前的值	交换操作同时带有 acquire/release 语义
+static inline uint32_t atomic_xchg_u32(volatile uint32_t* ptr, uint32_t val) {
+	return __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t atomic_or_u32(volatile uint32_t* ptr, uint32_t val) {
+	return __atomic_fetch_or(ptr, val, __ATOMIC_ACQ_REL);
+}
+
+// 以下操作按照 RISC-V AMO 的 aq + rl 语义 统一使用顺序一致
+static inline uint32_t atomic_and_u32(volatile uint32_t* ptr, uint32_t val) {
+	return __atomic_fetch_and(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_xor_u32(volatile uint32_t* ptr, uint32_t val) {
+	return __atomic_fetch_xor(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_add_u32(volatile uint32_t* ptr, uint32_t val) {
+	return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+// 写入带有 release 语义 之前的写操作对随后用 atomic_load_u32 读到该值的线程可见
+static inline void atomic_store_u32(volatile uint32_t* ptr, uint32_t val) {
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline int atomic_cas_u32(volatile uint32_t* ptr, uint32_t expected, uint32_t desired) {
+	return __atomic_compare_exchange_n(ptr, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// 64 位版本 供 RV64 的 .d 原子指令使用
+static inline uint64_t atomic_xchg_u64(volatile uint64_t* ptr, uint64_t val) {
+	return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_or_u64(volatile uint64_t* ptr, uint64_t val) {
+	return __atomic_fetch_or(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_and_u64(volatile uint64_t* ptr, uint64_t val) {
+	return __atomic_fetch_and(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_xor_u64(volatile uint64_t* ptr, uint64_t val) {
+	return __atomic_fetch_xor(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_add_u64(volatile uint64_t* ptr, uint64_t val) {
+	return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_load_u64(volatile uint64_t* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_cas_u64(volatile uint64_t* ptr, uint64_t expected, uint64_t desired) {
+	return __atomic_compare_exchange_n(ptr, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_fence(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+
+static inline void mutex_init(mutex_t* mutex) {
+	pthread_mutex_init(mutex, NULL);
+}
+
+static inline void mutex_lock(mutex_t* mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+static inline void mutex_unlock(mutex_t* mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+static inline void cond_init(cond_t* cond) {
+	pthread_cond_init(cond, NULL);
+}
+
+static inline void cond_wait(cond_t* cond, mutex_t* mutex) {
+	pthread_cond_wait(cond, mutex);
+}
+
+static inline void cond_broadcast(cond_t* cond) {
+	pthread_cond_broadcast(cond);
+}
+
+typedef struct _file_map_t {
+	uint8_t* addr;
+	size_t size;
+	int fd;
+}file_map_t;
+
+static int file_map_open(file_map_t* map, const char* path) {
+	map->fd = open(path, O_RDWR);
+	if (map->fd < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(map->fd, &st) < 0) {
+		close(map->fd);
+		return -1;
+	}
+	map->size = (size_t)st.st_size;
+
+	// MAP_SHARED: 对映射区的修改会直接反映到文件中
+	map->addr = (uint8_t*)mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (map->addr == MAP_FAILED) {
+		close(map->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static int file_map_sync(file_map_t* map, size_t offset, size_t size) {
+	// msync 要求起始地址按页对齐
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t aligned = offset & ~(page - 1);
+	return msync(map->addr + aligned, size + (offset - aligned), MS_SYNC);
+}
+
+static void file_map_close(file_map_t* map) {
+	munmap(map->addr, map->size);
+	close(map->fd);
+}
+
 static void plat_init(void) {
 }
 #endif
 
+#include <string.h>
+
+// 单生产者单消费者环形队列	设备线程向 CPU 线程传递事件 两边都不加锁
+// tail 只由生产者写 head 只由消费者写  下标一直递增 用 mask 取模 所以容量必须是 2 的幂
+// 两个下标放在不同的缓存行中 避免生产者和消费者互相使对方的缓存行失效
+typedef struct _spsc_ring_t {
+	uint8_t* buf;
+	uint32_t elem_size;
+	uint32_t mask;
+	volatile uint32_t head;
+	uint8_t head_pad[60];
+	volatile uint32_t tail;
+	uint8_t tail_pad[60];
+}spsc_ring_t;
+
+static inline int spsc_ring_init(spsc_ring_t* ring, uint32_t elem_size, uint32_t capacity) {
+	assert((capacity & (capacity - 1)) == 0);
+	ring->buf = (uint8_t*)malloc((size_t)elem_size * capacity);
+	ring->elem_size = elem_size;
+	ring->mask = capacity - 1;
+	ring->head = ring->tail = 0;
+	return ring->buf ? 0 : -1;
+}
+
+// 生产者调用 队列满时返回 -1
+static inline int spsc_ring_push(spsc_ring_t* ring, const void* elem) {
+	uint32_t tail = ring->tail;
+	if (tail - atomic_load_u32(&ring->head) > ring->mask) {
+		return -1;
+	}
+
+	// 先写元素再发布新的 tail
+	memcpy(ring->buf + (size_t)(tail & ring->mask) * ring->elem_size, elem, ring->elem_size);
+	atomic_store_u32(&ring->tail, tail + 1);
+	return 0;
+}
+
+// 消费者调用 一次最多取出 max 个元素 返回实际取出的数量
+static inline uint32_t spsc_ring_pop(spsc_ring_t* ring, void* elems, uint32_t max) {
+	uint32_t head = ring->head;
+	uint32_t count = atomic_load_u32(&ring->tail) - head;
+	if (count > max) {
+		count = max;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy((uint8_t*)elems + (size_t)i * ring->elem_size, ring->buf + (size_t)((head + i) & ring->mask) * ring->elem_size, ring->elem_size);
+	}
+
+	// 元素读完之后才释放位置
+	atomic_store_u32(&ring->head, head + count);
+	return count;
+}
+
 #endif // !PLAT_H